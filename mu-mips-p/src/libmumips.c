@@ -0,0 +1,555 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mu-mips.h"
+#include "libmumips.h"
+
+struct mumips {
+	sim_context_t context;		/* machine state while swapped out */
+	uint8_t *mem[NUM_MEM_REGION];	/* this instance's guest memory */
+	int forwarding;
+	int trace;
+	int activity;
+	machine_t machine;		/* stage depths, latencies and forwarding paths */
+	uint32_t *program;		/* image reloaded by mumips_reset */
+	uint32_t program_size;
+	uint8_t *data;			/* assembled .data, reloaded with the program */
+	uint32_t data_base, data_size;
+	uint8_t *dirty_map;		/* pages to zero on the next reset */
+	uint32_t *dirty_list;
+	uint32_t num_dirty, max_dirty;
+	int guest_files[MAX_GUEST_FILES];	/* host fds behind the guest's open files */
+};
+
+mumips_t *ACTIVE_SIM = NULL;	/* handle whose state is in the globals */
+
+/***************************************************************/
+/* Copy the globals back into the active handle                                              */
+/***************************************************************/
+void mumips_save(mumips_t *sim)
+{
+	int i;
+
+	save_context(&sim->context);
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		sim->mem[i] = MEM_REGIONS[i].mem;
+	}
+	sim->forwarding = ENABLE_FORWARDING;
+	sim->trace = TRACE_ENABLED;
+	sim->activity = ENABLE_ACTIVITY;
+	sim->machine = MACHINE;
+	sim->dirty_map = DIRTY_MAP;
+	sim->dirty_list = DIRTY_LIST;
+	sim->num_dirty = NUM_DIRTY;
+	sim->max_dirty = MAX_DIRTY;
+	memcpy(sim->guest_files, GUEST_FILES, sizeof(GUEST_FILES));
+}
+
+/***************************************************************/
+/* Make sim the instance the core functions operate on                           */
+/***************************************************************/
+void mumips_activate(mumips_t *sim)
+{
+	int i;
+
+	if (ACTIVE_SIM == sim) {
+		return;
+	}
+	if (ACTIVE_SIM != NULL) {
+		mumips_save(ACTIVE_SIM);
+	}
+	restore_context(&sim->context);
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		MEM_REGIONS[i].mem = sim->mem[i];
+	}
+	ENABLE_FORWARDING = sim->forwarding;
+	TRACE_ENABLED = sim->trace;
+	ENABLE_ACTIVITY = sim->activity;
+	MACHINE = sim->machine;
+	PROGRAM_SIZE = sim->program_size;
+	DIRTY_MAP = sim->dirty_map;
+	DIRTY_LIST = sim->dirty_list;
+	NUM_DIRTY = sim->num_dirty;
+	MAX_DIRTY = sim->max_dirty;
+	memcpy(GUEST_FILES, sim->guest_files, sizeof(GUEST_FILES));
+	ACTIVE_SIM = sim;
+}
+
+/***************************************************************/
+/* New instance with empty memory and no program                                     */
+/***************************************************************/
+mumips_t *mumips_create(void)
+{
+	mumips_t *sim;
+	int i;
+
+	sim = calloc(1, sizeof(*sim));
+	if (sim == NULL) {
+		return NULL;
+	}
+	if (ACTIVE_SIM != NULL) {
+		mumips_save(ACTIVE_SIM);
+	}
+	/* map_region only reuses an address it was given */
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		MEM_REGIONS[i].mem = NULL;
+		map_region(i);
+		sim->mem[i] = MEM_REGIONS[i].mem;
+	}
+	ACTIVE_SIM = sim;
+	init_decoder();
+	ENABLE_FORWARDING = 0;
+	TRACE_ENABLED = 0;
+	ENABLE_ACTIVITY = 1;
+	default_machine(&MACHINE);
+	MEMSYS.touched = NULL;	/* the last instance's bitmap stays with it */
+	for (i = 0; i < MAX_GUEST_FILES; i++) {
+		GUEST_FILES[i] = -1;	/* and so do its open files */
+	}
+	/* resets then only clear the pages the last run wrote */
+	DIRTY_MAP = NULL;
+	DIRTY_LIST = NULL;
+	NUM_DIRTY = MAX_DIRTY = 0;
+	if (enable_dirty_tracking() != 0) {
+		mumips_destroy(sim);
+		return NULL;
+	}
+	mumips_reset(sim);
+	return sim;
+}
+
+/***************************************************************/
+/* Release an instance and its guest memory                                                  */
+/***************************************************************/
+void mumips_destroy(mumips_t *sim)
+{
+	int i;
+
+	if (sim == NULL) {
+		return;
+	}
+	if (ACTIVE_SIM == sim) {
+		mumips_save(sim);
+		MEMSYS.touched = NULL;
+		for (i = 0; i < NUM_MEM_REGION; i++) {
+			MEM_REGIONS[i].mem = NULL;
+		}
+		DIRTY_MAP = NULL;
+		DIRTY_LIST = NULL;
+		NUM_DIRTY = MAX_DIRTY = 0;
+		for (i = 0; i < MAX_GUEST_FILES; i++) {
+			GUEST_FILES[i] = -1;
+		}
+		ACTIVE_SIM = NULL;
+	}
+	for (i = 0; i < MAX_GUEST_FILES; i++) {
+		if (sim->guest_files[i] != -1) {
+			close(sim->guest_files[i]);
+		}
+	}
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if (sim->mem[i] != NULL) {
+			munmap(sim->mem[i], MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1);
+		}
+	}
+	free(sim->context.memsys.touched);
+	free(sim->dirty_map);
+	free(sim->dirty_list);
+	free(sim->program);
+	free(sim->data);
+	free(sim);
+}
+
+/***************************************************************/
+/* Read the text words of a hex file or .s source; a source's .data     */
+/* is handed back in data (bytes NULL when there is none)                     */
+/***************************************************************/
+static uint32_t *read_image(const char *path, uint32_t *count, asm_section_t *data)
+{
+	asm_section_t sections[ASM_SECTIONS];
+	uint32_t *words, i;
+
+	memset(data, 0, sizeof(*data));
+	if (!is_asm_source(path)) {
+		return read_program(path, count);
+	}
+	clear_symbols();
+	if (assemble(path, sections) != 0) {
+		return NULL;
+	}
+	*count = sections[ASM_TEXT].size / 4;
+	words = malloc((*count ? *count : 1) * sizeof(uint32_t));
+	if (words != NULL) {
+		for (i = 0; i < *count; i++) {
+			words[i] = sections[ASM_TEXT].bytes[i*4] | (sections[ASM_TEXT].bytes[i*4 + 1] << 8) |
+				(sections[ASM_TEXT].bytes[i*4 + 2] << 16) | ((uint32_t)sections[ASM_TEXT].bytes[i*4 + 3] << 24);
+		}
+		if (sections[ASM_DATA].size != 0) {
+			*data = sections[ASM_DATA];
+			sections[ASM_DATA].bytes = NULL;
+		}
+	}
+	free_sections(sections);
+	return words;
+}
+
+/***************************************************************/
+/* Load a hex-word program file or assemble a .s source                         */
+/***************************************************************/
+int mumips_load_file(mumips_t *sim, const char *path)
+{
+	uint32_t *words, count;
+	asm_section_t data;
+	int result;
+
+	words = read_image(path, &count, &data);
+	if (words == NULL) {
+		return -1;
+	}
+	result = mumips_load_buffer(sim, words, count);
+	free(words);
+	if (result == 0 && data.bytes != NULL) {
+		sim->data = data.bytes;
+		sim->data_base = data.base;
+		sim->data_size = data.size;
+		data.bytes = NULL;
+		mumips_reset(sim);
+	}
+	free(data.bytes);
+	return result;
+}
+
+/***************************************************************/
+/* Swap in an edited program; keep leaves registers, data and the        */
+/* pipeline alone and rewrites only the text words that differ                */
+/***************************************************************/
+int mumips_reload_file(mumips_t *sim, const char *path, int keep)
+{
+	uint32_t *words, count, i, n, changed = 0;
+	asm_section_t data;
+
+	words = read_image(path, &count, &data);
+	if (words == NULL) {
+		return -1;
+	}
+	if ((uint64_t)count * 4 > MEM_TEXT_END - MEM_TEXT_BEGIN + 1) {
+		free(words);
+		free(data.bytes);
+		return -1;
+	}
+	mumips_activate(sim);
+	n = count > sim->program_size ? count : sim->program_size;
+	for (i = 0; i < n; i++) {
+		uint32_t word = i < count ? words[i] : 0;
+		if (word != (i < sim->program_size ? sim->program[i] : 0)) {
+			changed++;
+			if (keep) {
+				mem_write_32(MEM_TEXT_BEGIN + i*4, word);
+			}
+		}
+	}
+	free(sim->program);
+	sim->program = words;
+	sim->program_size = count;
+	PROGRAM_SIZE = count;
+	free(sim->data);
+	sim->data = data.bytes;
+	sim->data_base = data.base;
+	sim->data_size = data.bytes != NULL ? data.size : 0;
+	if (!keep) {
+		mumips_reset(sim);
+	}
+	return changed;
+}
+
+/***************************************************************/
+/* Load a program from memory                                                                              */
+/***************************************************************/
+int mumips_load_buffer(mumips_t *sim, const uint32_t *words, uint32_t count)
+{
+	uint32_t *copy;
+
+	if ((uint64_t)count * 4 > MEM_TEXT_END - MEM_TEXT_BEGIN + 1) {
+		return -1;
+	}
+	copy = malloc((count ? count : 1) * sizeof(uint32_t));
+	if (copy == NULL) {
+		return -1;
+	}
+	memcpy(copy, words, count * sizeof(uint32_t));
+	free(sim->program);
+	sim->program = copy;
+	sim->program_size = count;
+	free(sim->data);
+	sim->data = NULL;
+	sim->data_size = 0;
+	mumips_reset(sim);
+	return 0;
+}
+
+/***************************************************************/
+/* Fresh machine state with the program loaded at MEM_TEXT_BEGIN          */
+/***************************************************************/
+void mumips_reset(mumips_t *sim)
+{
+	sim_context_t fresh;
+	uint32_t i;
+
+	mumips_activate(sim);
+	reset_dirty_pages();
+	memset(&fresh, 0, sizeof(fresh));
+	fresh.current.PC = MEM_TEXT_BEGIN;
+	fresh.run_flag = TRUE;
+	fresh.current.REGS[29] = STACK_POINTER_INIT;
+	fresh.current.REGS[28] = GLOBAL_POINTER_INIT;
+	fresh.stack_low = MEM_STACK_BEGIN + 1;
+	reset_syscalls();
+	fresh.memsys.touched = MEMSYS.touched;
+	restore_context(&fresh);
+	reset_memsys();
+	set_heap_base(sim->data_size != 0 ? sim->data_base + sim->data_size : MEM_DATA_BEGIN);
+
+	for (i = 0; i < sim->program_size; i++) {
+		mem_write_32(MEM_TEXT_BEGIN + i*4, sim->program[i]);
+	}
+	if (sim->data_size != 0) {
+		mem_write_bytes(sim->data_base, sim->data, sim->data_size);
+	}
+	PROGRAM_SIZE = sim->program_size;
+}
+
+/***************************************************************/
+/* Simulate up to n cycles                                                                                      */
+/***************************************************************/
+uint32_t mumips_step(mumips_t *sim, uint32_t cycles)
+{
+	uint32_t i;
+
+	mumips_activate(sim);
+	select_pipeline();
+	for (i = 0; i < cycles && RUN_FLAG; i++) {
+		cycle();
+	}
+	flush_guest_output();
+	return i;
+}
+
+/***************************************************************/
+/* Store callback for wide_run: bind just the lane's memory and stack  */
+/* high-water mark                                                                                                */
+/***************************************************************/
+static void batch_store(void *owner, uint32_t address, uint32_t value, uint32_t size)
+{
+	mumips_t *sim = owner;
+	int i;
+
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		MEM_REGIONS[i].mem = sim->mem[i];
+	}
+	DIRTY_MAP = sim->dirty_map;
+	DIRTY_LIST = sim->dirty_list;
+	NUM_DIRTY = sim->num_dirty;
+	MAX_DIRTY = sim->max_dirty;
+	STACK_LOW = sim->context.stack_low;
+	if (size == 4) {
+		mem_write_32(address, value);
+	}else if (size == 2) {
+		mem_write_16(address, value);
+	}else {
+		mem_write_8(address, value);
+	}
+	sim->context.stack_low = STACK_LOW;
+	sim->dirty_list = DIRTY_LIST;
+	sim->num_dirty = NUM_DIRTY;
+	sim->max_dirty = MAX_DIRTY;
+}
+
+/***************************************************************/
+/* Can sim join the lockstep group led by first                                          */
+/***************************************************************/
+static int batch_compatible(const mumips_t *sim, const mumips_t *first)
+{
+	if (sim->trace || sim->machine.memsys || !wide_eligible(&sim->context)) {
+		return FALSE;
+	}
+	return first == NULL || (sim->forwarding == first->forwarding && sim->activity == first->activity &&
+		memcmp(&sim->machine, &first->machine, sizeof(machine_t)) == 0);
+}
+
+/***************************************************************/
+/* Run a lockstep group, then finish lanes that left it on their own      */
+/***************************************************************/
+static void batch_run(wide_lane_t *lanes, int n, uint32_t cycles)
+{
+	mumips_t *first = lanes[0].owner;
+	int l;
+
+	MACHINE = first->machine;
+	wide_run(lanes, n, cycles, first->forwarding, first->activity, batch_store);
+	for (l = 0; l < n; l++) {
+		if (lanes[l].cycles < cycles && lanes[l].context->run_flag) {
+			mumips_step(lanes[l].owner, cycles - lanes[l].cycles);
+		}
+	}
+}
+
+/***************************************************************/
+/* mumips_step on every handle, WIDE_LANES at a time where they share */
+/* a configuration                                                                                                */
+/***************************************************************/
+void mumips_step_batch(mumips_t **sims, int count, uint32_t cycles)
+{
+	wide_lane_t lanes[WIDE_LANES];
+	mumips_t *sim;
+	int n = 0, i, l;
+
+	if (!wide_supported() || NUM_BREAKPOINTS != 0 || NUM_WATCHPOINTS != 0 || RECORDING) {
+		for (i = 0; i < count; i++) {
+			mumips_step(sims[i], cycles);
+		}
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		sim = sims[i];
+		/* contexts have to be current while lanes are out of the globals */
+		if (ACTIVE_SIM != NULL) {
+			mumips_save(ACTIVE_SIM);
+			ACTIVE_SIM = NULL;
+		}
+		if (!batch_compatible(sim, NULL)) {
+			mumips_step(sim, cycles);
+			continue;
+		}
+		if (n != 0 && !batch_compatible(sim, lanes[0].owner)) {
+			batch_run(lanes, n, cycles);
+			n = 0;
+			if (ACTIVE_SIM != NULL) {
+				mumips_save(ACTIVE_SIM);
+				ACTIVE_SIM = NULL;
+			}
+		}
+		lanes[n].context = &sim->context;
+		for (l = 0; l < NUM_MEM_REGION; l++) {
+			lanes[n].mem[l] = sim->mem[l];
+		}
+		lanes[n].owner = sim;
+		if (++n == WIDE_LANES) {
+			batch_run(lanes, n, cycles);
+			n = 0;
+		}
+	}
+	if (n != 0) {
+		if (ACTIVE_SIM != NULL) {
+			mumips_save(ACTIVE_SIM);
+			ACTIVE_SIM = NULL;
+		}
+		batch_run(lanes, n, cycles);
+	}
+}
+
+/***************************************************************/
+/* Register and memory accessors                                                                       */
+/***************************************************************/
+uint32_t mumips_get_reg(mumips_t *sim, int reg)
+{
+	mumips_activate(sim);
+	return (reg >= 0 && reg < MIPS_REGS) ? CURRENT_STATE.REGS[reg] : 0;
+}
+
+void mumips_set_reg(mumips_t *sim, int reg, uint32_t value)
+{
+	mumips_activate(sim);
+	if (reg > 0 && reg < MIPS_REGS) {
+		CURRENT_STATE.REGS[reg] = value;
+		NEXT_STATE.REGS[reg] = value;
+	}
+}
+
+uint32_t mumips_get_pc(mumips_t *sim)
+{
+	mumips_activate(sim);
+	return CURRENT_STATE.PC;
+}
+
+uint32_t mumips_get_cp0(mumips_t *sim, int reg)
+{
+	mumips_activate(sim);
+	return (reg >= 0 && reg < MIPS_REGS) ? CURRENT_STATE.CP0[reg] : 0;
+}
+
+uint32_t mumips_read_mem(mumips_t *sim, uint32_t address)
+{
+	mumips_activate(sim);
+	return mem_read_32(address);
+}
+
+void mumips_write_mem(mumips_t *sim, uint32_t address, uint32_t value)
+{
+	mumips_activate(sim);
+	mem_write_32(address, value);
+}
+
+/***************************************************************/
+/* Configuration and statistics                                                                           */
+/***************************************************************/
+void mumips_set_forwarding(mumips_t *sim, int on)
+{
+	mumips_activate(sim);
+	ENABLE_FORWARDING = on ? 1 : 0;
+}
+
+int mumips_load_machine(mumips_t *sim, const char *path)
+{
+	mumips_activate(sim);
+	return load_machine(path);
+}
+
+int mumips_set_machine(mumips_t *sim, const char *description)
+{
+	mumips_activate(sim);
+	return parse_machine(description);
+}
+
+void mumips_set_trace(mumips_t *sim, int on)
+{
+	mumips_activate(sim);
+	TRACE_ENABLED = on ? 1 : 0;
+}
+
+void mumips_set_activity(mumips_t *sim, int on)
+{
+	mumips_activate(sim);
+	ENABLE_ACTIVITY = on ? 1 : 0;
+}
+
+void mumips_get_stats(mumips_t *sim, mumips_stats_t *stats)
+{
+	int i;
+
+	mumips_activate(sim);
+	stats->instructions = INSTRUCTION_COUNT;
+	stats->cycles = CYCLE_COUNT;
+	stats->cpi = INSTRUCTION_COUNT ? (double)CYCLE_COUNT / INSTRUCTION_COUNT : 0.0;
+	stats->running = RUN_FLAG;
+	stats->mem_faults = MEM_FAULT_COUNT;
+	stats->stack_peak = MEM_STACK_BEGIN + 1 - STACK_LOW;
+	stats->heap_peak = HEAP_PEAK - HEAP_BASE;
+	stats->unknown_syscalls = UNKNOWN_SYSCALL_COUNT;
+	stats->tlb_misses[TLB_I] = MEMSYS.tlb[TLB_I].misses;
+	stats->tlb_misses[TLB_D] = MEMSYS.tlb[TLB_D].misses;
+	stats->pages_touched = MEMSYS.page_faults;
+	stats->store_stalls = MEMSYS.full_stalls + MEMSYS.overlap_stalls;
+	for (i = 0; i < NUM_CACHES; i++) {
+		stats->cache_misses[i] = MEMSYS.cache[i].misses;
+		stats->prefetches[i] = MEMSYS.cache[i].issued;
+		stats->prefetch_hits[i] = MEMSYS.cache[i].useful;
+	}
+	stats->exception = UNHANDLED_EXCEPTION ? (int)((CURRENT_STATE.CP0[CP0_CAUSE] & CAUSE_EXC_MASK) >> CAUSE_EXC_SHIFT) : -1;
+	stats->latency_stalls = LATENCY_STALLS;
+	stats->refill_bubbles = REDIRECT_BUBBLES;
+	stats->energy = activity_energy();
+}
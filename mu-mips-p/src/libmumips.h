@@ -0,0 +1,85 @@
+#ifndef LIBMUMIPS_H
+#define LIBMUMIPS_H
+
+#include <stdint.h>
+
+/***************************************************************/
+/* libmumips: the MU-MIPS pipeline simulator as an in-process library     */
+/*                                                                                                                             */
+/* The simulator core keeps its machine state in globals. Each handle      */
+/* owns a copy of that state (registers, latches, counters, heap break, */
+/* caches and TLBs), its own guest memory and the host files its guest  */
+/* opened; every call swaps the handle in first, so many handles can     */
+/* live in one process, but only one thread may use the library at a    */
+/* time.                                                                                                                    */
+/*                                                                                                                             */
+/* The shell's debugging state is process-wide and never set by the       */
+/* library: breakpoints, watchpoints, the reverse-execution snapshots    */
+/* and their syscall log, and host files mapped into guest memory with  */
+/* -m/-M. The symbol table holds the last source loaded by any handle,  */
+/* and guest stdout shares one buffer, flushed before each step returns. */
+/***************************************************************/
+
+typedef struct mumips mumips_t;
+
+typedef struct {
+	uint32_t instructions;	/* retired in WB */
+	uint32_t cycles;
+	double cpi;
+	int running;		/* FALSE once the program executed its exit SYSCALL */
+	uint32_t mem_faults;	/* unmapped or region-straddling accesses */
+	uint32_t unknown_syscalls;	/* SYSCALLs with a $v0 the simulator does not emulate */
+	uint32_t stack_peak;	/* bytes below the top of the stack written so far */
+	uint32_t heap_peak;	/* bytes, highest sbrk break */
+	uint32_t tlb_misses[2];	/* ITLB, DTLB; 0 without a TLB in the machine */
+	uint32_t pages_touched;	/* pages translated at least once */
+	uint32_t store_stalls;	/* cycles waiting on a full store buffer or for a store to drain */
+	uint32_t cache_misses[2];	/* I-cache, D-cache; 0 without caches in the machine */
+	uint32_t prefetches[2];		/* lines prefetched into each cache */
+	uint32_t prefetch_hits[2];	/* of those, lines a demand access used */
+	int exception;		/* EXC_* code the run stopped on with no handler, -1 if none */
+	uint32_t latency_stalls;	/* cycles charged for multi-cycle units */
+	uint32_t refill_bubbles;	/* extra bubbles after redirects in a deep pipeline */
+	double energy;		/* pJ, activity counts times the machine's costs */
+} mumips_stats_t;
+
+mumips_t *mumips_create(void);
+void mumips_destroy(mumips_t *sim);
+
+/* load a program (hex words one per line, .s/.asm source, or a word */
+/* array) and reset; only the .text and .data of a source are loaded      */
+int mumips_load_file(mumips_t *sim, const char *path);
+int mumips_load_buffer(mumips_t *sim, const uint32_t *words, uint32_t count);
+
+/* load an edited version of the program; keep carries on from the     */
+/* current state with only the changed text words rewritten, otherwise */
+/* the handle is reset; returns the number of words that changed or -1 */
+int mumips_reload_file(mumips_t *sim, const char *path, int keep);
+
+/* zero registers, latches, counters and memory, then reload the program; */
+/* only the pages written since the previous reset are cleared               */
+void mumips_reset(mumips_t *sim);
+
+/* simulate up to n cycles, stopping early at exit; returns cycles run */
+uint32_t mumips_step(mumips_t *sim, uint32_t cycles);
+
+/* mumips_step(sims[i], cycles) for every handle; handles with the same */
+/* forwarding, activity and machine settings run WIDE_LANES at a time  */
+/* on vectors, with the same results                                                            */
+void mumips_step_batch(mumips_t **sims, int count, uint32_t cycles);
+
+uint32_t mumips_get_reg(mumips_t *sim, int reg);
+void mumips_set_reg(mumips_t *sim, int reg, uint32_t value);
+uint32_t mumips_get_pc(mumips_t *sim);
+uint32_t mumips_get_cp0(mumips_t *sim, int reg);	/* CP0_EPC, CP0_CAUSE, ... */
+uint32_t mumips_read_mem(mumips_t *sim, uint32_t address);
+void mumips_write_mem(mumips_t *sim, uint32_t address, uint32_t value);
+
+void mumips_set_forwarding(mumips_t *sim, int on);
+int mumips_load_machine(mumips_t *sim, const char *path);	/* machine description file, 0 on success */
+int mumips_set_machine(mumips_t *sim, const char *description);	/* the same as text, one line per setting */
+void mumips_set_trace(mumips_t *sim, int on);	/* per-stage printf trace, off by default */
+void mumips_set_activity(mumips_t *sim, int on);	/* activity counts behind stats.energy, on by default */
+void mumips_get_stats(mumips_t *sim, mumips_stats_t *stats);
+
+#endif
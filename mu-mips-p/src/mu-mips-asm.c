@@ -0,0 +1,1108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "mu-mips.h"
+
+symbol_t *SYMBOLS = NULL;
+uint32_t NUM_SYMBOLS = 0;
+uint32_t MAX_SYMBOLS = 0;
+
+/***************************************************************/
+/* Two-pass assembler                                                                                        */
+/*                                                                                                                             */
+/* Pass 1 only advances the location counters and records labels; pass  */
+/* 2 runs the same code again with every label known and emits bytes.    */
+/* Both passes must size each line identically, so a line's size never    */
+/* depends on the value of a label.                                                          */
+/***************************************************************/
+#define ASM_LINE_SIZE 1024
+#define MAX_LINE_LABELS 8
+#define MAX_OPERANDS 64
+
+/* operands each format takes, and how many of them lead as registers */
+const int FORMAT_OPERANDS[] = { 3, 3, 3, 1, 2, 2, 1, 1, 0, 3, 3, 2, 2, 3, 2, 1, 2 };
+const int FORMAT_REGISTERS[] = { 3, 2, 3, 1, 2, 2, 1, 1, 0, 2, 2, 1, 1, 2, 1, 0, 2 };
+
+#define REG_AT 1	/* scratch register of the pseudo-instructions */
+
+typedef struct {
+	char name[SYMBOL_NAME_SIZE];
+	uint32_t address;
+	int line;
+} asm_label_t;
+
+/* the file being assembled */
+const char *ASM_PATH;
+int ASM_LINE;
+int ASM_PASS;
+int ASM_ERRORS;
+int ASM_SECTION;
+asm_section_t *ASM_OUT;
+uint32_t ASM_CAPACITY[ASM_SECTIONS];
+int ASM_BASE_SET[ASM_SECTIONS];	/* .data <addr> etc. only before the first byte */
+asm_label_t *LABELS;	/* sorted by name after pass 1 */
+uint32_t NUM_LABELS, MAX_LABELS;
+
+const char *SECTION_NAMES[ASM_SECTIONS] = { ".text", ".data", ".ktext", ".kdata" };
+const uint32_t SECTION_BASES[ASM_SECTIONS] = { MEM_TEXT_BEGIN, MEM_DATA_BEGIN, EXCEPTION_VECTOR, MEM_KDATA_BEGIN };
+
+/***************************************************************/
+/* Report an error at the current line; pass 1 stays quiet since pass 2 */
+/* meets the same line again                                                                            */
+/***************************************************************/
+void asm_error(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (ASM_PASS == 1) {
+		return;
+	}
+	printf("%s:%d: ", ASM_PATH, ASM_LINE);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+	ASM_ERRORS++;
+}
+
+/***************************************************************/
+/* Program and kernel files ending in .s or .asm are assembled             */
+/***************************************************************/
+int is_asm_source(const char *path)
+{
+	const char *dot = strrchr(path, '.');
+
+	return dot != NULL && (strcmp(dot, ".s") == 0 || strcmp(dot, ".S") == 0 || strcmp(dot, ".asm") == 0);
+}
+
+/***************************************************************/
+/* Location counter of the current section                                                      */
+/***************************************************************/
+uint32_t asm_location()
+{
+	return ASM_OUT[ASM_SECTION].base + ASM_OUT[ASM_SECTION].size;
+}
+
+/***************************************************************/
+/* Append bytes to the current section (pass 1 only counts them)          */
+/***************************************************************/
+void emit_bytes(const uint8_t *data, uint32_t len)
+{
+	asm_section_t *sec = &ASM_OUT[ASM_SECTION];
+
+	if (ASM_PASS == 2) {
+		if (sec->size + len > ASM_CAPACITY[ASM_SECTION]) {
+			while (sec->size + len > ASM_CAPACITY[ASM_SECTION]) {
+				ASM_CAPACITY[ASM_SECTION] = ASM_CAPACITY[ASM_SECTION] ? ASM_CAPACITY[ASM_SECTION] * 2 : 4096;
+			}
+			sec->bytes = realloc(sec->bytes, ASM_CAPACITY[ASM_SECTION]);
+			assert(sec->bytes != NULL);
+		}
+		if (data != NULL) {
+			memcpy(sec->bytes + sec->size, data, len);
+		}else {
+			memset(sec->bytes + sec->size, 0, len);
+		}
+	}
+	sec->size += len;
+	ASM_BASE_SET[ASM_SECTION] = TRUE;
+}
+
+void emit_word(uint32_t word)
+{
+	uint8_t bytes[4];
+
+	bytes[0] = word & 0xFF;
+	bytes[1] = (word >> 8) & 0xFF;
+	bytes[2] = (word >> 16) & 0xFF;
+	bytes[3] = (word >> 24) & 0xFF;
+	emit_bytes(bytes, 4);
+}
+
+/***************************************************************/
+/* Zero-pad the current section to a multiple of align bytes                     */
+/***************************************************************/
+void asm_align(uint32_t align)
+{
+	uint32_t pad = (align - asm_location() % align) % align;
+
+	if (pad != 0) {
+		emit_bytes(NULL, pad);
+	}
+}
+
+/***************************************************************/
+/* Label table of the file being assembled                                                      */
+/***************************************************************/
+void define_label(const char *name)
+{
+	asm_label_t *label;
+
+	if (ASM_PASS == 2) {
+		return;
+	}
+	if (strlen(name) >= SYMBOL_NAME_SIZE) {
+		printf("%s:%d: label '%s' is too long\n", ASM_PATH, ASM_LINE, name);
+		ASM_ERRORS++;
+		return;
+	}
+	if (NUM_LABELS == MAX_LABELS) {
+		MAX_LABELS = MAX_LABELS ? MAX_LABELS * 2 : 256;
+		LABELS = realloc(LABELS, MAX_LABELS * sizeof(asm_label_t));
+		assert(LABELS != NULL);
+	}
+	label = &LABELS[NUM_LABELS++];
+	strcpy(label->name, name);
+	label->address = asm_location();
+	label->line = ASM_LINE;
+}
+
+int compare_label_names(const void *a, const void *b)
+{
+	return strcmp(((const asm_label_t *)a)->name, ((const asm_label_t *)b)->name);
+}
+
+asm_label_t *find_label(const char *name)
+{
+	asm_label_t key;
+
+	if (strlen(name) >= SYMBOL_NAME_SIZE || NUM_LABELS == 0) {
+		return NULL;
+	}
+	strcpy(key.name, name);
+	return bsearch(&key, LABELS, NUM_LABELS, sizeof(asm_label_t), compare_label_names);
+}
+
+/***************************************************************/
+/* Character that may start or continue a label                                             */
+/***************************************************************/
+int is_label_start(int c)
+{
+	return isalpha(c) || c == '_' || c == '.' || c == '$';
+}
+
+int is_label_char(int c)
+{
+	return isalnum(c) || c == '_' || c == '.' || c == '$';
+}
+
+char *trim(char *s)
+{
+	char *end;
+
+	while (isspace((unsigned char)*s)) {
+		s++;
+	}
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1])) {
+		*--end = '\0';
+	}
+	return s;
+}
+
+/***************************************************************/
+/* Plain number or character literal, TRUE if s is one                               */
+/***************************************************************/
+int asm_number(const char *s, uint32_t *value)
+{
+	char *end;
+	long long n;
+
+	if (s[0] == '\'') {
+		if (s[1] == '\\' && s[2] != '\0' && s[3] == '\'' && s[4] == '\0') {
+			switch (s[2]) {
+				case 'n': *value = '\n'; break;
+				case 't': *value = '\t'; break;
+				case 'r': *value = '\r'; break;
+				case '0': *value = '\0'; break;
+				default: *value = (uint8_t)s[2]; break;
+			}
+			return TRUE;
+		}
+		if (s[1] != '\0' && s[2] == '\'' && s[3] == '\0') {
+			*value = (uint8_t)s[1];
+			return TRUE;
+		}
+		return FALSE;
+	}
+	if (!isdigit((unsigned char)s[0]) && !((s[0] == '-' || s[0] == '+') && isdigit((unsigned char)s[1]))) {
+		return FALSE;
+	}
+	n = strtoll(s, &end, 0);
+	if (*end != '\0' || n < -0x80000000LL || n > 0xFFFFFFFFLL) {
+		return FALSE;
+	}
+	*value = (uint32_t)n;
+	return TRUE;
+}
+
+/***************************************************************/
+/* Operand value: number, 'c', label, label+n, label-n, %hi(x), %lo(x)  */
+/*                                                                                                                             */
+/* Labels read as 0 in pass 1. Returns FALSE after reporting an error.      */
+/***************************************************************/
+int asm_value(char *s, uint32_t *value)
+{
+	char *op, *end, saved;
+	uint32_t offset = 0;
+	asm_label_t *label;
+	int hi;
+
+	s = trim(s);
+	if ((strncmp(s, "%hi(", 4) == 0 || strncmp(s, "%lo(", 4) == 0) && s[strlen(s) - 1] == ')') {
+		hi = (s[1] == 'h');
+		s[strlen(s) - 1] = '\0';
+		if (!asm_value(s + 4, value)) {
+			return FALSE;
+		}
+		/* the low half is sign-extended by lw/addiu, so %hi rounds */
+		*value = hi ? ((*value + 0x8000) >> 16) & 0xFFFF : *value & 0xFFFF;
+		return TRUE;
+	}
+	if (asm_number(s, value)) {
+		return TRUE;
+	}
+	if (!is_label_start((unsigned char)s[0])) {
+		asm_error("bad value '%s'", s);
+		return FALSE;
+	}
+	for (end = s; is_label_char((unsigned char)*end); end++);
+	op = end;
+	while (isspace((unsigned char)*op)) {
+		op++;
+	}
+	if (*op == '+' || *op == '-') {
+		if (!asm_number(trim(op + 1), &offset)) {
+			asm_error("bad offset in '%s'", s);
+			return FALSE;
+		}
+		offset = (*op == '-') ? -offset : offset;
+	}else if (*op != '\0') {
+		asm_error("bad value '%s'", s);
+		return FALSE;
+	}
+	saved = *end;
+	*end = '\0';
+	label = find_label(s);
+	if (label == NULL && ASM_PASS == 2) {
+		asm_error("undefined label '%s'", s);
+		*end = saved;
+		return FALSE;
+	}
+	*end = saved;
+	*value = (label ? label->address : 0) + offset;
+	return TRUE;
+}
+
+/***************************************************************/
+/* Register operand, -1 after reporting an error                                          */
+/***************************************************************/
+int asm_register(const char *s)
+{
+	int reg = parse_register(s);
+
+	if (reg < 0) {
+		asm_error("bad register '%s'", s);
+	}
+	return reg;
+}
+
+/***************************************************************/
+/* Immediate that must fit in 16 bits, signed or not                                  */
+/***************************************************************/
+int asm_immediate(char *s, int is_signed, uint32_t *value)
+{
+	int32_t v;
+
+	if (!asm_value(s, value)) {
+		return FALSE;
+	}
+	v = (int32_t)*value;
+	if (is_signed ? (v < -32768 || v > 32767) : (*value > 0xFFFF)) {
+		asm_error("immediate '%s' does not fit in 16 bits", trim(s));
+		return FALSE;
+	}
+	*value &= 0xFFFF;
+	return TRUE;
+}
+
+/***************************************************************/
+/* Instruction encoders                                                                                      */
+/***************************************************************/
+uint32_t encode_r(uint32_t rs, uint32_t rt, uint32_t rd, uint32_t sa, uint32_t funct)
+{
+	return (rs << 21) | (rt << 16) | (rd << 11) | (sa << 6) | funct;
+}
+
+uint32_t encode_i(uint32_t opcode, uint32_t rs, uint32_t rt, uint32_t imm)
+{
+	return (opcode << 26) | (rs << 21) | (rt << 16) | (imm & 0xFFFF);
+}
+
+/***************************************************************/
+/* Branch to a label, relative to the instruction after it                           */
+/***************************************************************/
+void emit_branch(uint32_t opcode, uint32_t rs, uint32_t rt, char *target)
+{
+	uint32_t address;
+	int32_t offset = 0;
+
+	if (asm_value(target, &address) && ASM_PASS == 2) {
+		offset = (int32_t)(address - (asm_location() + 4)) >> 2;
+		if ((address & 3) != 0 || offset < -32768 || offset > 32767) {
+			asm_error("branch target '%s' out of range", trim(target));
+		}
+	}
+	emit_word(encode_i(opcode, rs, rt, (uint32_t)offset));
+}
+
+/***************************************************************/
+/* Split operands at commas outside quotes and parentheses                     */
+/***************************************************************/
+int split_operands(char *s, char **ops, int max)
+{
+	int n = 0, depth = 0, quoted = FALSE;
+	char prev = '\0';
+
+	s = trim(s);
+	if (*s == '\0') {
+		return 0;
+	}
+	ops[n++] = s;
+	for (; *s != '\0'; prev = *s++) {
+		if (*s == '"' && prev != '\\') {
+			quoted = !quoted;
+		}else if (!quoted && *s == '(') {
+			depth++;
+		}else if (!quoted && *s == ')') {
+			depth--;
+		}else if (!quoted && depth == 0 && *s == ',') {
+			*s = '\0';
+			if (n == max) {
+				return -1;
+			}
+			ops[n++] = s + 1;
+		}
+	}
+	for (depth = 0; depth < n; depth++) {
+		ops[depth] = trim(ops[depth]);
+	}
+	return n;
+}
+
+/***************************************************************/
+/* Load or store: "offset(base)" is one word, a bare address is two         */
+/***************************************************************/
+void assemble_memory(uint32_t opcode, int rt, char *operand)
+{
+	char *open = strchr(operand, '('), *close;
+	uint32_t offset = 0, address;
+	int base;
+
+	if (open == NULL) {
+		if (!asm_value(operand, &address)) {
+			address = 0;
+		}
+		emit_word(encode_i(0x0F, 0, REG_AT, ((address + 0x8000) >> 16) & 0xFFFF));
+		emit_word(encode_i(opcode, REG_AT, rt, address));
+		return;
+	}
+	close = strchr(open, ')');
+	if (close == NULL || *trim(close + 1) != '\0') {
+		asm_error("bad address '%s'", operand);
+		emit_word(0);
+		return;
+	}
+	*open = '\0';
+	*close = '\0';
+	base = asm_register(trim(open + 1));
+	if (*trim(operand) != '\0' && !asm_immediate(operand, TRUE, &offset)) {
+		offset = 0;
+	}
+	emit_word(encode_i(opcode, base < 0 ? 0 : base, rt, offset));
+}
+
+/***************************************************************/
+/* Pseudo-instructions; FALSE if name is not one                                       */
+/***************************************************************/
+int assemble_pseudo(const char *name, char **ops, int n)
+{
+	uint32_t value, opcode;
+	int r0 = -1, r1 = -1, r2 = -1;
+
+	if (strcmp(name, "nop") == 0) {
+		if (n != 0) {
+			asm_error("nop takes no operands");
+		}
+		emit_word(0);
+		return TRUE;
+	}
+	if (strcmp(name, "li") == 0 || strcmp(name, "la") == 0) {
+		if (n != 2) {
+			asm_error("%s takes a register and a value", name);
+			emit_word(0);
+			return TRUE;
+		}
+		r0 = asm_register(ops[0]);
+		r0 = r0 < 0 ? 0 : r0;
+		if (name[1] == 'i' && asm_number(ops[1], &value)) {
+			/* a literal's size is known in pass 1 */
+			if ((int32_t)value >= -32768 && (int32_t)value <= 32767) {
+				emit_word(encode_i(0x09, 0, r0, value));
+				return TRUE;
+			}
+			if (value <= 0xFFFF) {
+				emit_word(encode_i(0x0D, 0, r0, value));
+				return TRUE;
+			}
+		}else if (!asm_value(ops[1], &value)) {
+			value = 0;
+		}
+		emit_word(encode_i(0x0F, 0, r0, value >> 16));
+		emit_word(encode_i(0x0D, r0, r0, value));
+		return TRUE;
+	}
+	if (strcmp(name, "move") == 0 || strcmp(name, "not") == 0 || strcmp(name, "neg") == 0) {
+		if (n != 2) {
+			asm_error("%s takes two registers", name);
+			emit_word(0);
+			return TRUE;
+		}
+		r0 = asm_register(ops[0]);
+		r1 = asm_register(ops[1]);
+		if (r0 < 0 || r1 < 0) {
+			emit_word(0);
+		}else if (name[0] == 'm') {
+			emit_word(encode_r(r1, 0, r0, 0, 0x21));	/* addu rd, rs, $zero */
+		}else if (name[1] == 'o') {
+			emit_word(encode_r(r1, 0, r0, 0, 0x27));	/* nor rd, rs, $zero */
+		}else {
+			emit_word(encode_r(0, r1, r0, 0, 0x22));	/* sub rd, $zero, rs */
+		}
+		return TRUE;
+	}
+	if (strcmp(name, "mul") == 0) {
+		if (n != 3) {
+			asm_error("mul takes three registers");
+		}else {
+			r0 = asm_register(ops[0]);
+			r1 = asm_register(ops[1]);
+			r2 = asm_register(ops[2]);
+		}
+		if (r0 < 0 || r1 < 0 || r2 < 0) {
+			r0 = r1 = r2 = 0;
+		}
+		emit_word(encode_r(r1, r2, 0, 0, 0x18));	/* mult rs, rt */
+		emit_word(encode_r(0, 0, r0, 0, 0x12));	/* mflo rd */
+		return TRUE;
+	}
+	if (strcmp(name, "b") == 0) {
+		if (n != 1) {
+			asm_error("b takes a label");
+			emit_word(0);
+			return TRUE;
+		}
+		emit_branch(0x04, 0, 0, ops[0]);
+		return TRUE;
+	}
+	if (strcmp(name, "beqz") == 0 || strcmp(name, "bnez") == 0) {
+		if (n != 2 || (r0 = asm_register(ops[0])) < 0) {
+			if (n != 2) {
+				asm_error("%s takes a register and a label", name);
+			}
+			emit_word(0);
+			return TRUE;
+		}
+		emit_branch(name[1] == 'e' ? 0x04 : 0x05, r0, 0, ops[1]);
+		return TRUE;
+	}
+	if (strcmp(name, "blt") == 0 || strcmp(name, "bgt") == 0 || strcmp(name, "ble") == 0 || strcmp(name, "bge") == 0) {
+		if (n != 3) {
+			asm_error("%s takes two registers and a label", name);
+		}else {
+			r0 = asm_register(ops[0]);
+			r1 = asm_register(ops[1]);
+		}
+		if (r0 < 0 || r1 < 0) {
+			emit_word(0);
+			emit_word(0);
+			return TRUE;
+		}
+		/* blt/bge test rs < rt, bgt/ble test rt < rs */
+		if (strcmp(name, "blt") == 0 || strcmp(name, "bge") == 0) {
+			emit_word(encode_r(r0, r1, REG_AT, 0, 0x2A));
+		}else {
+			emit_word(encode_r(r1, r0, REG_AT, 0, 0x2A));
+		}
+		opcode = (strcmp(name, "blt") == 0 || strcmp(name, "bgt") == 0) ? 0x05 : 0x04;
+		emit_branch(opcode, REG_AT, 0, ops[2]);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/***************************************************************/
+/* One machine instruction or pseudo-instruction                                       */
+/***************************************************************/
+void assemble_instruction(const char *name, char *operands)
+{
+	char *ops[MAX_OPERANDS];
+	const instr_desc_t *op;
+	uint32_t value = 0, target = 0;
+	int n, r[3] = { 0, 0, 0 }, expect, i;
+
+	if (ASM_SECTION != ASM_TEXT && ASM_SECTION != ASM_KTEXT) {
+		asm_error("instruction '%s' outside .text", name);
+		return;
+	}
+	asm_align(4);
+	n = split_operands(operands, ops, MAX_OPERANDS);
+	if (n < 0) {
+		asm_error("too many operands");
+		emit_word(0);
+		return;
+	}
+	if (assemble_pseudo(name, ops, n)) {
+		return;
+	}
+	for (op = INSTRUCTIONS; op->name != NULL && strcmp(op->name, name) != 0; op++);
+	if (op->name == NULL) {
+		asm_error("unknown instruction '%s'", name);
+		emit_word(0);
+		return;
+	}
+
+	if ((op->format == FMT_IMM || op->format == FMT_IMMU) && n == 2) {
+		/* "addi $t0, 4" is "addi $t0, $t0, 4" */
+		ops[2] = ops[1];
+		ops[1] = ops[0];
+		n = 3;
+	}
+	expect = (op->format == FMT_JALR) ? n : FORMAT_REGISTERS[op->format];
+	if (op->format == FMT_JALR ? (n < 1 || n > 2) : (n != FORMAT_OPERANDS[op->format])) {
+		asm_error("wrong number of operands for '%s'", name);
+		emit_word(0);
+		return;
+	}
+	for (i = 0; i < expect; i++) {
+		r[i] = asm_register(ops[i]);
+		if (r[i] < 0) {
+			emit_word(0);
+			return;
+		}
+	}
+
+	switch (op->format) {
+		case FMT_R3:
+			emit_word(encode_r(r[1], r[2], r[0], 0, op->code));
+			break;
+		case FMT_SHIFT:
+			if (asm_value(ops[2], &value) && value > 31) {
+				asm_error("shift amount '%s' out of range", ops[2]);
+			}
+			emit_word(encode_r(0, r[1], r[0], value & 0x1F, op->code));
+			break;
+		case FMT_SHIFTV:
+			emit_word(encode_r(r[2], r[1], r[0], 0, op->code));
+			break;
+		case FMT_JR:
+		case FMT_MTHL:
+			emit_word(encode_r(r[0], 0, 0, 0, op->code));
+			break;
+		case FMT_JALR:
+			/* "jalr rs" links through $ra */
+			emit_word(n == 1 ? encode_r(r[0], 0, 31, 0, op->code) : encode_r(r[1], 0, r[0], 0, op->code));
+			break;
+		case FMT_MULDIV:
+			emit_word(encode_r(r[0], r[1], 0, 0, op->code));
+			break;
+		case FMT_MFHL:
+			emit_word(encode_r(0, 0, r[0], 0, op->code));
+			break;
+		case FMT_NONE:
+			emit_word((op->opcode << 26) | op->code);
+			break;
+		case FMT_IMM:
+		case FMT_IMMU:
+			asm_immediate(ops[2], op->format == FMT_IMM, &value);
+			emit_word(encode_i(op->opcode, r[1], r[0], value));
+			break;
+		case FMT_LUI:
+			asm_immediate(ops[1], FALSE, &value);
+			emit_word(encode_i(op->opcode, 0, r[0], value));
+			break;
+		case FMT_MEM:
+			assemble_memory(op->opcode, r[0], ops[1]);
+			break;
+		case FMT_BRANCH2:
+			emit_branch(op->opcode, r[0], r[1], ops[2]);
+			break;
+		case FMT_BRANCH1:
+			emit_branch(op->opcode, r[0], op->opcode == 0x01 ? op->code : 0, ops[1]);
+			break;
+		case FMT_JUMP:
+			if (asm_value(ops[0], &target) && ASM_PASS == 2 &&
+				((target & 3) != 0 || ((asm_location() + 4) & 0xF0000000) != (target & 0xF0000000))) {
+				asm_error("jump target '%s' out of range", ops[0]);
+			}
+			emit_word((op->opcode << 26) | ((target >> 2) & 0x03FFFFFF));
+			break;
+		case FMT_COP0:
+			emit_word((op->opcode << 26) | (op->code << 21) | (r[0] << 16) | (r[1] << 11));
+			break;
+	}
+}
+
+/***************************************************************/
+/* The pipeline traps every word it does not execute as a reserved        */
+/* instruction, so an instruction that assembles to one (directly or as    */
+/* a pseudo-instruction's expansion) is an error; start is the section    */
+/* size before it                                                                                          */
+/***************************************************************/
+void check_implemented(const char *name, uint32_t start)
+{
+	asm_section_t *sec = &ASM_OUT[ASM_SECTION];
+	const uint8_t *p;
+	uint32_t offset, word;
+
+	if (ASM_PASS != 2) {
+		return;
+	}
+	for (offset = start; offset + 4 <= sec->size; offset += 4) {
+		p = sec->bytes + offset;
+		word = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		if (reserved_instruction(word)) {
+			asm_error("'%s' is not implemented by the pipeline", name);
+			return;
+		}
+	}
+}
+
+/***************************************************************/
+/* Contents of a "..." literal with C escapes, decoded in place at *start; */
+/* returns the length, -1 if malformed                                                    */
+/***************************************************************/
+int asm_string(char *s, char **start)
+{
+	char *in, *out;
+
+	s = trim(s);
+	*start = s;
+	if (s[0] != '"' || strlen(s) < 2 || s[strlen(s) - 1] != '"') {
+		return -1;
+	}
+	s[strlen(s) - 1] = '\0';
+	for (in = s + 1, out = s; *in != '\0'; in++) {
+		if (*in != '\\' || in[1] == '\0') {
+			*out++ = *in;
+			continue;
+		}
+		switch (*++in) {
+			case 'n': *out++ = '\n'; break;
+			case 't': *out++ = '\t'; break;
+			case 'r': *out++ = '\r'; break;
+			case '0': *out++ = '\0'; break;
+			default: *out++ = *in; break;
+		}
+	}
+	return out - s;
+}
+
+/***************************************************************/
+/* Assembler directives                                                                                    */
+/***************************************************************/
+void assemble_directive(const char *name, char *operands)
+{
+	char *ops[MAX_OPERANDS];
+	uint32_t value, size;
+	uint8_t bytes[4];
+	char *text;
+	int n, i, len, section;
+
+	if (strcmp(name, ".ascii") == 0 || strcmp(name, ".asciiz") == 0) {
+		len = asm_string(operands, &text);
+		if (len < 0) {
+			asm_error("%s needs a quoted string", name);
+			return;
+		}
+		emit_bytes((uint8_t *)text, len);
+		if (name[6] == 'z') {
+			emit_bytes(NULL, 1);
+		}
+		return;
+	}
+
+	n = split_operands(operands, ops, MAX_OPERANDS);
+	if (n < 0) {
+		asm_error("too many operands");
+		return;
+	}
+	for (section = 0; section < ASM_SECTIONS && strcmp(name, SECTION_NAMES[section]) != 0; section++);
+	if (section < ASM_SECTIONS) {
+		ASM_SECTION = section;
+		if (n == 1 && asm_value(ops[0], &value)) {
+			if (section == ASM_TEXT && value != MEM_TEXT_BEGIN) {
+				asm_error(".text always starts at 0x%08x", MEM_TEXT_BEGIN);
+			}else if (ASM_BASE_SET[section] && value != ASM_OUT[section].base) {
+				asm_error("%s already started at 0x%08x", name, ASM_OUT[section].base);
+			}else {
+				ASM_OUT[section].base = value;
+				ASM_BASE_SET[section] = TRUE;
+			}
+		}else if (n > 1) {
+			asm_error("%s takes at most an address", name);
+		}
+		return;
+	}
+
+	if (strcmp(name, ".word") == 0 || strcmp(name, ".half") == 0 || strcmp(name, ".byte") == 0) {
+		size = (name[1] == 'w') ? 4 : (name[1] == 'h') ? 2 : 1;
+		asm_align(size);
+		for (i = 0; i < n; i++) {
+			if (!asm_value(ops[i], &value)) {
+				value = 0;
+			}
+			bytes[0] = value & 0xFF;
+			bytes[1] = (value >> 8) & 0xFF;
+			bytes[2] = (value >> 16) & 0xFF;
+			bytes[3] = (value >> 24) & 0xFF;
+			emit_bytes(bytes, size);
+		}
+		return;
+	}
+	if (strcmp(name, ".space") == 0 || strcmp(name, ".align") == 0) {
+		if (n != 1 || !asm_number(ops[0], &value)) {
+			asm_error("%s takes a number", name);
+			return;
+		}
+		if (name[1] == 'a') {
+			if (value > 12) {
+				asm_error(".align %u is larger than a page", value);
+				return;
+			}
+			asm_align(1u << value);
+		}else {
+			emit_bytes(NULL, value);
+		}
+		return;
+	}
+	if (strcmp(name, ".globl") == 0 || strcmp(name, ".global") == 0 || strcmp(name, ".extern") == 0 ||
+		strcmp(name, ".ent") == 0 || strcmp(name, ".end") == 0 || strcmp(name, ".set") == 0) {
+		return;	/* no linker, nothing to do */
+	}
+	asm_error("unknown directive '%s'", name);
+}
+
+/***************************************************************/
+/* One source line: labels, then a directive or an instruction             */
+/***************************************************************/
+void assemble_line(char *line)
+{
+	char *labels[MAX_LINE_LABELS];
+	char *s, *p, *name;
+	int num_labels = 0, quoted = FALSE, i;
+	uint32_t start;
+
+	/* strip the comment, leaving '#' inside strings alone */
+	for (p = line; *p != '\0'; p++) {
+		if (*p == '"' && (p == line || p[-1] != '\\')) {
+			quoted = !quoted;
+		}else if (*p == '#' && !quoted) {
+			*p = '\0';
+			break;
+		}
+	}
+
+	s = trim(line);
+	while (is_label_start((unsigned char)*s)) {
+		for (p = s; is_label_char((unsigned char)*p); p++);
+		name = p;
+		while (isspace((unsigned char)*p)) {
+			p++;
+		}
+		if (*p != ':') {
+			break;
+		}
+		*name = '\0';
+		if (num_labels == MAX_LINE_LABELS) {
+			asm_error("too many labels on one line");
+		}else {
+			labels[num_labels++] = s;
+		}
+		s = trim(p + 1);
+	}
+
+	name = s;
+	for (p = s; *p != '\0' && !isspace((unsigned char)*p); p++) {
+		*p = tolower((unsigned char)*p);
+	}
+	if (*p != '\0') {
+		*p++ = '\0';
+	}
+
+	/* labels name the first byte of what follows, after its alignment */
+	if (name[0] != '.' && name[0] != '\0') {
+		asm_align(4);
+	}else if (strcmp(name, ".word") == 0) {
+		asm_align(4);
+	}else if (strcmp(name, ".half") == 0) {
+		asm_align(2);
+	}
+	for (i = 0; i < num_labels; i++) {
+		define_label(labels[i]);
+	}
+
+	if (name[0] == '\0') {
+		return;
+	}
+	if (name[0] == '.') {
+		assemble_directive(name, p);
+	}else {
+		start = ASM_OUT[ASM_SECTION].size;
+		assemble_instruction(name, p);
+		check_implemented(name, start);
+	}
+}
+
+/***************************************************************/
+/* Run one pass over the whole file                                                                  */
+/***************************************************************/
+int assemble_pass(FILE *fp, int pass)
+{
+	char line[ASM_LINE_SIZE];
+	int i;
+
+	ASM_PASS = pass;
+	ASM_LINE = 0;
+	ASM_SECTION = ASM_TEXT;
+	for (i = 0; i < ASM_SECTIONS; i++) {
+		ASM_OUT[i].size = 0;
+		if (pass == 1) {
+			ASM_OUT[i].base = SECTION_BASES[i];
+			ASM_BASE_SET[i] = FALSE;
+		}
+	}
+	rewind(fp);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		ASM_LINE++;
+		if (strchr(line, '\n') == NULL && !feof(fp)) {
+			printf("%s:%d: line too long\n", ASM_PATH, ASM_LINE);
+			return -1;
+		}
+		assemble_line(line);
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Assemble a source file into its sections and add its labels to              */
+/* SYMBOLS. Returns 0, or -1 after printing the errors.                              */
+/***************************************************************/
+int assemble(const char *path, asm_section_t sections[ASM_SECTIONS])
+{
+	FILE *fp;
+	uint32_t i;
+
+	memset(sections, 0, ASM_SECTIONS * sizeof(asm_section_t));
+	memset(ASM_CAPACITY, 0, sizeof(ASM_CAPACITY));
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return -1;
+	}
+	ASM_PATH = path;
+	ASM_OUT = sections;
+	ASM_ERRORS = 0;
+	NUM_LABELS = 0;
+
+	if (assemble_pass(fp, 1) != 0) {
+		fclose(fp);
+		return -1;
+	}
+	qsort(LABELS, NUM_LABELS, sizeof(asm_label_t), compare_label_names);
+	for (i = 1; i < NUM_LABELS; i++) {
+		if (strcmp(LABELS[i].name, LABELS[i - 1].name) == 0) {
+			printf("%s:%d: label '%s' already defined on line %d\n", path, LABELS[i].line, LABELS[i].name, LABELS[i - 1].line);
+			ASM_ERRORS++;
+		}
+	}
+	assemble_pass(fp, 2);
+	fclose(fp);
+	if (ASM_ERRORS != 0) {
+		free_sections(sections);
+		return -1;
+	}
+
+	for (i = 0; i < NUM_LABELS; i++) {
+		add_symbol(LABELS[i].name, LABELS[i].address);
+	}
+	sort_symbols();
+	return 0;
+}
+
+/***************************************************************/
+/* Release what assemble() allocated                                                                */
+/***************************************************************/
+void free_sections(asm_section_t sections[ASM_SECTIONS])
+{
+	int i;
+
+	for (i = 0; i < ASM_SECTIONS; i++) {
+		free(sections[i].bytes);
+		sections[i].bytes = NULL;
+		sections[i].size = 0;
+	}
+}
+
+/***************************************************************/
+/* Symbol table shared by the disassembler, trace and breakpoints          */
+/***************************************************************/
+void clear_symbols()
+{
+	NUM_SYMBOLS = 0;
+}
+
+void add_symbol(const char *name, uint32_t address)
+{
+	if (NUM_SYMBOLS == MAX_SYMBOLS) {
+		MAX_SYMBOLS = MAX_SYMBOLS ? MAX_SYMBOLS * 2 : 256;
+		SYMBOLS = realloc(SYMBOLS, MAX_SYMBOLS * sizeof(symbol_t));
+		assert(SYMBOLS != NULL);
+	}
+	snprintf(SYMBOLS[NUM_SYMBOLS].name, SYMBOL_NAME_SIZE, "%s", name);
+	SYMBOLS[NUM_SYMBOLS].address = address;
+	NUM_SYMBOLS++;
+}
+
+int compare_symbol_addresses(const void *a, const void *b)
+{
+	const symbol_t *x = a, *y = b;
+
+	if (x->address != y->address) {
+		return x->address < y->address ? -1 : 1;
+	}
+	return strcmp(x->name, y->name);
+}
+
+void sort_symbols()
+{
+	qsort(SYMBOLS, NUM_SYMBOLS, sizeof(symbol_t), compare_symbol_addresses);
+}
+
+/***************************************************************/
+/* Memory region an address falls in, -1 if none                                      */
+/***************************************************************/
+int region_of(uint32_t address)
+{
+	int i;
+
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if (address >= MEM_REGIONS[i].begin && address <= MEM_REGIONS[i].end) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/***************************************************************/
+/* Nearest symbol at or below address in the same region, NULL if none  */
+/***************************************************************/
+const symbol_t *symbol_at(uint32_t address, uint32_t *offset)
+{
+	uint32_t lo = 0, hi = NUM_SYMBOLS, mid;
+	const symbol_t *sym;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (SYMBOLS[mid].address <= address) {
+			lo = mid + 1;
+		}else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return NULL;
+	}
+	sym = &SYMBOLS[lo - 1];
+	while (sym > SYMBOLS && sym[-1].address == sym->address) {
+		sym--;	/* first name at that address */
+	}
+	if (region_of(sym->address) != region_of(address) || region_of(address) < 0) {
+		return NULL;
+	}
+	if (offset != NULL) {
+		*offset = address - sym->address;
+	}
+	return sym;
+}
+
+/***************************************************************/
+/* Address of a symbol, TRUE if it exists                                                           */
+/***************************************************************/
+int lookup_symbol(const char *name, uint32_t *address)
+{
+	uint32_t i;
+
+	for (i = 0; i < NUM_SYMBOLS; i++) {
+		if (strcmp(SYMBOLS[i].name, name) == 0) {
+			*address = SYMBOLS[i].address;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/***************************************************************/
+/* Shell address argument: hex, symbol or symbol+offset                       */
+/***************************************************************/
+int parse_address(const char *s, uint32_t *address)
+{
+	char name[SYMBOL_NAME_SIZE];
+	char *end;
+	const char *plus = strchr(s, '+');
+	size_t len = plus ? (size_t)(plus - s) : strlen(s);
+	uint32_t offset = 0;
+
+	*address = strtoul(s, &end, 16);
+	if (end != s && *end == '\0') {
+		return TRUE;
+	}
+	if (len >= SYMBOL_NAME_SIZE) {
+		return FALSE;
+	}
+	memcpy(name, s, len);
+	name[len] = '\0';
+	if (plus != NULL) {
+		offset = strtoul(plus + 1, &end, 0);
+		if (end == plus + 1 || *end != '\0') {
+			return FALSE;
+		}
+	}
+	if (!lookup_symbol(name, address)) {
+		return FALSE;
+	}
+	*address += offset;
+	return TRUE;
+}
+
+/***************************************************************/
+/* "0x00400010 <main+0x10>", or just the hex if no symbol covers it          */
+/***************************************************************/
+char *format_address(uint32_t address, char *buf, size_t size)
+{
+	uint32_t offset;
+	const symbol_t *sym = symbol_at(address, &offset);
+
+	if (sym == NULL) {
+		snprintf(buf, size, "0x%08x", address);
+	}else if (offset == 0) {
+		snprintf(buf, size, "0x%08x <%s>", address, sym->name);
+	}else {
+		snprintf(buf, size, "0x%08x <%s+0x%x>", address, sym->name, offset);
+	}
+	return buf;
+}
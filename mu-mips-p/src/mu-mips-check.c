@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "mu-mips.h"
+#include "libmumips.h"
+
+/***************************************************************/
+/* Golden-output check: each expectation file names a program and the   */
+/* state it must end in. The program is run with forwarding off and on,  */
+/* one forked worker per run and as many at once as the host has cores. */
+/* Registers, memory and the instruction count must match exactly; the  */
+/* cycle count may drift by the tolerance, a percentage that defaults */
+/* to 0 so a change meant to be timing-neutral has to be.                         */
+/*                                                                                                                             */
+/*   program ../inputs/testPipeline1.in   # relative to this file          */
+/*   machine deep.m                  # optional machine description          */
+/*   cycles 1000000                  # per run, default CHECK_CYCLES            */
+/*   tolerance 0.5                   # percent of the expected cycles           */
+/*   forwarding both                 # the lines below hold for 0, 1 or both  */
+/*   status exit                     # exit, timeout or an exception name  */
+/*   reg 0 <value> <value> ...       # registers from 0 on                            */
+/*   mem 0x10010000 <value> ...      # words from the address on                */
+/*   count <instructions> <cycles>                                                                   */
+/*                                                                                                                             */
+/* The modes can end in different states, since the exit SYSCALL stops  */
+/* the run with different instructions in flight. -u runs every file      */
+/* and rewrites its forwarding sections from the results, keeping the    */
+/* mem addresses and word counts; a new file needs only its program and */
+/* mem placeholders. -b runs every job through mumips_step_batch, so   */
+/* the lockstep engine is held to what scalar stepping recorded.          */
+/***************************************************************/
+
+#define CHECK_MAX_FILES 256
+#define CHECK_MAX_MEM 16
+#define CHECK_MAX_WORDS 64
+#define CHECK_CYCLES 1000000
+#define CHECK_SLICE 64	/* cycles per mumips_step_batch call with -b */
+
+typedef struct {
+	uint32_t address, count;
+	uint32_t words[CHECK_MAX_WORDS];
+} mem_range_t;
+
+/* what one forwarding mode ends in, expected or simulated */
+typedef struct {
+	char status[32];	/* empty if not checked */
+	int num_regs;		/* registers 0 .. num_regs-1 are checked */
+	uint32_t regs[32];
+	int num_mem;
+	mem_range_t mem[CHECK_MAX_MEM];
+	int has_counts;
+	uint32_t instructions, cycles;
+} final_state_t;
+
+typedef struct {
+	const char *path;
+	char program[512], machine[512];
+	uint32_t cycles;
+	double tolerance;
+	final_state_t mode[2];	/* forwarding off, on */
+} expect_t;
+
+typedef struct {
+	int file, forwarding;
+	int state;
+	char report[POOL_REPORT_SIZE];
+} job_t;
+
+expect_t EXPECT[CHECK_MAX_FILES];
+int NUM_FILES = 0;
+job_t JOBS[2 * CHECK_MAX_FILES];
+int NUM_JOBS = 0;
+double TOLERANCE = -1.0;	/* -t, overrides every file when set */
+int VERBOSE = 0;
+int BATCH = 0;		/* -b, run through mumips_step_batch */
+
+/***************************************************************/
+/* Path of name relative to the directory of the file that names it   */
+/***************************************************************/
+void relative_path(char *buf, size_t size, const char *file, const char *name)
+{
+	const char *slash = strrchr(file, '/');
+
+	if (name[0] == '/' || slash == NULL) {
+		snprintf(buf, size, "%s", name);
+	}else {
+		snprintf(buf, size, "%.*s/%s", (int)(slash - file), file, name);
+	}
+}
+
+/***************************************************************/
+/* Apply one status/reg/mem/count line to a mode, 0 on success          */
+/***************************************************************/
+int state_line(final_state_t *f, char **tok, int n)
+{
+	mem_range_t *m;
+	int first, i;
+
+	if (strcmp(tok[0], "status") == 0 && n == 2) {
+		snprintf(f->status, sizeof(f->status), "%s", tok[1]);
+	}else if (strcmp(tok[0], "reg") == 0 && n >= 3) {
+		first = atoi(tok[1]);
+		if (first != f->num_regs || first + n - 2 > 32) {
+			return -1;
+		}
+		for (i = 2; i < n; i++) {
+			f->regs[f->num_regs++] = strtoul(tok[i], NULL, 0);
+		}
+	}else if (strcmp(tok[0], "mem") == 0 && n >= 3 && f->num_mem < CHECK_MAX_MEM) {
+		m = &f->mem[f->num_mem++];
+		m->address = strtoul(tok[1], NULL, 0);
+		m->count = n - 2;
+		for (i = 2; i < n; i++) {
+			m->words[i - 2] = strtoul(tok[i], NULL, 0);
+		}
+	}else if (strcmp(tok[0], "count") == 0 && n == 3) {
+		f->has_counts = TRUE;
+		f->instructions = strtoul(tok[1], NULL, 0);
+		f->cycles = strtoul(tok[2], NULL, 0);
+	}else {
+		return -1;
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Read one expectation file                                                                             */
+/***************************************************************/
+int read_expect(const char *path, expect_t *e)
+{
+	char line[CMD_LINE_SIZE];
+	char *tok[2 + CHECK_MAX_WORDS];
+	char *hash, *save, *word;
+	FILE *fp;
+	int lineno = 0, errors = 0, first = 0, last = 1, n, fwd;
+
+	memset(e, 0, sizeof(*e));
+	e->path = path;
+	e->cycles = CHECK_CYCLES;
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: Can't open expectation file %s\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if ((hash = strchr(line, '#')) != NULL) {
+			*hash = '\0';
+		}
+		for (n = 0, word = strtok_r(line, " \t\r\n", &save); word != NULL && n < 2 + CHECK_MAX_WORDS; word = strtok_r(NULL, " \t\r\n", &save)) {
+			tok[n++] = word;
+		}
+		if (n == 0) {
+			continue;
+		}
+		if (strcmp(tok[0], "program") == 0 && n == 2) {
+			relative_path(e->program, sizeof(e->program), path, tok[1]);
+		}else if (strcmp(tok[0], "machine") == 0 && n == 2) {
+			relative_path(e->machine, sizeof(e->machine), path, tok[1]);
+		}else if (strcmp(tok[0], "cycles") == 0 && n == 2) {
+			e->cycles = strtoul(tok[1], NULL, 0);
+		}else if (strcmp(tok[0], "tolerance") == 0 && n == 2) {
+			e->tolerance = atof(tok[1]);
+		}else if (strcmp(tok[0], "forwarding") == 0 && n == 2 && (strcmp(tok[1], "0") == 0 || strcmp(tok[1], "1") == 0)) {
+			first = last = atoi(tok[1]);
+		}else if (strcmp(tok[0], "forwarding") == 0 && n == 2 && strcmp(tok[1], "both") == 0) {
+			first = 0;
+			last = 1;
+		}else {
+			for (fwd = first; fwd <= last; fwd++) {
+				if (state_line(&e->mode[fwd], tok, n) != 0) {
+					fprintf(stderr, "%s:%d: unknown or malformed line '%s'\n", path, lineno, tok[0]);
+					errors++;
+					break;
+				}
+			}
+		}
+	}
+	fclose(fp);
+	if (e->program[0] == '\0') {
+		fprintf(stderr, "%s: no program\n", path);
+		errors++;
+	}
+	return errors ? -1 : 0;
+}
+
+/***************************************************************/
+/* Load a file's program into a new handle                                                  */
+/***************************************************************/
+mumips_t *load_sim(const expect_t *e, int forwarding)
+{
+	mumips_t *sim = mumips_create();
+
+	if (sim == NULL || mumips_load_file(sim, e->program) != 0) {
+		fprintf(stderr, "%s: Can't load %s\n", e->path, e->program);
+		mumips_destroy(sim);
+		return NULL;
+	}
+	if (e->machine[0] != '\0' && mumips_load_machine(sim, e->machine) != 0) {
+		mumips_destroy(sim);
+		return NULL;
+	}
+	mumips_set_forwarding(sim, forwarding);
+	return sim;
+}
+
+/***************************************************************/
+/* The state a handle ended in, with the mem ranges f checks              */
+/***************************************************************/
+void read_state(mumips_t *sim, const final_state_t *f, final_state_t *o)
+{
+	mumips_stats_t stats;
+	uint32_t j;
+	int i;
+
+	memset(o, 0, sizeof(*o));
+	mumips_get_stats(sim, &stats);
+	if (stats.exception != -1) {
+		snprintf(o->status, sizeof(o->status), "%s", exception_name(stats.exception));
+	}else {
+		snprintf(o->status, sizeof(o->status), "%s", stats.running ? "timeout" : "exit");
+	}
+	o->num_regs = 32;
+	for (i = 0; i < 32; i++) {
+		o->regs[i] = mumips_get_reg(sim, i);
+	}
+	o->num_mem = f->num_mem;
+	for (i = 0; i < f->num_mem; i++) {
+		o->mem[i].address = f->mem[i].address;
+		o->mem[i].count = f->mem[i].count;
+		for (j = 0; j < f->mem[i].count; j++) {
+			o->mem[i].words[j] = mumips_read_mem(sim, f->mem[i].address + 4 * j);
+		}
+	}
+	o->has_counts = TRUE;
+	o->instructions = stats.instructions;
+	o->cycles = stats.cycles;
+}
+
+/***************************************************************/
+/* Run a file's program in one forwarding mode. With -b it runs on    */
+/* WIDE_LANES handles through mumips_step_batch, CHECK_SLICE cycles at */
+/* a time so lanes leave and rejoin lockstep, and every lane has to end  */
+/* where scalar stepping recorded.                                                              */
+/***************************************************************/
+int simulate(const expect_t *e, int forwarding, final_state_t *o)
+{
+	const final_state_t *f = &e->mode[forwarding];
+	mumips_t *sims[WIDE_LANES];
+	mumips_stats_t stats;
+	final_state_t lane;
+	uint32_t done, slice;
+	int n = BATCH ? WIDE_LANES : 1, i;
+
+	for (i = 0; i < n; i++) {
+		if ((sims[i] = load_sim(e, forwarding)) == NULL) {
+			while (i-- > 0) {
+				mumips_destroy(sims[i]);
+			}
+			return -1;
+		}
+	}
+	if (!BATCH) {
+		mumips_step(sims[0], e->cycles);
+	}else {
+		stats.running = TRUE;
+		for (done = 0; done < e->cycles && stats.running; done += slice) {
+			slice = (e->cycles - done < CHECK_SLICE) ? e->cycles - done : CHECK_SLICE;
+			mumips_step_batch(sims, n, slice);
+			mumips_get_stats(sims[0], &stats);
+		}
+	}
+
+	read_state(sims[0], f, o);
+	for (i = 1; i < n; i++) {
+		read_state(sims[i], f, &lane);
+		if (memcmp(&lane, o, sizeof(lane)) != 0) {
+			snprintf(o->status, sizeof(o->status), "lane-%d-differs", i);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		mumips_destroy(sims[i]);
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Compare a run with its expectations; returns the number of failures */
+/***************************************************************/
+int compare(const expect_t *e, int forwarding, const final_state_t *o, char *report, size_t size)
+{
+	const final_state_t *f = &e->mode[forwarding];
+	double tolerance = (TOLERANCE >= 0) ? TOLERANCE : e->tolerance;
+	double drift;
+	size_t len = 0;
+	int failures = 0, i;
+	uint32_t j;
+
+#define NOTE(...) do { if (len < size) len += snprintf(report + len, size - len, __VA_ARGS__); } while (0)
+
+	report[0] = '\0';
+	if (f->status[0] != '\0' && strcmp(f->status, o->status) != 0) {
+		NOTE("  status %s, expected %s\n", o->status, f->status);
+		failures++;
+	}
+	for (i = 0; i < f->num_regs; i++) {
+		if (o->regs[i] != f->regs[i]) {
+			NOTE("  R%d = 0x%08x, expected 0x%08x\n", i, o->regs[i], f->regs[i]);
+			failures++;
+		}
+	}
+	for (i = 0; i < f->num_mem; i++) {
+		for (j = 0; j < f->mem[i].count; j++) {
+			if (o->mem[i].words[j] != f->mem[i].words[j]) {
+				NOTE("  [0x%08x] = 0x%08x, expected 0x%08x\n", f->mem[i].address + 4 * j, o->mem[i].words[j], f->mem[i].words[j]);
+				failures++;
+			}
+		}
+	}
+	if (f->has_counts) {
+		if (o->instructions != f->instructions) {
+			NOTE("  %u instructions, expected %u\n", o->instructions, f->instructions);
+			failures++;
+		}
+		if (o->cycles != f->cycles) {
+			drift = f->cycles ? 100.0 * ((double)o->cycles - f->cycles) / f->cycles : 100.0;
+			NOTE("  %u cycles, expected %u (%+.2f%%, tolerance %.2f%%)\n", o->cycles, f->cycles, drift, tolerance);
+			failures += (drift > tolerance || drift < -tolerance);
+		}
+	}
+#undef NOTE
+	return failures;
+}
+
+/***************************************************************/
+/* Write the status, reg and mem lines of a final state                               */
+/***************************************************************/
+void write_state(FILE *out, const final_state_t *o)
+{
+	uint32_t j;
+	int i;
+
+	fprintf(out, "status %s\n", o->status);
+	for (i = 0; i < 32; i++) {
+		if (i % 8 == 0) {
+			fprintf(out, "reg %d", i);
+		}
+		fprintf(out, " 0x%08x%s", o->regs[i], (i % 8 == 7) ? "\n" : "");
+	}
+	for (i = 0; i < o->num_mem; i++) {
+		fprintf(out, "mem 0x%08x", o->mem[i].address);
+		for (j = 0; j < o->mem[i].count; j++) {
+			fprintf(out, " 0x%08x", o->mem[i].words[j]);
+		}
+		fprintf(out, "\n");
+	}
+}
+
+/***************************************************************/
+/* Rewrite a file with the results of both modes                                         */
+/***************************************************************/
+int update_expect(const expect_t *e, const final_state_t o[2])
+{
+	static const char *recorded[] = { "forwarding", "status", "reg", "mem", "count" };
+	char line[CMD_LINE_SIZE], word[32], tmp[512 + 16];
+	FILE *in, *out;
+	int same, keep, fwd, i;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", e->path, (int)getpid());
+	in = fopen(e->path, "r");
+	out = fopen(tmp, "w");
+	if (in == NULL || out == NULL) {
+		fprintf(stderr, "Error: Can't rewrite %s\n", e->path);
+		if (in != NULL) {
+			fclose(in);
+		}
+		if (out != NULL) {
+			fclose(out);
+		}
+		return -1;
+	}
+	/* keep everything but the recorded lines */
+	while (fgets(line, sizeof(line), in) != NULL) {
+		keep = TRUE;
+		for (i = 0; i < 5 && sscanf(line, "%31s", word) == 1; i++) {
+			keep = keep && strcmp(word, recorded[i]) != 0;
+		}
+		if (keep) {
+			fputs(line, out);
+		}
+	}
+	fclose(in);
+
+	same = strcmp(o[0].status, o[1].status) == 0 && memcmp(o[0].regs, o[1].regs, sizeof(o[0].regs)) == 0
+		&& o[0].num_mem == o[1].num_mem && memcmp(o[0].mem, o[1].mem, o[0].num_mem * sizeof(mem_range_t)) == 0;
+	if (same) {
+		fprintf(out, "forwarding both\n");
+		write_state(out, &o[0]);
+	}
+	for (fwd = 0; fwd < 2; fwd++) {
+		fprintf(out, "forwarding %d\n", fwd);
+		if (!same) {
+			write_state(out, &o[fwd]);
+		}
+		fprintf(out, "count %u %u\n", o[fwd].instructions, o[fwd].cycles);
+	}
+	fclose(out);
+	return rename(tmp, e->path);
+}
+
+/***************************************************************/
+/* Worker: run one job and write its report to fd                                     */
+/***************************************************************/
+int run_job(int i, int fd)
+{
+	char report[POOL_REPORT_SIZE];
+	final_state_t o;
+	int failures;
+
+	if (simulate(&EXPECT[JOBS[i].file], JOBS[i].forwarding, &o) != 0) {
+		return JOB_ERROR;
+	}
+	failures = compare(&EXPECT[JOBS[i].file], JOBS[i].forwarding, &o, report, sizeof(report));
+	if (write(fd, report, strlen(report)) < 0) {
+		return JOB_ERROR;
+	}
+	return failures ? JOB_FAIL : JOB_PASS;
+}
+
+/***************************************************************/
+/* Parent: keep a finished job's verdict and report                                   */
+/***************************************************************/
+void job_done(int i, int state, const char *report)
+{
+	JOBS[i].state = state;
+	snprintf(JOBS[i].report, sizeof(JOBS[i].report), "%s", report);
+}
+
+/***************************************************************/
+/* main                                                                                                                                   */
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+	const char *usage = "Usage: %s [-j workers] [-t tolerance %%] [-u update] [-v verbose] [-b batch] <expectation file>...\n";
+	int workers = pool_workers();
+	int update = 0, opt, i, fwd, failed = 0, errors = 0;
+	struct timespec t0, t1;
+	final_state_t o[2];
+	const char *verdict;
+
+	while ((opt = getopt(argc, argv, "j:t:uvb")) != -1) {
+		switch (opt) {
+			case 'j': workers = atoi(optarg); break;
+			case 't': TOLERANCE = atof(optarg); break;
+			case 'u': update = 1; break;
+			case 'v': VERBOSE = 1; break;
+			case 'b': BATCH = 1; break;
+			default:
+				fprintf(stderr, usage, argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, usage, argv[0]);
+		return 1;
+	}
+	for (i = optind; i < argc; i++) {
+		if (NUM_FILES == CHECK_MAX_FILES) {
+			fprintf(stderr, "Error: more than %d expectation files\n", CHECK_MAX_FILES);
+			return 1;
+		}
+		errors += (read_expect(argv[i], &EXPECT[NUM_FILES++]) != 0);
+	}
+	if (errors) {
+		return 1;
+	}
+	if (BATCH && !wide_supported()) {
+		/* mumips_step_batch would only step each handle on its own */
+		fprintf(stderr, "no AVX2 on this host, skipping the batch check\n");
+		return 0;
+	}
+
+	if (update) {
+		for (i = 0; i < NUM_FILES; i++) {
+			if (simulate(&EXPECT[i], 0, &o[0]) != 0 || simulate(&EXPECT[i], 1, &o[1]) != 0 || update_expect(&EXPECT[i], o) != 0) {
+				errors++;
+			}
+		}
+		fprintf(stderr, "%d files: %d updated, %d failed\n", NUM_FILES, NUM_FILES - errors, errors);
+		return errors != 0;
+	}
+
+	workers = (workers < 1) ? 1 : workers;
+	for (i = 0; i < NUM_FILES; i++) {
+		for (fwd = 0; fwd < 2; fwd++) {
+			JOBS[NUM_JOBS].file = i;
+			JOBS[NUM_JOBS].forwarding = fwd;
+			NUM_JOBS++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	run_pool(NUM_JOBS, workers, run_job, job_done);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	for (i = 0; i < NUM_JOBS; i++) {
+		verdict = (JOBS[i].state == JOB_PASS) ? "ok" : (JOBS[i].state == JOB_FAIL) ? "FAIL" : "ERROR";
+		if (JOBS[i].state != JOB_PASS || VERBOSE) {
+			printf("%-5s %s forwarding %d\n%s", verdict, EXPECT[JOBS[i].file].path, JOBS[i].forwarding, JOBS[i].report);
+		}
+		failed += (JOBS[i].state != JOB_PASS);
+	}
+	fflush(stdout);
+	fprintf(stderr, "%d runs on %d workers in %.2f s: %d passed, %d failed\n", NUM_JOBS, workers,
+		(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, NUM_JOBS - failed, failed);
+	return failed != 0;
+}
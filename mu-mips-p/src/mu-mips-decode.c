@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* The instruction set, one row per instruction. The assembler looks rows */
+/* up by name, the decoder indexes them by opcode fields and the stages  */
+/* run them by op.                                                                                              */
+/***************************************************************/
+const instr_desc_t INSTRUCTIONS[] = {
+	{ "add", FMT_R3, 0x00, 0x20, OP_ADD }, { "addu", FMT_R3, 0x00, 0x21, OP_ADDU },
+	{ "sub", FMT_R3, 0x00, 0x22, OP_SUB }, { "subu", FMT_R3, 0x00, 0x23, OP_SUBU },
+	{ "and", FMT_R3, 0x00, 0x24, OP_AND }, { "or", FMT_R3, 0x00, 0x25, OP_OR },
+	{ "xor", FMT_R3, 0x00, 0x26, OP_XOR }, { "nor", FMT_R3, 0x00, 0x27, OP_NOR },
+	{ "slt", FMT_R3, 0x00, 0x2A, OP_SLT }, { "sltu", FMT_R3, 0x00, 0x2B, OP_SLTU },
+	{ "sll", FMT_SHIFT, 0x00, 0x00, OP_SLL }, { "srl", FMT_SHIFT, 0x00, 0x02, OP_SRL }, { "sra", FMT_SHIFT, 0x00, 0x03, OP_SRA },
+	{ "sllv", FMT_SHIFTV, 0x00, 0x04, OP_SLL }, { "srlv", FMT_SHIFTV, 0x00, 0x06, OP_SRL }, { "srav", FMT_SHIFTV, 0x00, 0x07, OP_SRA },
+	{ "jr", FMT_JR, 0x00, 0x08, OP_NONE }, { "jalr", FMT_JALR, 0x00, 0x09, OP_NONE },
+	{ "syscall", FMT_NONE, 0x00, 0x0C, OP_SYSCALL }, { "break", FMT_NONE, 0x00, 0x0D, OP_NONE },
+	{ "mfhi", FMT_MFHL, 0x00, 0x10, OP_NONE }, { "mthi", FMT_MTHL, 0x00, 0x11, OP_NONE },
+	{ "mflo", FMT_MFHL, 0x00, 0x12, OP_NONE }, { "mtlo", FMT_MTHL, 0x00, 0x13, OP_NONE },
+	{ "mult", FMT_MULDIV, 0x00, 0x18, OP_NONE }, { "multu", FMT_MULDIV, 0x00, 0x19, OP_NONE },
+	{ "div", FMT_MULDIV, 0x00, 0x1A, OP_NONE }, { "divu", FMT_MULDIV, 0x00, 0x1B, OP_NONE },
+	{ "bltz", FMT_BRANCH1, 0x01, 0x00, OP_NONE }, { "bgez", FMT_BRANCH1, 0x01, 0x01, OP_NONE },
+	{ "bltzal", FMT_BRANCH1, 0x01, 0x10, OP_NONE }, { "bgezal", FMT_BRANCH1, 0x01, 0x11, OP_NONE },
+	{ "j", FMT_JUMP, 0x02, 0, OP_NONE }, { "jal", FMT_JUMP, 0x03, 0, OP_NONE },
+	{ "beq", FMT_BRANCH2, 0x04, 0, OP_NONE }, { "bne", FMT_BRANCH2, 0x05, 0, OP_NONE },
+	{ "blez", FMT_BRANCH1, 0x06, 0, OP_NONE }, { "bgtz", FMT_BRANCH1, 0x07, 0, OP_NONE },
+	{ "addi", FMT_IMM, 0x08, 0, OP_ADD }, { "addiu", FMT_IMM, 0x09, 0, OP_ADDU },
+	{ "slti", FMT_IMM, 0x0A, 0, OP_SLT }, { "sltiu", FMT_IMM, 0x0B, 0, OP_SLTU },
+	{ "andi", FMT_IMMU, 0x0C, 0, OP_AND }, { "ori", FMT_IMMU, 0x0D, 0, OP_OR },
+	{ "xori", FMT_IMMU, 0x0E, 0, OP_XOR }, { "lui", FMT_LUI, 0x0F, 0, OP_LUI },
+	{ "mfc0", FMT_COP0, 0x10, 0x00, OP_MFC0 }, { "mtc0", FMT_COP0, 0x10, 0x04, OP_MTC0 },
+	{ "eret", FMT_NONE, 0x10, 0x02000018, OP_ERET },
+	{ "lb", FMT_MEM, 0x20, 0, OP_LOAD }, { "lh", FMT_MEM, 0x21, 0, OP_LOAD }, { "lwl", FMT_MEM, 0x22, 0, OP_NONE },
+	{ "lw", FMT_MEM, 0x23, 0, OP_LOAD }, { "lbu", FMT_MEM, 0x24, 0, OP_NONE }, { "lhu", FMT_MEM, 0x25, 0, OP_NONE },
+	{ "lwr", FMT_MEM, 0x26, 0, OP_NONE }, { "sb", FMT_MEM, 0x28, 0, OP_STORE }, { "sh", FMT_MEM, 0x29, 0, OP_STORE },
+	{ "swl", FMT_MEM, 0x2A, 0, OP_NONE }, { "sw", FMT_MEM, 0x2B, 0, OP_STORE }, { "swr", FMT_MEM, 0x2E, 0, OP_NONE },
+	{ NULL, 0, 0, 0, OP_NONE }
+};
+
+/* decode lookup, filled in from INSTRUCTIONS by init_decoder() */
+const instr_desc_t *SPECIAL_DECODE[64];	/* opcode 0x00, by funct */
+const instr_desc_t *REGIMM_DECODE[32];	/* opcode 0x01, by rt */
+const instr_desc_t *COP0_DECODE[32];	/* opcode 0x10, by rs */
+const instr_desc_t *OPCODE_DECODE[64];	/* everything else, by opcode */
+int DECODER_READY = FALSE;
+
+/***************************************************************/
+/* Build the decode lookup arrays                                                                    */
+/***************************************************************/
+void init_decoder()
+{
+	const instr_desc_t *d;
+
+	if (DECODER_READY) {
+		return;
+	}
+	for (d = INSTRUCTIONS; d->name != NULL; d++) {
+		switch (d->opcode) {
+			case 0x00: SPECIAL_DECODE[d->code & 0x3F] = d; break;
+			case 0x01: REGIMM_DECODE[d->code] = d; break;
+			case 0x10: COP0_DECODE[d->format == FMT_COP0 ? d->code : (d->code >> 21) & 0x1F] = d; break;
+			default: OPCODE_DECODE[d->opcode] = d; break;
+		}
+	}
+	DECODER_READY = TRUE;
+}
+
+/***************************************************************/
+/* Table row of an instruction word, NULL if it is not in MIPS I                */
+/***************************************************************/
+const instr_desc_t *decode_instruction(uint32_t ir)
+{
+	uint32_t opcode = ir >> 26;
+	const instr_desc_t *d;
+
+	if (!DECODER_READY) {
+		init_decoder();
+	}
+	switch (opcode) {
+		case 0x00:
+			return SPECIAL_DECODE[ir & 0x3F];
+		case 0x01:
+			return REGIMM_DECODE[(ir >> 16) & 0x1F];
+		case 0x10:
+			d = COP0_DECODE[(ir >> 21) & 0x1F];
+			if (d != NULL && d->format == FMT_NONE && (ir & 0x3F) != (d->code & 0x3F)) {
+				return NULL;	/* CO instructions other than ERET */
+			}
+			return d;
+		default:
+			return OPCODE_DECODE[opcode];
+	}
+}
+
+/***************************************************************/
+/* Which of rs, rt and rd an instruction reads and writes, from its        */
+/* format; 0 for an instruction the stages do not execute                     */
+/***************************************************************/
+int register_use(const instr_desc_t *d)
+{
+	if (d == NULL || d->op == OP_NONE) {
+		return 0;
+	}
+	switch (d->format) {
+		case FMT_R3:
+		case FMT_SHIFTV:
+			return REG_READS_RS | REG_READS_RT | REG_WRITES_RD;
+		case FMT_SHIFT:
+			return REG_READS_RT | REG_WRITES_RD;
+		case FMT_JR:
+		case FMT_MTHL:
+		case FMT_BRANCH1:
+			return REG_READS_RS;
+		case FMT_JALR:
+			return REG_READS_RS | REG_WRITES_RD;
+		case FMT_MULDIV:
+		case FMT_BRANCH2:
+			return REG_READS_RS | REG_READS_RT;
+		case FMT_MFHL:
+			return REG_WRITES_RD;
+		case FMT_IMM:
+		case FMT_IMMU:
+			return REG_READS_RS | REG_WRITES_RT;
+		case FMT_LUI:
+			return REG_WRITES_RT;
+		case FMT_MEM:
+			return REG_READS_RS | ((d->opcode & 0x08) ? REG_READS_RT : REG_WRITES_RT);
+		case FMT_COP0:
+			return (d->code == 0x00) ? REG_WRITES_RT : REG_READS_RT;	/* MFC0, MTC0 */
+		default:
+			return 0;
+	}
+}
+
+/***************************************************************/
+/* Branch or jump target as a label if one covers it                                 */
+/***************************************************************/
+char *format_target(uint32_t address, char *buf, size_t size)
+{
+	uint32_t offset;
+	const symbol_t *sym = symbol_at(address, &offset);
+
+	if (sym == NULL) {
+		snprintf(buf, size, "0x%08x", address);
+	}else if (offset == 0) {
+		snprintf(buf, size, "%s", sym->name);
+	}else {
+		snprintf(buf, size, "%s+0x%x", sym->name, offset);
+	}
+	return buf;
+}
+
+/***************************************************************/
+/* Disassemble ir, fetched from addr, into buf in assembler syntax         */
+/***************************************************************/
+char *format_instruction(uint32_t ir, uint32_t addr, char *buf, size_t size)
+{
+	const instr_desc_t *d = decode_instruction(ir);
+	const char *rs = REG_NAMES[(ir >> 21) & 0x1F];
+	const char *rt = REG_NAMES[(ir >> 16) & 0x1F];
+	const char *rd = REG_NAMES[(ir >> 11) & 0x1F];
+	uint32_t sa = (ir >> 6) & 0x1F;
+	uint32_t imm = ir & 0xFFFF;
+	int32_t simm = (int16_t)imm;
+	char target[ADDRESS_STRING_SIZE];
+
+	if (d == NULL) {
+		snprintf(buf, size, ".word 0x%08x", ir);
+		return buf;
+	}
+	if (ir == 0) {
+		snprintf(buf, size, "nop");
+		return buf;
+	}
+	switch (d->format) {
+		case FMT_R3:
+			snprintf(buf, size, "%s $%s, $%s, $%s", d->name, rd, rs, rt);
+			break;
+		case FMT_SHIFT:
+			snprintf(buf, size, "%s $%s, $%s, %u", d->name, rd, rt, sa);
+			break;
+		case FMT_SHIFTV:
+			snprintf(buf, size, "%s $%s, $%s, $%s", d->name, rd, rt, rs);
+			break;
+		case FMT_JR:
+		case FMT_MTHL:
+			snprintf(buf, size, "%s $%s", d->name, rs);
+			break;
+		case FMT_JALR:
+			if (((ir >> 11) & 0x1F) == 31) {
+				snprintf(buf, size, "%s $%s", d->name, rs);
+			}else {
+				snprintf(buf, size, "%s $%s, $%s", d->name, rd, rs);
+			}
+			break;
+		case FMT_MULDIV:
+			snprintf(buf, size, "%s $%s, $%s", d->name, rs, rt);
+			break;
+		case FMT_MFHL:
+			snprintf(buf, size, "%s $%s", d->name, rd);
+			break;
+		case FMT_NONE:
+			snprintf(buf, size, "%s", d->name);
+			break;
+		case FMT_IMM:
+			snprintf(buf, size, "%s $%s, $%s, %d", d->name, rt, rs, simm);
+			break;
+		case FMT_IMMU:
+			snprintf(buf, size, "%s $%s, $%s, 0x%x", d->name, rt, rs, imm);
+			break;
+		case FMT_LUI:
+			snprintf(buf, size, "%s $%s, 0x%x", d->name, rt, imm);
+			break;
+		case FMT_MEM:
+			snprintf(buf, size, "%s $%s, %d($%s)", d->name, rt, simm, rs);
+			break;
+		case FMT_BRANCH2:
+			format_target(addr + 4 + ((uint32_t)simm << 2), target, sizeof(target));
+			snprintf(buf, size, "%s $%s, $%s, %s", d->name, rs, rt, target);
+			break;
+		case FMT_BRANCH1:
+			format_target(addr + 4 + ((uint32_t)simm << 2), target, sizeof(target));
+			snprintf(buf, size, "%s $%s, %s", d->name, rs, target);
+			break;
+		case FMT_JUMP:
+			format_target(((addr + 4) & 0xF0000000) | ((ir & 0x03FFFFFF) << 2), target, sizeof(target));
+			snprintf(buf, size, "%s %s", d->name, target);
+			break;
+		case FMT_COP0:
+			snprintf(buf, size, "%s $%s, $%u", d->name, rt, (ir >> 11) & 0x1F);
+			break;
+	}
+	return buf;
+}
@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "mu-mips.h"
+#include "libmumips.h"
+
+/***************************************************************/
+/* Instruction-level fuzzer: random instruction streams are run on the  */
+/* pipeline and on a functional reference, and the final registers,       */
+/* stored bytes and any exception the run stopped on are compared.      */
+/* Untrapped out-of-region accesses, hangs and crashes are reported     */
+/* too. Build with -DMUMIPS_LIBFUZZER to get only the                              */
+/* LLVMFuzzerTestOneInput entry point.                                                    */
+/***************************************************************/
+
+#define FUZZ_MAX_INSNS 64
+#define FUZZ_BASE_REG 28	/* holds MEM_DATA_BEGIN, never a destination */
+#define FUZZ_MAX_STORES (4 * FUZZ_MAX_INSNS)	/* bytes */
+
+#define FIND_NONE       0
+#define FIND_DIVERGENCE 1
+#define FIND_OUT_OF_BOUNDS 2
+#define FIND_HANG       3
+
+typedef struct {
+	uint32_t regs[MIPS_REGS];
+	uint32_t store_addr[FUZZ_MAX_STORES];	/* bytes written, in first-write order */
+	uint8_t store_value[FUZZ_MAX_STORES];
+	int num_stores;
+	int exception;		/* EXC_* the program stopped on, -1 if it exited */
+	uint32_t epc;
+} ref_state_t;
+
+mumips_t *FUZZ_SIM = NULL;
+uint32_t FUZZ_PROGRAM[FUZZ_MAX_INSNS + 3];
+uint32_t FUZZ_PROGRAM_SIZE = 0;
+int FUZZ_FORWARDING = 0;
+
+/***************************************************************/
+/* Encoders for the instructions the pipeline implements                      */
+/***************************************************************/
+uint32_t enc_r(uint32_t funct, uint32_t rd, uint32_t rs, uint32_t rt)
+{
+	return (rs << 21) | (rt << 16) | (rd << 11) | funct;
+}
+
+uint32_t enc_i(uint32_t opcode, uint32_t rt, uint32_t rs, uint32_t imm)
+{
+	return (opcode << 26) | (rs << 21) | (rt << 16) | (imm & 0xFFFF);
+}
+
+/***************************************************************/
+/* Turn fuzz bytes into a program: 4 bytes per instruction, then exit      */
+/***************************************************************/
+void build_program(const uint8_t *data, size_t size)
+{
+	static const uint32_t shifts[6] = { 0x00, 0x02, 0x03, 0x04, 0x06, 0x07 };	/* SLL SRL SRA SLLV SRLV SRAV */
+	static const uint32_t loads[3] = { 0x20, 0x21, 0x23 }, stores[3] = { 0x28, 0x29, 0x2B };	/* byte, half, word */
+	uint32_t n = 0, sel, rd, rs, rt, imm, load, store, align;
+	size_t i;
+
+	FUZZ_PROGRAM[n++] = enc_i(0x0F, FUZZ_BASE_REG, 0, MEM_DATA_BEGIN >> 16);	/* LUI $28 */
+	for (i = 0; i + 4 <= size && n < FUZZ_MAX_INSNS + 1; i += 4) {
+		sel = data[i] % 16;
+		rd = 1 + data[i+1] % 27;	/* $1..$27 */
+		rs = data[i+2] & 0x1F;
+		rt = data[i+3] & 0x1F;
+		imm = (data[i+2] << 8 | data[i+3]) ^ (data[i] << 3);
+		load = loads[(data[i] >> 4) % 3];	/* the high bits pick the access size */
+		store = stores[(data[i] >> 4) % 3];
+		align = 0x3FF & ~(load & 0x3);	/* an aligned offset into the first 1 KB of .data */
+		switch (sel) {
+			case 0: FUZZ_PROGRAM[n++] = enc_r(0x20, rd, rs, rt); break;	/* ADD */
+			case 1: FUZZ_PROGRAM[n++] = enc_r(0x24, rd, rs, rt); break;	/* AND */
+			case 2: FUZZ_PROGRAM[n++] = enc_r(0x25, rd, rs, rt); break;	/* OR */
+			case 3: FUZZ_PROGRAM[n++] = enc_r(0x26, rd, rs, rt); break;	/* XOR */
+			case 4: FUZZ_PROGRAM[n++] = enc_i(0x09, rd, rs, imm); break;	/* ADDIU */
+			case 5: FUZZ_PROGRAM[n++] = enc_i(0x0E, rd, rs, imm); break;	/* XORI */
+			case 6: FUZZ_PROGRAM[n++] = enc_i(0x0F, rd, 0, imm); break;	/* LUI */
+			case 7: FUZZ_PROGRAM[n++] = enc_i(load, rd, FUZZ_BASE_REG, imm & align); break;	/* LB, LH, LW */
+			case 8: FUZZ_PROGRAM[n++] = enc_i(store, rt, FUZZ_BASE_REG, imm & align); break;	/* SB, SH, SW */
+			case 9: FUZZ_PROGRAM[n++] = enc_r((imm & 1) ? 0x23 : 0x21, rd, rs, rt); break;	/* SUBU, ADDU */
+			case 10: FUZZ_PROGRAM[n++] = enc_r((imm & 1) ? 0x2B : 0x27, rd, rs, rt); break;	/* SLTU, NOR */
+			case 11: FUZZ_PROGRAM[n++] = enc_r(0x2A, rd, rs, rt); break;	/* SLT */
+			case 12: FUZZ_PROGRAM[n++] = enc_r(shifts[imm % 6], rd, rs, rt) | ((imm & 0x1F) << 6); break;	/* shifts */
+			case 13: FUZZ_PROGRAM[n++] = enc_i((imm & 1) ? 0x0D : 0x0C, rd, rs, imm); break;	/* ORI, ANDI */
+			case 14: FUZZ_PROGRAM[n++] = enc_i((imm & 1) ? 0x0B : 0x0A, rd, rs, imm); break;	/* SLTIU, SLTI */
+			default:
+				/* now and then any base register, so unmapped and straddling */
+				/* addresses show up without drowning out the other findings */
+				FUZZ_PROGRAM[n++] = enc_i((data[i+1] & 1) ? store : load, rd,
+					(data[i+1] & 0x0E) ? FUZZ_BASE_REG : rs, (data[i+1] & 0x0E) ? imm & align : imm);
+				break;
+		}
+	}
+	FUZZ_PROGRAM[n++] = enc_i(0x09, 2, 0, 0xA);	/* ADDIU $v0, $zero, 10 */
+	FUZZ_PROGRAM[n++] = 0x0000000C;			/* SYSCALL */
+	FUZZ_PROGRAM_SIZE = n;
+}
+
+/***************************************************************/
+/* Functional reference: one instruction per step, no pipeline              */
+/***************************************************************/
+int ref_mapped(uint32_t address, uint32_t size)
+{
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if (address >= MEM_REGIONS[i].begin && address <= MEM_REGIONS[i].end - (size - 1)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+uint8_t ref_byte(ref_state_t *ref, uint32_t address)
+{
+	int i;
+
+	for (i = 0; i < ref->num_stores; i++) {
+		if (ref->store_addr[i] == address) {
+			return ref->store_value[i];
+		}
+	}
+	if (address >= MEM_TEXT_BEGIN && address - MEM_TEXT_BEGIN < FUZZ_PROGRAM_SIZE * 4) {
+		return FUZZ_PROGRAM[(address - MEM_TEXT_BEGIN) / 4] >> (8 * (address & 3));
+	}
+	return 0;
+}
+
+/* address and bus errors, as MEM checks them for a size-byte access */
+int ref_check(ref_state_t *ref, uint32_t address, uint32_t size, int store)
+{
+	if (address & (size - 1)) {
+		ref->exception = store ? EXC_ADES : EXC_ADEL;
+	}else if (!ref_mapped(address, size)) {
+		ref->exception = EXC_DBE;
+	}
+	return ref->exception != -1;
+}
+
+/* size bytes, little-endian and zero-extended */
+uint32_t ref_load(ref_state_t *ref, uint32_t address, uint32_t size)
+{
+	uint32_t value = 0, b;
+
+	for (b = 0; b < size; b++) {
+		value |= (uint32_t)ref_byte(ref, address + b) << (8 * b);
+	}
+	return value;
+}
+
+/* the low size bytes of value; the rest of the word is untouched */
+void ref_store(ref_state_t *ref, uint32_t address, uint32_t value, uint32_t size)
+{
+	uint32_t b;
+	int i;
+
+	for (b = 0; b < size; b++) {
+		for (i = 0; i < ref->num_stores && ref->store_addr[i] != address + b; i++);
+		if (i == ref->num_stores) {
+			ref->store_addr[ref->num_stores++] = address + b;
+		}
+		ref->store_value[i] = value >> (8 * b);
+	}
+}
+
+void ref_run(ref_state_t *ref)
+{
+	uint32_t i, ir, opcode, funct, rs, rt, rd, sa, imm, simm, sum, size;
+
+	memset(ref, 0, sizeof(*ref));
+	ref->regs[29] = STACK_POINTER_INIT;
+	ref->regs[28] = GLOBAL_POINTER_INIT;
+	ref->exception = -1;
+	for (i = 0; i < FUZZ_PROGRAM_SIZE; i++) {
+		ir = FUZZ_PROGRAM[i];
+		opcode = ir >> 26;
+		funct = ir & 0x3F;
+		rs = (ir >> 21) & 0x1F;
+		rt = (ir >> 16) & 0x1F;
+		rd = (ir >> 11) & 0x1F;
+		sa = (ir >> 6) & 0x1F;
+		imm = ir & 0xFFFF;
+		simm = (imm & 0x8000) ? (imm | 0xFFFF0000) : imm;
+		size = (opcode & 0x3) + 1;	/* of a load or store: byte, half or word */
+		ref->epc = MEM_TEXT_BEGIN + i * 4;
+		if (opcode == 0x00) {
+			switch (funct) {
+				case 0x20:
+					sum = ref->regs[rs] + ref->regs[rt];
+					if (~(ref->regs[rs] ^ ref->regs[rt]) & (ref->regs[rs] ^ sum) & 0x80000000) {
+						ref->exception = EXC_OV;
+						return;
+					}
+					ref->regs[rd] = sum;
+					break;
+				case 0x21: ref->regs[rd] = ref->regs[rs] + ref->regs[rt]; break;
+				case 0x23: ref->regs[rd] = ref->regs[rs] - ref->regs[rt]; break;
+				case 0x24: ref->regs[rd] = ref->regs[rs] & ref->regs[rt]; break;
+				case 0x25: ref->regs[rd] = ref->regs[rs] | ref->regs[rt]; break;
+				case 0x26: ref->regs[rd] = ref->regs[rs] ^ ref->regs[rt]; break;
+				case 0x27: ref->regs[rd] = ~(ref->regs[rs] | ref->regs[rt]); break;
+				case 0x2A: ref->regs[rd] = (int32_t)ref->regs[rs] < (int32_t)ref->regs[rt]; break;
+				case 0x2B: ref->regs[rd] = ref->regs[rs] < ref->regs[rt]; break;
+				case 0x00: ref->regs[rd] = ref->regs[rt] << sa; break;
+				case 0x02: ref->regs[rd] = ref->regs[rt] >> sa; break;
+				case 0x03: ref->regs[rd] = (int32_t)ref->regs[rt] >> sa; break;
+				case 0x04: ref->regs[rd] = ref->regs[rt] << (ref->regs[rs] & 0x1F); break;
+				case 0x06: ref->regs[rd] = ref->regs[rt] >> (ref->regs[rs] & 0x1F); break;
+				case 0x07: ref->regs[rd] = (int32_t)ref->regs[rt] >> (ref->regs[rs] & 0x1F); break;
+				case 0x0C: return;	/* SYSCALL: $v0 is always 10 here */
+			}
+		}else {
+			switch (opcode) {
+				case 0x09: ref->regs[rt] = ref->regs[rs] + simm; break;
+				case 0x0A: ref->regs[rt] = (int32_t)ref->regs[rs] < (int32_t)simm; break;
+				case 0x0B: ref->regs[rt] = ref->regs[rs] < simm; break;
+				case 0x0C: ref->regs[rt] = ref->regs[rs] & imm; break;
+				case 0x0D: ref->regs[rt] = ref->regs[rs] | imm; break;
+				case 0x0E: ref->regs[rt] = ref->regs[rs] ^ imm; break;
+				case 0x0F: ref->regs[rt] = imm << 16; break;
+				case 0x20:
+				case 0x21:
+				case 0x23:
+					if (ref_check(ref, ref->regs[rs] + simm, size, 0)) {
+						return;
+					}
+					ref->regs[rt] = ref_load(ref, ref->regs[rs] + simm, size);
+					if (opcode == 0x20) {
+						ref->regs[rt] = (int8_t)ref->regs[rt];
+					}else if (opcode == 0x21) {
+						ref->regs[rt] = (int16_t)ref->regs[rt];
+					}
+					break;
+				case 0x28:
+				case 0x29:
+				case 0x2B:
+					if (ref_check(ref, ref->regs[rs] + simm, size, 1)) {
+						return;
+					}
+					ref_store(ref, ref->regs[rs] + simm, ref->regs[rt], size);
+					break;
+			}
+		}
+		ref->regs[0] = 0;
+	}
+}
+
+/***************************************************************/
+/* Run one input on both models; returns a FIND_* code                          */
+/***************************************************************/
+int fuzz_one(const uint8_t *data, size_t size, int verbose)
+{
+	ref_state_t ref;
+	mumips_stats_t stats;
+	uint32_t limit, value;
+	int i, found = FIND_NONE;
+
+	if (FUZZ_SIM == NULL) {
+		FUZZ_SIM = mumips_create();
+		if (FUZZ_SIM == NULL) {
+			fprintf(stderr, "can't create simulator\n");
+			exit(1);
+		}
+	}
+	build_program(data, size);
+	mumips_load_buffer(FUZZ_SIM, FUZZ_PROGRAM, FUZZ_PROGRAM_SIZE);	/* resets in O(dirty pages) */
+	mumips_set_forwarding(FUZZ_SIM, FUZZ_FORWARDING);
+	mumips_set_activity(FUZZ_SIM, 0);	/* energy is not checked */
+
+	limit = FUZZ_PROGRAM_SIZE * 8 + 64;
+	mumips_step(FUZZ_SIM, limit);
+	mumips_get_stats(FUZZ_SIM, &stats);
+	ref_run(&ref);
+
+	if (stats.running) {
+		found = FIND_HANG;
+		if (verbose) {
+			printf("hang: no exit after %u cycles\n", limit);
+		}
+	}else if (stats.mem_faults != 0) {
+		found = FIND_OUT_OF_BOUNDS;
+		if (verbose) {
+			printf("untrapped out-of-bounds access: %u\n", stats.mem_faults);
+		}
+	}else if (stats.exception != ref.exception ||
+		(ref.exception != -1 && mumips_get_cp0(FUZZ_SIM, CP0_EPC) != ref.epc)) {
+		found = FIND_DIVERGENCE;
+		if (verbose) {
+			printf("divergence: pipeline stopped on %s at 0x%08x, reference on %s at 0x%08x\n",
+				stats.exception == -1 ? "exit" : exception_name(stats.exception), mumips_get_cp0(FUZZ_SIM, CP0_EPC),
+				ref.exception == -1 ? "exit" : exception_name(ref.exception), ref.epc);
+		}
+	}
+	for (i = 1; i < MIPS_REGS && found == FIND_NONE; i++) {
+		value = mumips_get_reg(FUZZ_SIM, i);
+		if (value != ref.regs[i]) {
+			found = FIND_DIVERGENCE;
+			if (verbose) {
+				printf("divergence: $r%d pipeline 0x%08x reference 0x%08x\n", i, value, ref.regs[i]);
+			}
+		}
+	}
+	for (i = 0; i < ref.num_stores && found == FIND_NONE; i++) {
+		/* regions are word aligned, so the enclosing aligned word is mapped */
+		value = (mumips_read_mem(FUZZ_SIM, ref.store_addr[i] & ~3) >> (8 * (ref.store_addr[i] & 3))) & 0xFF;
+		if (value != ref.store_value[i]) {
+			found = FIND_DIVERGENCE;
+			if (verbose) {
+				printf("divergence: byte [0x%08x] pipeline 0x%02x reference 0x%02x\n",
+					ref.store_addr[i], value, ref.store_value[i]);
+			}
+		}
+	}
+	return found;
+}
+
+/***************************************************************/
+/* Print the program under test as a loadable .in file                              */
+/***************************************************************/
+void print_reproducer(FILE *fp)
+{
+	uint32_t i;
+	for (i = 0; i < FUZZ_PROGRAM_SIZE; i++) {
+		fprintf(fp, "%X\n", FUZZ_PROGRAM[i]);
+	}
+}
+
+/***************************************************************/
+/* libFuzzer entry point: any finding aborts                                                */
+/***************************************************************/
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	if (fuzz_one(data, size, 1) != FIND_NONE) {
+		print_reproducer(stderr);
+		abort();
+	}
+	return 0;
+}
+
+#ifndef MUMIPS_LIBFUZZER
+/***************************************************************/
+/* Standalone persistent mode: generate inputs in-process                     */
+/***************************************************************/
+void crash_handler(int sig)
+{
+	fprintf(stderr, "crash (signal %d) on program:\n", sig);
+	print_reproducer(stderr);
+	_exit(128 + sig);
+}
+
+uint64_t xorshift64(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t data[FUZZ_MAX_INSNS * 4];
+	uint64_t seed = 1, iterations = 100000, i, rnd;
+	uint64_t counts[4] = { 0, 0, 0, 0 };
+	const char *names[4] = { "clean", "divergences", "out-of-bounds", "hangs" };
+	int keep_going = 0, opt, found, j;
+	size_t size;
+	struct timespec t0, t1;
+	double secs;
+
+	while ((opt = getopt(argc, argv, "n:s:fk")) != -1) {
+		switch (opt) {
+			case 'n': iterations = strtoull(optarg, NULL, 0); break;
+			case 's': seed = strtoull(optarg, NULL, 0); break;
+			case 'f': FUZZ_FORWARDING = 1; break;
+			case 'k': keep_going = 1; break;
+			default:
+				fprintf(stderr, "Usage: %s [-n iterations] [-s seed] [-f forwarding] [-k keep going]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (seed == 0) {
+		seed = 1;	/* xorshift has no zero state */
+	}
+	signal(SIGSEGV, crash_handler);
+	signal(SIGBUS, crash_handler);
+	signal(SIGFPE, crash_handler);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < iterations; i++) {
+		size = 4 * (1 + xorshift64(&seed) % FUZZ_MAX_INSNS);
+		for (j = 0; j < (int)size; j += 8) {
+			rnd = xorshift64(&seed);
+			memcpy(data + j, &rnd, (size - j < 8) ? size - j : 8);
+		}
+		found = fuzz_one(data, size, !keep_going);
+		counts[found]++;
+		if (found != FIND_NONE && !keep_going) {
+			printf("after %llu inputs, program:\n", (unsigned long long)i + 1);
+			print_reproducer(stdout);
+			return 2;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("%llu inputs in %.2f s (%.0f exec/s)\n", (unsigned long long)iterations, secs, iterations / secs);
+	for (j = 0; j < 4; j++) {
+		printf("  %-14s %llu\n", names[j], (unsigned long long)counts[j]);
+	}
+	return (counts[FIND_DIVERGENCE] + counts[FIND_OUT_OF_BOUNDS] + counts[FIND_HANG]) != 0;
+}
+#endif
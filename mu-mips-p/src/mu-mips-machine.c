@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <strings.h>
+
+#include "mu-mips.h"
+
+const char *STAGE_NAMES[NUM_STAGES] = { "IF", "ID", "EX", "MEM", "WB" };
+const char *UNIT_NAMES[NUM_UNITS] = { "alu", "muldiv", "load", "store" };
+const char *ACTIVITY_NAMES[NUM_ACTIVITY] = { "fetch", "rf_read", "alu", "mem_read", "mem_write", "rf_write", "forward", "latch" };
+const char *TLB_NAMES[NUM_TLBS] = { "itlb", "dtlb" };
+const char *CACHE_NAMES[NUM_CACHES] = { "icache", "dcache" };
+const char *PREFETCH_NAMES[NUM_PREFETCHERS] = { "none", "next_line", "stride", "stream" };
+
+/* rough 45 nm figures in pJ: small SRAM reads, a 32-bit adder plus */
+/* control, a multi-ported register file, one flip-flop toggling             */
+const double DEFAULT_ENERGY[NUM_ACTIVITY] = { 10.0, 1.0, 0.5, 10.0, 12.0, 1.5, 0.1, 0.02 };
+
+machine_t MACHINE;
+char machine_file[256];
+uint32_t FETCH_DELAY = 0;
+uint32_t LATENCY_STALLS = 0;
+uint32_t REDIRECT_BUBBLES = 0;
+uint64_t ACTIVITY[NUM_ACTIVITY];
+
+/***************************************************************/
+/* The classic five-stage pipeline with both forwarding paths                */
+/***************************************************************/
+void default_machine(machine_t *m)
+{
+	int i;
+
+	memset(m, 0, sizeof(*m));
+	snprintf(m->name, sizeof(m->name), "classic");
+	for (i = 0; i < NUM_STAGES; i++) {
+		m->depth[i] = 1;
+	}
+	for (i = 0; i < NUM_UNITS; i++) {
+		m->latency[i] = 1;
+	}
+	m->forward = FWD_EX_MEM | FWD_MEM_WB;
+	memcpy(m->energy, DEFAULT_ENERGY, sizeof(m->energy));
+	m->tlb_miss = 20;
+	m->tlb_refill = TLB_REFILL_HARDWARE;
+	m->store_drain = 4;
+	m->cache_line = 32;
+	m->cache_miss = 20;
+	m->prefetch_degree = 1;
+	m->prefetch_distance = 1;
+	apply_machine(m);
+}
+
+/***************************************************************/
+/* Derive stall distances from stage depths                                                  */
+/*                                                                                                                             */
+/* A producer k instructions ahead of the one in ID has EX + MEM + WB - k  */
+/* cycles left before its register write; ID reads the same cycle WB     */
+/* writes. Forwarded ALU results are ready once the producer leaves EX,   */
+/* loaded ones once it leaves MEM. A software TLB refill flushes into the */
+/* handler and again on its way back.                                                               */
+/***************************************************************/
+void apply_machine(machine_t *m)
+{
+	uint32_t back = m->depth[STAGE_EX] + m->depth[STAGE_MEM] + m->depth[STAGE_WB];
+	int i;
+
+	m->stall_ex_mem = back - 1;
+	m->stall_mem_wb = back - 2;
+	m->forward_stall_ex_mem = m->depth[STAGE_EX] - 1;
+	m->forward_stall_mem_wb = m->depth[STAGE_EX] > 2 ? m->depth[STAGE_EX] - 2 : 0;
+	m->load_stall = m->depth[STAGE_EX] + m->depth[STAGE_MEM] - 1;
+	m->redirect_penalty = 0;
+	for (i = 0; i < NUM_STAGES; i++) {
+		m->redirect_penalty += m->depth[i] - 1;
+	}
+	m->tlb_trap = 2 * (m->depth[STAGE_IF] + m->depth[STAGE_ID] + m->depth[STAGE_EX]);
+	m->line_shift = 0;
+	while ((1u << m->line_shift) < m->cache_line) {
+		m->line_shift++;
+	}
+	for (i = 0; i < NUM_CACHES; i++) {
+		m->cache_lines[i] = m->cache_size[i] >> m->line_shift;
+	}
+	m->memsys = m->tlb_entries[TLB_I] != 0 || m->tlb_entries[TLB_D] != 0 || m->store_buffer != 0 ||
+		m->cache_size[CACHE_I] != 0 || m->cache_size[CACHE_D] != 0;
+}
+
+/***************************************************************/
+/* Index of name in a table, -1 if absent                                                        */
+/***************************************************************/
+int machine_lookup(const char *name, const char **table, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (strcasecmp(name, table[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/***************************************************************/
+/* Apply one line of a machine description to m                                             */
+/*                                                                                                                             */
+/*   name deep-mem                                                                                              */
+/*   stage MEM 2          # pipelined sub-stages                                          */
+/*   latency muldiv 4     # cycles the unit is busy                                      */
+/*   forward mem_wb off                                                                                  */
+/*   energy mem_read 20   # pJ per event                                                      */
+/*   tlb dtlb 64 4        # entries and ways, 0 ways = fully associative   */
+/*   tlb miss 30          # cycles to refill an entry                              */
+/*   tlb refill software  # or hardware, the default                               */
+/*   store_buffer depth 8 # entries, 0 (the default) = no buffer            */
+/*   store_buffer drain 4 # cycles to write one entry                            */
+/*   store_buffer combine 16  # merge stores within 16-byte blocks         */
+/*   cache dcache 8192 2  # bytes and ways, 0 ways = fully associative    */
+/*   cache line 32        # bytes per line, both caches                         */
+/*   cache miss 20        # cycles to fill a line                                   */
+/*   prefetch dcache stride   # none next_line stride stream                  */
+/*   prefetch degree 2    # lines per trigger                                          */
+/*   prefetch distance 4  # lines ahead of the trigger                          */
+/***************************************************************/
+int machine_line(machine_t *m, char *line, const char *origin, int lineno)
+{
+	char key[64], arg[64], value[64], extra[64];
+	char *hash;
+	int n, i;
+	long v, ways;
+
+	if ((hash = strchr(line, '#')) != NULL) {
+		*hash = '\0';
+	}
+	n = sscanf(line, "%63s %63s %63s %63s", key, arg, value, extra);
+	if (n <= 0) {
+		return 0;
+	}
+	if (strcmp(key, "name") == 0 && n >= 2) {
+		snprintf(m->name, sizeof(m->name), "%s", arg);
+	}else if (strcmp(key, "stage") == 0 && n == 3) {
+		i = machine_lookup(arg, STAGE_NAMES, NUM_STAGES);
+		v = strtol(value, NULL, 0);
+		if (i < 0 || v < 1 || v > MAX_STAGE_DEPTH) {
+			printf("%s:%d: expected a stage (IF ID EX MEM WB) and a depth 1-%d\n", origin, lineno, MAX_STAGE_DEPTH);
+			return -1;
+		}
+		m->depth[i] = v;
+	}else if (strcmp(key, "latency") == 0 && n == 3) {
+		i = machine_lookup(arg, UNIT_NAMES, NUM_UNITS);
+		v = strtol(value, NULL, 0);
+		if (i < 0 || v < 1 || v > MAX_UNIT_LATENCY) {
+			printf("%s:%d: expected a unit (alu muldiv load store) and a latency 1-%d\n", origin, lineno, MAX_UNIT_LATENCY);
+			return -1;
+		}
+		m->latency[i] = v;
+	}else if (strcmp(key, "forward") == 0 && n == 3) {
+		i = (strcasecmp(arg, "ex_mem") == 0) ? FWD_EX_MEM : (strcasecmp(arg, "mem_wb") == 0) ? FWD_MEM_WB : 0;
+		if (i == 0 || (strcmp(value, "on") != 0 && strcmp(value, "off") != 0)) {
+			printf("%s:%d: expected forward ex_mem|mem_wb on|off\n", origin, lineno);
+			return -1;
+		}
+		if (strcmp(value, "on") == 0) {
+			m->forward |= i;
+		}else {
+			m->forward &= ~i;
+		}
+	}else if (strcmp(key, "energy") == 0 && n == 3) {
+		i = machine_lookup(arg, ACTIVITY_NAMES, NUM_ACTIVITY);
+		if (i < 0 || strtod(value, NULL) < 0) {
+			printf("%s:%d: expected an activity (fetch rf_read alu mem_read mem_write rf_write forward latch) and pJ\n", origin, lineno);
+			return -1;
+		}
+		m->energy[i] = strtod(value, NULL);
+	}else if (strcmp(key, "tlb") == 0 && n == 3 && strcasecmp(arg, "miss") == 0) {
+		v = strtol(value, NULL, 0);
+		if (v < 1 || v > MAX_UNIT_LATENCY) {
+			printf("%s:%d: expected tlb miss 1-%d\n", origin, lineno, MAX_UNIT_LATENCY);
+			return -1;
+		}
+		m->tlb_miss = v;
+	}else if (strcmp(key, "tlb") == 0 && n == 3 && strcasecmp(arg, "refill") == 0) {
+		if (strcasecmp(value, "hardware") != 0 && strcasecmp(value, "software") != 0) {
+			printf("%s:%d: expected tlb refill hardware|software\n", origin, lineno);
+			return -1;
+		}
+		m->tlb_refill = (strcasecmp(value, "software") == 0) ? TLB_REFILL_SOFTWARE : TLB_REFILL_HARDWARE;
+	}else if (strcmp(key, "store_buffer") == 0 && n == 3) {
+		v = strtol(value, NULL, 0);
+		if (strcasecmp(arg, "depth") == 0 && v >= 0 && v <= MAX_STORE_BUFFER) {
+			m->store_buffer = v;
+		}else if (strcasecmp(arg, "drain") == 0 && v >= 1 && v <= MAX_UNIT_LATENCY) {
+			m->store_drain = v;
+		}else if (strcasecmp(arg, "combine") == 0 && (v == 0 || (v >= 4 && v <= MAX_COMBINE_BYTES && (v & (v - 1)) == 0))) {
+			m->store_combine = v;
+		}else {
+			printf("%s:%d: expected store_buffer depth 0-%d, drain 1-%d or combine 0|4|8|16|32\n", origin, lineno,
+				MAX_STORE_BUFFER, MAX_UNIT_LATENCY);
+			return -1;
+		}
+	}else if (strcmp(key, "cache") == 0 && n == 3 && (strcasecmp(arg, "line") == 0 || strcasecmp(arg, "miss") == 0)) {
+		v = strtol(value, NULL, 0);
+		if (strcasecmp(arg, "line") == 0 && v >= 4 && v <= MAX_CACHE_LINE && (v & (v - 1)) == 0) {
+			m->cache_line = v;
+		}else if (strcasecmp(arg, "miss") == 0 && v >= 1 && v <= MAX_UNIT_LATENCY * 4) {
+			m->cache_miss = v;
+		}else {
+			printf("%s:%d: expected cache line 4-%d (a power of two) or cache miss 1-%d\n", origin, lineno,
+				MAX_CACHE_LINE, MAX_UNIT_LATENCY * 4);
+			return -1;
+		}
+	}else if (strcmp(key, "cache") == 0 && (n == 3 || n == 4)) {
+		i = machine_lookup(arg, CACHE_NAMES, NUM_CACHES);
+		v = strtol(value, NULL, 0);
+		ways = (n == 4) ? strtol(extra, NULL, 0) : 0;
+		if (i < 0 || v < 0 || ways < 0) {
+			printf("%s:%d: expected a cache (icache dcache), its size in bytes and ways\n", origin, lineno);
+			return -1;
+		}
+		m->cache_size[i] = v;
+		m->cache_ways[i] = ways;
+	}else if (strcmp(key, "prefetch") == 0 && n == 3 && (strcasecmp(arg, "degree") == 0 || strcasecmp(arg, "distance") == 0)) {
+		v = strtol(value, NULL, 0);
+		if (strcasecmp(arg, "degree") == 0 && v >= 1 && v <= MAX_PREFETCH_DEGREE) {
+			m->prefetch_degree = v;
+		}else if (strcasecmp(arg, "distance") == 0 && v >= 1 && v <= 64) {
+			m->prefetch_distance = v;
+		}else {
+			printf("%s:%d: expected prefetch degree 1-%d or distance 1-64\n", origin, lineno, MAX_PREFETCH_DEGREE);
+			return -1;
+		}
+	}else if (strcmp(key, "prefetch") == 0 && n == 3) {
+		i = machine_lookup(arg, CACHE_NAMES, NUM_CACHES);
+		v = machine_lookup(value, PREFETCH_NAMES, NUM_PREFETCHERS);
+		if (i < 0 || v < 0 || (i == CACHE_I && v == PREFETCH_STRIDE)) {
+			printf("%s:%d: expected prefetch icache|dcache none|next_line|stride|stream (stride is dcache only)\n", origin, lineno);
+			return -1;
+		}
+		m->prefetch[i] = v;
+	}else if (strcmp(key, "tlb") == 0 && (n == 3 || n == 4)) {
+		i = machine_lookup(arg, TLB_NAMES, NUM_TLBS);
+		v = strtol(value, NULL, 0);
+		ways = (n == 4) ? strtol(extra, NULL, 0) : 0;
+		if (i < 0 || v < 0 || v > MAX_TLB_ENTRIES || ways < 0 || (ways != 0 && v % ways != 0)) {
+			printf("%s:%d: expected a TLB (itlb dtlb), 0-%d entries and ways dividing them\n", origin, lineno, MAX_TLB_ENTRIES);
+			return -1;
+		}
+		m->tlb_entries[i] = v;
+		m->tlb_ways[i] = (ways == v) ? 0 : ways;
+	}else {
+		printf("%s:%d: unknown line '%s'\n", origin, lineno, key);
+		return -1;
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Settings that only make sense together, checked once all are read    */
+/***************************************************************/
+int check_machine(const machine_t *m, const char *origin)
+{
+	uint32_t lines, ways;
+	int i, errors = 0;
+
+	for (i = 0; i < NUM_CACHES; i++) {
+		if (m->cache_size[i] == 0) {
+			continue;
+		}
+		lines = m->cache_size[i] / m->cache_line;
+		ways = m->cache_ways[i] ? m->cache_ways[i] : lines;
+		if (m->cache_size[i] % m->cache_line != 0 || lines > MAX_CACHE_LINES || lines % ways != 0) {
+			printf("%s: %s of %u bytes needs whole %u-byte lines, at most %d of them, split evenly over %u ways\n", origin,
+				CACHE_NAMES[i], m->cache_size[i], m->cache_line, MAX_CACHE_LINES, ways);
+			errors++;
+		}
+	}
+	return errors;
+}
+
+/***************************************************************/
+/* Read a machine description; MACHINE is only replaced if it all parses */
+/***************************************************************/
+int load_machine(const char *path)
+{
+	char line[CMD_LINE_SIZE];
+	machine_t m;
+	FILE *fp;
+	int lineno = 0, errors = 0;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("Error: Can't open machine description %s\n", path);
+		return -1;
+	}
+	default_machine(&m);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		errors += (machine_line(&m, line, path, ++lineno) != 0);
+	}
+	fclose(fp);
+	if (errors != 0 || check_machine(&m, path) != 0) {
+		return -1;
+	}
+	apply_machine(&m);
+	MACHINE = m;
+	snprintf(machine_file, sizeof(machine_file), "%s", path);
+	return 0;
+}
+
+/***************************************************************/
+/* Same, from newline-separated text                                                             */
+/***************************************************************/
+int parse_machine(const char *text)
+{
+	char line[CMD_LINE_SIZE];
+	machine_t m;
+	const char *end;
+	int lineno = 0, errors = 0;
+	size_t len;
+
+	default_machine(&m);
+	while (*text != '\0') {
+		end = strchr(text, '\n');
+		len = end ? (size_t)(end - text) : strlen(text);
+		snprintf(line, sizeof(line), "%.*s", (int)len, text);
+		errors += (machine_line(&m, line, "machine", ++lineno) != 0);
+		text += len + (end != NULL);
+	}
+	if (errors != 0 || check_machine(&m, "machine") != 0) {
+		return -1;
+	}
+	apply_machine(&m);
+	MACHINE = m;
+	snprintf(machine_file, sizeof(machine_file), "(%s)", m.name);
+	return 0;
+}
+
+/***************************************************************/
+/* One-line summary of the machine description                                          */
+/***************************************************************/
+void print_machine()
+{
+	int i;
+
+	printf("%s (", MACHINE.name);
+	for (i = 0; i < NUM_STAGES; i++) {
+		printf("%s%s", i ? " " : "", STAGE_NAMES[i]);
+		if (MACHINE.depth[i] != 1) {
+			printf("x%u", MACHINE.depth[i]);
+		}
+	}
+	for (i = 0; i < NUM_UNITS; i++) {
+		if (MACHINE.latency[i] != 1) {
+			printf(", %s %u", UNIT_NAMES[i], MACHINE.latency[i]);
+		}
+	}
+	for (i = 0; i < NUM_TLBS; i++) {
+		if (MACHINE.tlb_entries[i] != 0) {
+			printf(", %s %u", TLB_NAMES[i], MACHINE.tlb_entries[i]);
+			if (MACHINE.tlb_ways[i] != 0) {
+				printf("x%u", MACHINE.tlb_ways[i]);
+			}
+		}
+	}
+	if (MACHINE.tlb_entries[TLB_I] != 0 || MACHINE.tlb_entries[TLB_D] != 0) {
+		printf(", tlb miss %u %s", MACHINE.tlb_miss, MACHINE.tlb_refill == TLB_REFILL_SOFTWARE ? "software" : "hardware");
+	}
+	for (i = 0; i < NUM_CACHES; i++) {
+		if (MACHINE.cache_size[i] != 0) {
+			printf(", %s %u", CACHE_NAMES[i], MACHINE.cache_size[i]);
+			if (MACHINE.cache_ways[i] != 0) {
+				printf("x%u", MACHINE.cache_ways[i]);
+			}
+			if (MACHINE.prefetch[i] != PREFETCH_NONE) {
+				printf(" %s", PREFETCH_NAMES[MACHINE.prefetch[i]]);
+			}
+		}
+	}
+	if (MACHINE.cache_size[CACHE_I] != 0 || MACHINE.cache_size[CACHE_D] != 0) {
+		printf(", line %u miss %u", MACHINE.cache_line, MACHINE.cache_miss);
+	}
+	if (MACHINE.store_buffer != 0) {
+		printf(", store buffer %u drain %u", MACHINE.store_buffer, MACHINE.store_drain);
+		if (MACHINE.store_combine != 0) {
+			printf(" combine %u", MACHINE.store_combine);
+		}
+	}
+	printf(", forward%s%s%s)\n", (MACHINE.forward & FWD_EX_MEM) ? " ex_mem" : "",
+		(MACHINE.forward & FWD_MEM_WB) ? " mem_wb" : "", MACHINE.forward ? "" : " none");
+}
+
+/***************************************************************/
+/* Unit an instruction occupies, -1 for a bubble                                              */
+/***************************************************************/
+int instruction_unit(uint32_t ir)
+{
+	const instr_desc_t *d;
+
+	if (ir == 0 || (d = decode_instruction(ir)) == NULL) {
+		return -1;
+	}
+	switch (d->format) {
+		case FMT_MULDIV:
+		case FMT_MFHL:
+		case FMT_MTHL:
+			return UNIT_MULDIV;
+		case FMT_MEM:
+			return (d->opcode & 0x08) ? UNIT_STORE : UNIT_LOAD;
+		default:
+			return UNIT_ALU;
+	}
+}
+
+/***************************************************************/
+/* Cycles the instruction that just left EX keeps its unit busy                  */
+/*                                                                                                                             */
+/* Charged as a stall on the next issue, so a non-pipelined unit delays   */
+/* everything behind it without the datapath holding it in place.          */
+/***************************************************************/
+uint32_t unit_busy(uint32_t ir)
+{
+	int unit = instruction_unit(ir);
+
+	return (unit < 0) ? 0 : MACHINE.latency[unit] - 1;
+}
+
+/***************************************************************/
+/* Does ir write a general register in WB                                                      */
+/***************************************************************/
+int writes_register(uint32_t ir)
+{
+	if (ir == 0) {
+		return FALSE;
+	}
+	return (register_use(decode_instruction(ir)) & (REG_WRITES_RD | REG_WRITES_RT)) != 0;
+}
+
+/***************************************************************/
+/* Set bits in x; __builtin_popcount is a libgcc call without -mpopcnt     */
+/***************************************************************/
+static inline uint32_t bit_count(uint32_t x)
+{
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0F0F0F0F;
+	return (x * 0x01010101) >> 24;
+}
+
+/***************************************************************/
+/* Count latch bits that changed over a sampled cycle                                   */
+/***************************************************************/
+void count_latch_toggles(const CPU_Pipeline_Reg before[4])
+{
+	const CPU_Pipeline_Reg *after[4] = { &IF_ID, &ID_EX, &EX_MEM, &MEM_WB };
+	uint64_t bits = 0;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		bits += bit_count(before[i].PC ^ after[i]->PC) + bit_count(before[i].IR ^ after[i]->IR) +
+			bit_count(before[i].A ^ after[i]->A) + bit_count(before[i].B ^ after[i]->B) +
+			bit_count(before[i].imm ^ after[i]->imm) + bit_count(before[i].ALUOutput ^ after[i]->ALUOutput) +
+			bit_count(before[i].LMD ^ after[i]->LMD);
+	}
+	ACTIVITY[ACT_LATCH] += bits * LATCH_SAMPLE_CYCLES;
+}
+
+/***************************************************************/
+/* Energy of the run so far, in pJ                                                                      */
+/***************************************************************/
+double activity_energy()
+{
+	double total = 0;
+	int i;
+
+	for (i = 0; i < NUM_ACTIVITY; i++) {
+		total += ACTIVITY[i] * MACHINE.energy[i];
+	}
+	return total;
+}
+
+/***************************************************************/
+/* Energy total, per instruction and per activity                                            */
+/***************************************************************/
+void print_energy()
+{
+	double total = activity_energy();
+	int i;
+
+	if (total == 0 && !ENABLE_ACTIVITY) {
+		printf("Energy\t\t\t: not counted (energy 0)\n");
+		return;
+	}
+	printf("Energy\t\t\t: %.3f nJ (%.2f pJ/instruction)\n", total / 1000, INSTRUCTION_COUNT ? total / INSTRUCTION_COUNT : 0.0);
+	for (i = 0; i < NUM_ACTIVITY && total > 0; i++) {
+		if (ACTIVITY[i] != 0) {
+			printf("  %-9s\t\t: %llu x %.2f pJ (%.1f%%)\n", ACTIVITY_NAMES[i], (unsigned long long)ACTIVITY[i],
+				MACHINE.energy[i], 100.0 * ACTIVITY[i] * MACHINE.energy[i] / total);
+		}
+	}
+}
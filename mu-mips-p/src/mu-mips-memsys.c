@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "mu-mips.h"
+
+memsys_t MEMSYS;
+
+/***************************************************************/
+/* Empty TLBs and zero counters; the touched-page bitmap is kept, cleared */
+/***************************************************************/
+void reset_memsys()
+{
+	uint8_t *touched = MEMSYS.touched;
+
+	memset(&MEMSYS, 0, sizeof(MEMSYS));
+	if (touched != NULL) {
+		memset(touched, 0, PAGE_BITMAP_SIZE);
+		MEMSYS.touched = touched;
+	}
+}
+
+/***************************************************************/
+/* Next LRU stamp; on wrap-around the order is forgotten, not the entries */
+/***************************************************************/
+static uint32_t next_stamp()
+{
+	int t, i;
+
+	if (++MEMSYS.stamp == 0) {
+		for (t = 0; t < NUM_TLBS; t++) {
+			for (i = 0; i < MAX_TLB_ENTRIES; i++) {
+				MEMSYS.tlb[t].used[i] = (MEMSYS.tlb[t].used[i] != 0);
+			}
+		}
+		for (t = 0; t < NUM_CACHES; t++) {
+			for (i = 0; i < MAX_CACHE_LINES; i++) {
+				MEMSYS.cache[t].used[i] = (MEMSYS.cache[t].used[i] != 0);
+			}
+		}
+		MEMSYS.stamp = 2;
+	}
+	return MEMSYS.stamp;
+}
+
+/***************************************************************/
+/* Look a page up on a TLB miss, marking it the first time it is used    */
+/***************************************************************/
+static void walk_page_table(uint32_t vpn)
+{
+	uint8_t bit = 1 << (vpn & 7);
+
+	if (MEMSYS.touched == NULL) {
+		MEMSYS.touched = calloc(PAGE_BITMAP_SIZE, 1);
+		assert(MEMSYS.touched != NULL);
+	}
+	if (!(MEMSYS.touched[vpn >> 3] & bit)) {
+		MEMSYS.touched[vpn >> 3] |= bit;
+		MEMSYS.page_faults++;
+		if (RECORDING) {
+			record_touched_page(vpn);
+		}
+	}
+}
+
+/***************************************************************/
+/* Translate address through one TLB; returns the cycles a miss costs,   */
+/* 0 on a hit. The set is vpn mod sets and LRU picks the victim.           */
+/***************************************************************/
+static uint32_t tlb_access(int which, uint32_t address)
+{
+	tlb_t *tlb = &MEMSYS.tlb[which];
+	uint32_t vpn = address >> PAGE_SHIFT;
+	uint32_t entries = MACHINE.tlb_entries[which];
+	uint32_t ways = MACHINE.tlb_ways[which] ? MACHINE.tlb_ways[which] : entries;
+	uint32_t first, i, victim, cycles, stamp = next_stamp();
+
+	tlb->accesses++;
+	if (tlb->used[tlb->last] != 0 && tlb->vpn[tlb->last] == vpn) {
+		tlb->used[tlb->last] = stamp;
+		return 0;
+	}
+	first = (vpn % (entries / ways)) * ways;
+	victim = first;
+	for (i = first; i < first + ways; i++) {
+		if (tlb->used[i] != 0 && tlb->vpn[i] == vpn) {
+			tlb->used[i] = stamp;
+			tlb->last = i;
+			return 0;
+		}
+		if (tlb->used[i] < tlb->used[victim]) {
+			victim = i;
+		}
+	}
+
+	tlb->misses++;
+	walk_page_table(vpn);
+	tlb->vpn[victim] = vpn;
+	tlb->used[victim] = stamp;
+	tlb->last = victim;
+	cycles = MACHINE.tlb_miss;
+	if (MACHINE.tlb_refill == TLB_REFILL_SOFTWARE) {
+		cycles += MACHINE.tlb_trap;
+	}
+	MEMSYS.walk_cycles += cycles;
+	return cycles;
+}
+
+/***************************************************************/
+/* First entry of the set line maps to in cache c, and the set's ways   */
+/***************************************************************/
+static uint32_t cache_set(int c, uint32_t line, uint32_t *ways)
+{
+	uint32_t lines = MACHINE.cache_lines[c];
+
+	*ways = MACHINE.cache_ways[c] ? MACHINE.cache_ways[c] : lines;
+	return (line % (lines / *ways)) * *ways;
+}
+
+/***************************************************************/
+/* Entry holding line in cache c, -1 if it is not there                            */
+/***************************************************************/
+static int cache_find(int c, uint32_t line)
+{
+	cache_t *cache = &MEMSYS.cache[c];
+	uint32_t first, ways, i;
+
+	if (cache->used[cache->last] != 0 && cache->tag[cache->last] == line) {
+		return cache->last;
+	}
+	first = cache_set(c, line, &ways);
+	for (i = first; i < first + ways; i++) {
+		if (cache->used[i] != 0 && cache->tag[i] == line) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/***************************************************************/
+/* Put line in cache c over the LRU entry of its set                             */
+/***************************************************************/
+static uint32_t cache_fill(int c, uint32_t line, uint32_t ready, int prefetched)
+{
+	cache_t *cache = &MEMSYS.cache[c];
+	uint32_t first, ways, i, victim;
+
+	first = cache_set(c, line, &ways);
+	victim = first;
+	for (i = first + 1; i < first + ways; i++) {
+		if (cache->used[i] < cache->used[victim]) {
+			victim = i;
+		}
+	}
+	cache->tag[victim] = line;
+	cache->used[victim] = next_stamp();
+	cache->ready[victim] = ready;
+	cache->prefetched[victim] = prefetched;
+	return victim;
+}
+
+/***************************************************************/
+/* Ask for line ahead of use unless cache c already has it                    */
+/***************************************************************/
+static void prefetch_line(int c, uint32_t line, uint32_t now)
+{
+	if (cache_find(c, line) < 0) {
+		cache_fill(c, line, now + MACHINE.cache_miss, TRUE);
+		MEMSYS.cache[c].issued++;
+	}
+}
+
+/***************************************************************/
+/* Restart the stream buffer of cache c after line                                */
+/***************************************************************/
+static void stream_start(int c, uint32_t line, uint32_t now)
+{
+	cache_t *cache = &MEMSYS.cache[c];
+	uint32_t k;
+
+	cache->stream_head = 0;
+	cache->stream_count = MACHINE.prefetch_degree;
+	for (k = 0; k < MACHINE.prefetch_degree; k++) {
+		cache->stream[k] = line + MACHINE.prefetch_distance + k;
+		cache->stream_ready[k] = now + MACHINE.cache_miss;
+	}
+	cache->issued += MACHINE.prefetch_degree;
+}
+
+/***************************************************************/
+/* Take line from the head of the stream buffer if it is there; the     */
+/* buffer asks for one more line to stay degree deep                             */
+/***************************************************************/
+static int stream_hit(int c, uint32_t line, uint32_t now, uint32_t *cycles)
+{
+	cache_t *cache = &MEMSYS.cache[c];
+	uint32_t head = cache->stream_head, tail;
+
+	if (cache->stream_count == 0 || cache->stream[head] != line) {
+		return FALSE;
+	}
+	*cycles = 0;
+	if ((int32_t)(cache->stream_ready[head] - now) > 0) {
+		*cycles = cache->stream_ready[head] - now;
+		cache->late++;
+	}
+	cache->useful++;
+	tail = (head + cache->stream_count - 1) % MACHINE.prefetch_degree;
+	cache->stream[head] = cache->stream[tail] + 1;	/* the freed slot becomes the new tail */
+	cache->stream_ready[head] = now + MACHINE.cache_miss;
+	cache->stream_head = (head + 1) % MACHINE.prefetch_degree;
+	cache->issued++;
+	return TRUE;
+}
+
+/***************************************************************/
+/* Note address in a stride entry; TRUE once the same stride came twice */
+/***************************************************************/
+static int stride_train(stride_entry_t *e, uint32_t address)
+{
+	uint32_t delta = address - e->last;
+
+	e->last = address;
+	if (delta == 0 || delta != e->stride) {
+		e->stride = delta;
+		e->confidence = 0;
+		return FALSE;
+	}
+	if (e->confidence < 2) {
+		e->confidence++;
+	}
+	return e->confidence == 2;
+}
+
+/***************************************************************/
+/* Prefetch along the stride of this load or store's PC. Straight-line  */
+/* code runs each PC once, so until its own entry is trained the stride */
+/* of consecutive data accesses is used.                              */
+/***************************************************************/
+static void stride_prefetch(int c, uint32_t pc, uint32_t address, uint32_t now)
+{
+	stride_entry_t *e = &MEMSYS.strides[(pc >> 2) % STRIDE_TABLE_SIZE];
+	int confident = FALSE;
+	uint32_t k;
+
+	if (e->pc != pc) {
+		e->pc = pc;
+		e->last = address;
+		e->stride = 0;
+		e->confidence = 0;
+	}else {
+		confident = stride_train(e, address);
+	}
+	if (stride_train(&MEMSYS.global_stride, address) && !confident) {
+		e = &MEMSYS.global_stride;
+		confident = TRUE;
+	}
+	if (confident) {
+		for (k = 0; k < MACHINE.prefetch_degree; k++) {
+			prefetch_line(c, (address + e->stride * (MACHINE.prefetch_distance + k)) >> MACHINE.line_shift, now);
+		}
+	}
+}
+
+/***************************************************************/
+/* One access to cache c, then whatever its prefetcher does with it;    */
+/* returns the cycles the access waits                                                          */
+/***************************************************************/
+static uint32_t cache_access(int c, uint32_t pc, uint32_t address, uint32_t now)
+{
+	cache_t *cache = &MEMSYS.cache[c];
+	uint32_t line = address >> MACHINE.line_shift, cycles = 0, k;
+	int i, trigger = FALSE;
+
+	cache->accesses++;
+	i = cache_find(c, line);
+	if (i >= 0) {
+		cache->used[i] = next_stamp();
+		cache->last = i;
+		if (cache->prefetched[i]) {
+			cache->prefetched[i] = FALSE;
+			cache->useful++;
+			trigger = TRUE;	/* keep a next-line run going */
+			if ((int32_t)(cache->ready[i] - now) > 0) {
+				cycles = cache->ready[i] - now;
+				cache->late++;
+			}
+		}
+	}else if (MACHINE.prefetch[c] == PREFETCH_STREAM && stream_hit(c, line, now, &cycles)) {
+		cache->last = cache_fill(c, line, now + cycles, FALSE);
+	}else {
+		cache->misses++;
+		cycles = MACHINE.cache_miss;
+		cache->last = cache_fill(c, line, now + cycles, FALSE);
+		trigger = TRUE;
+		if (MACHINE.prefetch[c] == PREFETCH_STREAM) {
+			stream_start(c, line, now);
+		}
+	}
+
+	if (MACHINE.prefetch[c] == PREFETCH_NEXT_LINE && trigger) {
+		for (k = 0; k < MACHINE.prefetch_degree; k++) {
+			prefetch_line(c, line + MACHINE.prefetch_distance + k, now);
+		}
+	}else if (MACHINE.prefetch[c] == PREFETCH_STRIDE) {
+		stride_prefetch(c, pc, address, now);
+	}
+	return cycles;
+}
+
+/***************************************************************/
+/* Forget the entries that have reached memory by cycle now                    */
+/***************************************************************/
+static void retire_stores(uint32_t now)
+{
+	while (MEMSYS.store_count != 0 && (int32_t)(MEMSYS.stores[MEMSYS.store_head].done - now) <= 0) {
+		MEMSYS.store_head = (MEMSYS.store_head + 1) % MAX_STORE_BUFFER;
+		MEMSYS.store_count--;
+	}
+}
+
+/***************************************************************/
+/* Queue a store of size bytes; returns cycles MEM waits for room         */
+/***************************************************************/
+static uint32_t buffer_store(uint32_t address, uint32_t size, uint32_t now)
+{
+	uint32_t bytes = MACHINE.store_combine ? MACHINE.store_combine : 4;
+	uint32_t block = address & ~(bytes - 1);
+	uint32_t mask = ((1u << size) - 1) << (address - block);
+	uint32_t i, wait = 0, start;
+	store_entry_t *e;
+
+	retire_stores(now);
+	MEMSYS.buffered++;
+	if (MACHINE.store_combine != 0) {
+		for (i = 0; i < MEMSYS.store_count; i++) {
+			e = &MEMSYS.stores[(MEMSYS.store_head + i) % MAX_STORE_BUFFER];
+			if (e->block == block && (int32_t)(e->done - MACHINE.store_drain - now) > 0) {
+				e->mask |= mask;	/* still waiting its turn to drain */
+				MEMSYS.combined++;
+				return 0;
+			}
+		}
+	}
+	while (MEMSYS.store_count >= MACHINE.store_buffer) {
+		wait = MEMSYS.stores[MEMSYS.store_head].done - now;
+		retire_stores(now + wait);
+	}
+	MEMSYS.full_stalls += wait;
+
+	start = now + wait;
+	if (MEMSYS.store_count != 0) {
+		e = &MEMSYS.stores[(MEMSYS.store_head + MEMSYS.store_count - 1) % MAX_STORE_BUFFER];
+		if ((int32_t)(e->done - start) > 0) {
+			start = e->done;	/* the buffer drains one entry at a time */
+		}
+	}
+	e = &MEMSYS.stores[(MEMSYS.store_head + MEMSYS.store_count) % MAX_STORE_BUFFER];
+	e->block = block;
+	e->mask = mask;
+	e->done = start + MACHINE.store_drain;
+	MEMSYS.store_count++;
+	return wait;
+}
+
+/***************************************************************/
+/* Check a load against the buffer; returns cycles it waits for a store  */
+/* it only partly overlaps                                                                                  */
+/***************************************************************/
+static uint32_t buffer_load(uint32_t address, uint32_t size, uint32_t now, int *forwarded)
+{
+	uint32_t bytes = MACHINE.store_combine ? MACHINE.store_combine : 4;
+	uint32_t block = address & ~(bytes - 1);
+	uint32_t mask = ((1u << size) - 1) << (address - block);
+	uint32_t i, wait;
+	const store_entry_t *e;
+
+	retire_stores(now);
+	for (i = MEMSYS.store_count; i-- > 0; ) {	/* youngest first */
+		e = &MEMSYS.stores[(MEMSYS.store_head + i) % MAX_STORE_BUFFER];
+		if (e->block != block || (e->mask & mask) == 0) {
+			continue;
+		}
+		if ((e->mask & mask) == mask) {
+			MEMSYS.forwarded++;
+			*forwarded = TRUE;
+			return 0;
+		}
+		wait = e->done - now;
+		MEMSYS.overlap_stalls += wait;
+		return wait;
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Should IF insert a bubble instead of fetching pc this cycle                 */
+/***************************************************************/
+int memsys_fetch_wait(uint32_t pc)
+{
+	if (MEMSYS.fetch_wait == 0) {
+		if ((pc & 0x3) || !mem_mapped(pc, 4)) {
+			return FALSE;	/* faults are IF's to report */
+		}
+		if (MACHINE.tlb_entries[TLB_I] != 0) {
+			MEMSYS.fetch_wait = tlb_access(TLB_I, pc);
+		}
+		if (MACHINE.cache_size[CACHE_I] != 0) {
+			MEMSYS.fetch_wait += cache_access(CACHE_I, pc, pc, CYCLE_COUNT + MEMSYS.fetch_wait);
+		}
+		if (MEMSYS.fetch_wait == 0) {
+			return FALSE;
+		}
+	}
+	MEMSYS.fetch_wait--;
+	return TRUE;
+}
+
+/***************************************************************/
+/* Cycles the load or store MEM is making costs beyond the pipeline's;  */
+/* the low opcode bits give the size (byte 00, half 01, word 11)           */
+/***************************************************************/
+uint32_t memsys_data(uint32_t pc, uint32_t address, uint32_t opcode)
+{
+	uint32_t cycles = 0, size = (opcode & 0x3) + 1;
+	int store = (opcode & 0x08) != 0, forwarded = FALSE;
+
+	if (MACHINE.tlb_entries[TLB_D] != 0) {
+		cycles = tlb_access(TLB_D, address);
+	}
+	if (MACHINE.store_buffer != 0) {
+		if (store) {
+			return cycles + buffer_store(address, size, CYCLE_COUNT + cycles);	/* drains past the cache */
+		}
+		cycles += buffer_load(address, size, CYCLE_COUNT + cycles, &forwarded);
+	}
+	if (MACHINE.cache_size[CACHE_D] != 0 && !forwarded) {
+		cycles += cache_access(CACHE_D, pc, address, CYCLE_COUNT + cycles);
+	}
+	return cycles;
+}
+
+/***************************************************************/
+/* Hit rate of cache c and how well its prefetcher did: accuracy is the  */
+/* share of prefetched lines that were used, coverage the share of        */
+/* would-be misses they removed, timeliness the share used that had     */
+/* arrived in time                                                                                               */
+/***************************************************************/
+static void print_cache(int c)
+{
+	const cache_t *cache = &MEMSYS.cache[c];
+
+	printf("%s\t\t\t: %u accesses, %u misses (%.2f%% hit)\n", c == CACHE_I ? "I-cache" : "D-cache", cache->accesses,
+		cache->misses, cache->accesses ? 100.0 * (cache->accesses - cache->misses) / cache->accesses : 0.0);
+	if (MACHINE.prefetch[c] != PREFETCH_NONE) {
+		printf("  %s prefetch\t: %u issued, %u useful, %u late\n", PREFETCH_NAMES[MACHINE.prefetch[c]], cache->issued,
+			cache->useful, cache->late);
+		printf("  accuracy %.1f%%, coverage %.1f%%, timeliness %.1f%%\n",
+			cache->issued ? 100.0 * cache->useful / cache->issued : 0.0,
+			cache->useful + cache->misses ? 100.0 * cache->useful / (cache->useful + cache->misses) : 0.0,
+			cache->useful ? 100.0 * (cache->useful - cache->late) / cache->useful : 0.0);
+	}
+}
+
+/***************************************************************/
+/* Statistics of the models that are on                                                               */
+/***************************************************************/
+void print_memsys()
+{
+	const tlb_t *tlb;
+	int i;
+
+	for (i = 0; i < NUM_TLBS; i++) {
+		tlb = &MEMSYS.tlb[i];
+		if (MACHINE.tlb_entries[i] != 0) {
+			printf("%s\t\t\t: %u accesses, %u misses (%.2f%% hit)\n", i == TLB_I ? "ITLB" : "DTLB", tlb->accesses, tlb->misses,
+				tlb->accesses ? 100.0 * (tlb->accesses - tlb->misses) / tlb->accesses : 0.0);
+		}
+	}
+	if (MACHINE.tlb_entries[TLB_I] != 0 || MACHINE.tlb_entries[TLB_D] != 0) {
+		printf("TLB refill cycles\t: %u (%s)\n", MEMSYS.walk_cycles,
+			MACHINE.tlb_refill == TLB_REFILL_SOFTWARE ? "software" : "hardware walk");
+		printf("Pages touched\t\t: %u (%u KB)\n", MEMSYS.page_faults, MEMSYS.page_faults << (PAGE_SHIFT - 10));
+	}
+	for (i = 0; i < NUM_CACHES; i++) {
+		if (MACHINE.cache_size[i] != 0) {
+			print_cache(i);
+		}
+	}
+	if (MACHINE.store_buffer != 0) {
+		printf("Store buffer\t\t: %u stores, %u combined, %u loads forwarded\n", MEMSYS.buffered, MEMSYS.combined,
+			MEMSYS.forwarded);
+		printf("Store buffer stalls\t: %u full, %u partial overlap\n", MEMSYS.full_stalls, MEMSYS.overlap_stalls);
+	}
+}
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include "mu-mips.h"
+
+/* forwarding x tracing x activity counting x profiling x memory system, all from mu-mips-stages.h */
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 0
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 0
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 0
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 0
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 0
+#include "mu-mips-stages.h"
+
+#define STAGE_FORWARDING 1
+#define STAGE_TRACE 1
+#define STAGE_ACTIVITY 1
+#define STAGE_PROFILE 1
+#define STAGE_MEMSYS 1
+#include "mu-mips-stages.h"
+
+#define VARIANT(f, t, a, p, m) { "forwarding " #f ", trace " #t ", activity " #a ", profile " #p ", memsys " #m, \
+	handle_pipeline_f##f##_t##t##_a##a##_p##p##_m##m }
+#define WITH_MEMSYS(f, t, a, p) { VARIANT(f, t, a, p, 0), VARIANT(f, t, a, p, 1) }
+#define PROFILED(f, t, a) { WITH_MEMSYS(f, t, a, 0), WITH_MEMSYS(f, t, a, 1) }
+
+/* indexed [forwarding][trace][activity][profile][memsys] */
+static const pipeline_variant_t VARIANTS[2][2][2][2][2] = {
+	{ { PROFILED(0, 0, 0), PROFILED(0, 0, 1) }, { PROFILED(0, 1, 0), PROFILED(0, 1, 1) } },
+	{ { PROFILED(1, 0, 0), PROFILED(1, 0, 1) }, { PROFILED(1, 1, 0), PROFILED(1, 1, 1) } },
+};
+
+const pipeline_variant_t *PIPELINE = &VARIANTS[0][1][1][0][0];
+int ENABLE_ACTIVITY = 1;
+int ENABLE_PROFILE = 0;
+int PROFILE_SAMPLE = 0;
+uint64_t PROFILE_TICKS[NUM_PROF];
+uint64_t PROFILE_CYCLES = 0;
+
+static uint64_t PROFILE_START_TICKS, PROFILE_START_NS;
+static size_t PROFILE_START_HEAP;
+
+/***************************************************************/
+/* Pick the pipeline compiled for the current settings and machine.      */
+/* Called where a run starts; the stages themselves no longer look at  */
+/* the globals.                                                                                                   */
+/***************************************************************/
+void select_pipeline()
+{
+	PIPELINE = &VARIANTS[ENABLE_FORWARDING == 1][TRACE_ENABLED != 0][ENABLE_ACTIVITY != 0][ENABLE_PROFILE != 0][MACHINE.memsys != 0];
+}
+
+/***************************************************************/
+/* Host clock in ns and the bytes malloc has handed out                       */
+/***************************************************************/
+static uint64_t host_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+/***************************************************************/
+/* Start a new profile                                                                                        */
+/***************************************************************/
+void reset_profile()
+{
+	memset(PROFILE_TICKS, 0, sizeof(PROFILE_TICKS));
+	PROFILE_CYCLES = 0;
+	PROFILE_START_TICKS = host_ticks();
+	PROFILE_START_NS = host_ns();
+	PROFILE_START_HEAP = heap_in_use();
+}
+
+/***************************************************************/
+/* Host ns per simulated cycle by stage, and the host's memory use.      */
+/* Stage times include the timer reads of anything nested inside them, */
+/* so a parent is slightly overstated when its children are timed too.   */
+/***************************************************************/
+void print_profile()
+{
+	static const struct { int part; const char *name; } ROWS[] = {
+		{ PROF_WB, "WB" }, { PROF_MEM, "MEM" }, { PROF_MEMORY, "  memory accessors" }, { PROF_MEMSYS, "  memory system" },
+		{ PROF_EX, "EX" }, { PROF_ID, "ID" }, { PROF_FORWARD, "  ForwardData" }, { PROF_IF, "IF" },
+	};
+	uint64_t ticks = host_ticks() - PROFILE_START_TICKS;
+	uint64_t ns = host_ns() - PROFILE_START_NS;
+	double ns_per_tick = ticks ? (double)ns / ticks : 1.0;
+	double total, part, stages = 0;
+	size_t heap = heap_in_use();
+	long rss_pages = 0;
+	struct rusage usage;
+	FILE *fp;
+	unsigned i;
+
+	printf("Host profile		: %llu of %u cycles timed (1 in %d)\n", (unsigned long long)PROFILE_CYCLES, CYCLE_COUNT, PROFILE_SAMPLE_CYCLES);
+	if (PROFILE_CYCLES != 0) {
+		total = PROFILE_TICKS[PROF_CYCLE] * ns_per_tick / PROFILE_CYCLES;
+		printf("  pipeline\t\t: %8.1f ns/cycle\n", total);
+		for (i = 0; i < sizeof(ROWS) / sizeof(ROWS[0]); i++) {
+			part = PROFILE_TICKS[ROWS[i].part] * ns_per_tick / PROFILE_CYCLES;
+			printf("  %-20s\t: %8.1f ns/cycle  %5.1f%%\n", ROWS[i].name, part, total > 0 ? 100.0 * part / total : 0.0);
+			stages += (ROWS[i].name[0] != ' ') ? part : 0;
+		}
+		part = (total > stages) ? total - stages : 0;
+		printf("  %-20s\t: %8.1f ns/cycle  %5.1f%%\n", "other", part, total > 0 ? 100.0 * part / total : 0.0);
+	}
+	fp = fopen("/proc/self/statm", "r");
+	if (fp != NULL) {
+		if (fscanf(fp, "%*s %ld", &rss_pages) != 1) {
+			rss_pages = 0;
+		}
+		fclose(fp);
+	}
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Host memory\t\t: heap %zu KB (%+ld KB since profiling started), RSS %ld KB, peak RSS %ld KB\n\n",
+		heap / 1024, ((long)heap - (long)PROFILE_START_HEAP) / 1024, rss_pages * (sysconf(_SC_PAGESIZE) / 1024), usage.ru_maxrss);
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Forked worker pool shared by mu-mips-check and mu-mips-sweep. Every */
+/* job runs in a child of its own, so a run that crashes the simulator   */
+/* costs only that job and no simulator state leaks into the next one.  */
+/***************************************************************/
+
+/***************************************************************/
+/* Default number of workers: one per core the host has online           */
+/***************************************************************/
+int pool_workers()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (n < 1) ? 1 : (int)n;
+}
+
+/***************************************************************/
+/* Run jobs 0 .. count-1, at most workers at a time. work(job, fd) runs  */
+/* in the child and returns its JOB_* state; what it writes to fd comes  */
+/* back as the report, up to POOL_REPORT_SIZE - 1 bytes. done() runs in  */
+/* the parent as each job ends, JOB_ERROR if it crashed or never started */
+/***************************************************************/
+void run_pool(int count, int workers, int (*work)(int job, int fd), void (*done)(int job, int state, const char *report))
+{
+	char report[POOL_REPORT_SIZE];
+	int next = 0, active = 0, status, state, i, devnull, fds[2];
+	pid_t *pids = calloc(count ? count : 1, sizeof(pid_t));
+	int *reads = calloc(count ? count : 1, sizeof(int));
+	ssize_t n;
+	pid_t pid;
+
+	if (pids == NULL || reads == NULL) {
+		for (i = 0; i < count; i++) {
+			done(i, JOB_ERROR, "");
+		}
+		free(pids);
+		free(reads);
+		return;
+	}
+	workers = (workers < 1) ? 1 : workers;
+	while (next < count || active != 0) {
+		while (active < workers && next < count) {
+			i = next++;
+			if (pipe(fds) != 0) {
+				done(i, JOB_ERROR, "");
+				continue;
+			}
+			fflush(stdout);
+			pid = fork();
+			if (pid == 0) {
+				/* guest output and loader messages would interleave */
+				close(fds[0]);
+				devnull = open("/dev/null", O_WRONLY);
+				dup2(devnull, STDOUT_FILENO);
+				_exit(work(i, fds[1]));
+			}
+			close(fds[1]);
+			if (pid < 0) {
+				close(fds[0]);
+				done(i, JOB_ERROR, "");
+				continue;
+			}
+			pids[i] = pid;
+			reads[i] = fds[0];
+			active++;
+		}
+		if (active == 0) {
+			continue;
+		}
+		pid = wait(&status);
+		if (pid < 0) {
+			break;
+		}
+		active--;
+		for (i = 0; i < count && pids[i] != pid; i++);
+		if (i < count) {
+			n = read(reads[i], report, sizeof(report) - 1);
+			report[n > 0 ? n : 0] = '\0';
+			close(reads[i]);
+			pids[i] = 0;
+			state = WIFEXITED(status) ? WEXITSTATUS(status) : JOB_ERROR;
+			done(i, (state == JOB_PASS || state == JOB_FAIL) ? state : JOB_ERROR, report);
+		}
+	}
+	free(pids);
+	free(reads);
+}
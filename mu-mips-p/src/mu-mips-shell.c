@@ -0,0 +1,587 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+
+#include "mu-mips.h"
+
+int SERVER_MODE = 0;
+int SERVER_STDOUT = -1;
+pthread_mutex_t SIM_LOCK = PTHREAD_MUTEX_INITIALIZER;
+pthread_t SIM_WORKER;
+volatile int SIM_BUSY = 0;
+volatile int STOP_REQUESTED = 0;
+uint32_t BACKGROUND_CYCLES;
+int BACKGROUND_FOREVER;
+
+/***************************************************************/
+/* Print out a list of commands available                                                                  */
+/***************************************************************/
+void help() {        
+	printf("------------------------------------------------------------------\n\n");
+	printf("\t**********MU-MIPS Help MENU**********\n\n");
+	printf("sim\t-- simulate program to completion \n");
+	printf("run <n>\t-- simulate program for <n> instructions\n");
+	printf("rdump\t-- dump register values\n");
+	printf("reset\t-- clears all registers/memory and re-loads the program\n");
+	printf("reload [keep]\t-- like reset, but only rewrites the instructions that changed;\n");
+	printf("\t   keep leaves registers, data and the pipeline alone and goes on with the new code\n");
+	printf("reload watch <0|1>\t-- reload before sim/run whenever the program file changes\n");
+	printf("input <reg> <val>\t-- set GPR <reg> to <val>\n");
+	printf("mdump <start> <stop>\t-- dump memory from <start> to <stop> address\n");
+	printf("mdump --rle <start> <stop>\t-- same, collapsing runs of zero words\n");
+	printf("mdump --bin <file> <start> <stop>\t-- write raw memory bytes to <file>\n");
+	printf("mdiff <file> <start>\t-- compare memory at <start> against a --bin dump\n");
+	printf("map <file> <addr> [shared]\t-- back data memory at <addr> with <file>\n");
+	printf("high <val>\t-- set the HI register to <val>\n");
+	printf("low <val>\t-- set the LO register to <val>\n");
+	printf("print\t-- print the program loaded into memory\n");
+	printf("show\t-- print the current content of the pipeline registers\n");
+	printf("stats\t-- print instruction, cycle and CPI counters\n");
+	printf("stop\t-- pause a background run (command server only)\n");
+	printf("forward\t-- enable or disable forwarding\n");
+	printf("break <pc> [if <reg> <op> <val>]\t-- stop when <pc> is fetched, or retires with the condition true\n");
+	printf("watch <addr> [r|w|rw]\t-- stop when MEM accesses the word at <addr>\n");
+	printf("\t   <pc> and <addr> are hex or a label of an assembled program, e.g. loop+0x8\n");
+	printf("unbreak <pc>, unwatch <addr>\t-- remove a breakpoint or watchpoint\n");
+	printf("continue\t-- resume after a breakpoint or watchpoint\n");
+	printf("record <0|1>\t-- record snapshots for reverse execution\n");
+	printf("reverse-step <n>\t-- go back <n> cycles\n");
+	printf("reverse-continue\t-- go back to the previous breakpoint or watchpoint hit\n");
+	printf("trace <0|1>\t-- print what each pipeline stage does\n");
+	printf("energy <0|1>\t-- count pipeline activity for the energy estimate\n");
+	printf("profile [0|1]\t-- time the simulator's own stages on the host, or print the times\n");
+	printf("?\t-- display help menu\n");
+	printf("quit\t-- exit the simulator\n\n");
+	printf("------------------------------------------------------------------\n\n");
+}
+
+/***************************************************************/
+/* Pick up an edited program file before a run if watching it                */
+/***************************************************************/
+void reload_if_changed() {
+	if (WATCH_PROGRAM && !SIM_BUSY && program_changed()) {
+		reload(FALSE);
+	}
+}
+
+/***************************************************************/
+/* Read a command from standard input.                                                               */  
+/***************************************************************/
+void handle_command() {                         
+	char line[CMD_LINE_SIZE];
+
+	printf("MU-MIPS SIM:> ");
+
+	if (fgets(line, sizeof(line), stdin) == NULL){
+		exit(0);
+	}
+	if (execute_command(line) == CMD_QUIT){
+		quit_simulator();
+	}
+}
+
+/***************************************************************/
+/* Run one command line; returns CMD_QUIT for quit                                               */  
+/***************************************************************/
+int execute_command(const char *line) {
+	char buffer[20];
+	char path[256], mode[20], option[20];
+	const char *args;
+	uint32_t start, stop, cycles;
+	uint32_t register_no;
+	int register_value;
+	int hi_reg_value, lo_reg_value;
+	int n;
+
+	if (sscanf(line, " %19s%n", buffer, &n) != 1 || buffer[0] == '#'){
+		return CMD_OK;	/* blank line or comment */
+	}
+	args = line + n;
+
+	switch(buffer[0]) {
+		case 'S':
+		case 's':
+			if (buffer[1] == 'h' || buffer[1] == 'H'){
+				show_pipeline();
+			}else if (buffer[1] == 't' || buffer[1] == 'T'){
+				if (buffer[2] == 'o' || buffer[2] == 'O'){
+					STOP_REQUESTED = 1;
+				}else {
+					stats();
+					printf("State\t\t\t: %s\n\n", SIM_BUSY ? "running" : (RUN_FLAG ? "stopped" : "finished"));
+				}
+			}else {
+				reload_if_changed();
+				SERVER_MODE ? start_background_run(0, TRUE) : runAll(); 
+			}
+			break;
+		case 'M':
+		case 'm':
+			if (buffer[1] == 'a' || buffer[1] == 'A'){
+				/* optional mode word after the address */
+				mode[0] = '\0';
+				if (sscanf(args, "%255s %x %19s", path, &start, mode) < 2){
+					break;
+				}
+				map_file(path, start, strcmp(mode, "shared") == 0);
+				break;
+			}
+			if (buffer[2] == 'i' || buffer[2] == 'I'){
+				if (sscanf(args, "%255s %x", path, &start) != 2){
+					break;
+				}
+				mdiff(path, start);
+				break;
+			}
+			if (sscanf(args, "%19s%n", option, &n) != 1){
+				break;
+			}
+			if (strcmp(option, "--bin") == 0){
+				if (sscanf(args + n, "%255s %x %x", path, &start, &stop) != 3){
+					break;
+				}
+				mdump_bin(path, start, stop);
+			}else if (strcmp(option, "--rle") == 0){
+				if (sscanf(args + n, "%x %x", &start, &stop) != 2){
+					break;
+				}
+				mdump_rle(start, stop);
+			}else {
+				if (sscanf(args, "%x %x", &start, &stop) != 2){
+					break;
+				}
+				mdump(start, stop);
+			}
+			break;
+		case '?':
+			help();
+			break;
+		case 'Q':
+		case 'q':
+			return CMD_QUIT;
+		case 'R':
+		case 'r':
+			if (buffer[1] == 'd' || buffer[1] == 'D'){
+				rdump();
+			}else if (strcmp(buffer, "reverse-step") == 0){
+				if (sscanf(args, "%u", &cycles) != 1) {
+					break;
+				}
+				reverse_step(cycles);
+			}else if (strcmp(buffer, "reverse-continue") == 0){
+				reverse_continue();
+			}else if (buffer[2] == 'c' || buffer[2] == 'C'){
+				if (sscanf(args, "%d", &register_value) != 1) {
+					break;
+				}
+				set_recording(register_value);
+				RECORDING == 0 ? printf("Recording OFF\n") : printf("Recording ON\n");
+			}else if (buffer[2] == 'l' || buffer[2] == 'L'){
+				option[0] = '\0';
+				register_value = 1;
+				sscanf(args, "%19s %d", option, &register_value);
+				if (strcmp(option, "watch") == 0){
+					WATCH_PROGRAM = register_value;
+					WATCH_PROGRAM == 0 ? printf("Program watch OFF\n") : printf("Program watch ON\n");
+				}else if (!SIM_BUSY){
+					reload(strcmp(option, "keep") == 0);
+				}
+			}else if(buffer[1] == 'e' || buffer[1] == 'E'){
+				reset();
+			}
+			else {
+				if (sscanf(args, "%u", &cycles) != 1) {
+					break;
+				}
+				reload_if_changed();
+				SERVER_MODE ? start_background_run(cycles, FALSE) : run(cycles);
+			}
+			break;
+		case 'I':
+		case 'i':
+			if (sscanf(args, "%u %i", &register_no, &register_value) != 2 || register_no >= MIPS_REGS){
+				break;
+			}
+			CURRENT_STATE.REGS[register_no] = register_value;
+			NEXT_STATE.REGS[register_no] = register_value;
+			break;
+		case 'H':
+		case 'h':
+			if (sscanf(args, "%i", &hi_reg_value) != 1){
+				break;
+			}
+			CURRENT_STATE.HI = hi_reg_value; 
+			NEXT_STATE.HI = hi_reg_value; 
+			break;
+		case 'L':
+		case 'l':
+			if (sscanf(args, "%i", &lo_reg_value) != 1){
+				break;
+			}
+			CURRENT_STATE.LO = lo_reg_value;
+			NEXT_STATE.LO = lo_reg_value;
+			break;
+		case 'P':
+		case 'p':
+			if (buffer[2] == 'o' || buffer[2] == 'O'){
+				if (sscanf(args, "%d", &ENABLE_PROFILE) != 1) {
+					print_profile();
+					break;
+				}
+				if (ENABLE_PROFILE){
+					reset_profile();
+				}
+				ENABLE_PROFILE == 0 ? printf("Profiling OFF\n") : printf("Profiling ON\n");
+				break;
+			}
+			print_program(); 
+			break;
+		case 'f':
+			if (sscanf(args, "%d", &ENABLE_FORWARDING) != 1) {
+				break;
+			}
+			
+			ENABLE_FORWARDING == 0 ? printf("Forwarding OFF\n") : printf("Forwarding ON\n");
+			break;
+		case 'B':
+		case 'b':
+			if (sscanf(args, "%255s%n", path, &n) != 1 || !parse_address(path, &start)){
+				printf("Unknown address or symbol.\n");
+				break;
+			}
+			add_breakpoint(start, args + n);
+			break;
+		case 'W':
+		case 'w':
+			mode[0] = '\0';
+			if (sscanf(args, "%255s %19s", path, mode) < 1 || !parse_address(path, &start)){
+				printf("Unknown address or symbol.\n");
+				break;
+			}
+			if (strcmp(mode, "r") == 0){
+				add_watchpoint(start, WATCH_READ);
+			}else if (strcmp(mode, "rw") == 0){
+				add_watchpoint(start, WATCH_READ | WATCH_WRITE);
+			}else {
+				add_watchpoint(start, WATCH_WRITE);
+			}
+			break;
+		case 'U':
+		case 'u':
+			if (sscanf(args, "%255s", path) != 1 || !parse_address(path, &start)){
+				printf("Unknown address or symbol.\n");
+				break;
+			}
+			if (buffer[2] == 'b' || buffer[2] == 'B'){
+				remove_breakpoint(start);
+			}else {
+				remove_watchpoint(start);
+			}
+			break;
+		case 'C':
+		case 'c':
+			SERVER_MODE ? start_background_run(0, TRUE) : runAll();
+			break;
+		case 'E':
+		case 'e':
+			if (sscanf(args, "%d", &ENABLE_ACTIVITY) != 1) {
+				break;
+			}
+			ENABLE_ACTIVITY == 0 ? printf("Activity counting OFF\n") : printf("Activity counting ON\n");
+			break;
+		case 'T':
+		case 't':
+			if (buffer[1] != 'r' && buffer[1] != 'R'){
+				printf("Invalid Command.\n");
+				break;
+			}
+			if (sscanf(args, "%d", &TRACE_ENABLED) != 1) {
+				break;
+			}
+			TRACE_ENABLED == 0 ? printf("Trace OFF\n") : printf("Trace ON\n");
+			break;
+
+		default:
+			printf("Invalid Command.\n");
+			break;
+	}
+	return CMD_OK;
+}
+
+/***************************************************************/
+/* Leave the simulator                                                                                            */  
+/***************************************************************/
+void quit_simulator() {
+	printf("**************************\n");
+	printf("Exiting MU-MIPS! Good Bye...\n");
+	printf("**************************\n");
+	exit(0);
+}
+
+/***************************************************************/
+/* Execute the commands in a script file, echoing each one                        */  
+/***************************************************************/
+int run_script(const char *path) {
+	char line[CMD_LINE_SIZE];
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("Error: Can't open command file %s\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		printf("MU-MIPS SIM:> %s", line);
+		if (strchr(line, '\n') == NULL) {
+			printf("\n");
+		}
+		if (execute_command(line) == CMD_QUIT) {
+			fclose(fp);
+			quit_simulator();
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/***************************************************************/
+/* Background run for the command server: n cycles, or to completion      */  
+/***************************************************************/
+void start_background_run(uint32_t cycles, int forever) {
+	if (SIM_BUSY) {
+		printf("Simulation already running.\n");
+		return;
+	}
+	if (RUN_FLAG == FALSE) {
+		printf("Simulation Stopped.\n\n");
+		return;
+	}
+	BACKGROUND_CYCLES = cycles;
+	BACKGROUND_FOREVER = forever;
+	STOP_REQUESTED = 0;
+	SIM_BUSY = 1;
+	if (pthread_create(&SIM_WORKER, NULL, background_run_main, NULL) != 0) {
+		SIM_BUSY = 0;
+		printf("Error: Can't start simulation thread\n");
+		return;
+	}
+	pthread_detach(SIM_WORKER);
+	printf("Simulation started in background.\n");
+}
+
+/***************************************************************/
+/* Worker thread: simulate in batches, letting clients in between            */  
+/***************************************************************/
+void *background_run_main(void *arg) {
+	uint32_t remaining = BACKGROUND_CYCLES;
+	int forever = BACKGROUND_FOREVER;
+	int i;
+
+	pthread_mutex_lock(&SIM_LOCK);
+	printf("Simulation Started...\n\n");
+	select_pipeline();
+	while (RUN_FLAG && (forever || remaining != 0) && !STOP_REQUESTED) {
+		for (i = 0; i < BACKGROUND_BATCH && RUN_FLAG && (forever || remaining != 0); i++) {
+			cycle();
+			if (!forever) {
+				remaining--;
+			}
+			if (BREAK_FLAG) {
+				BREAK_FLAG = 0;
+				STOP_REQUESTED = 1;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&SIM_LOCK);
+		sched_yield();	/* give waiting clients the lock */
+		pthread_mutex_lock(&SIM_LOCK);
+	}
+	flush_guest_output();
+	printf(RUN_FLAG ? "Simulation Paused.\n\n" : "Simulation Finished.\n\n");
+	fflush(stdout);
+	SIM_BUSY = 0;
+	pthread_mutex_unlock(&SIM_LOCK);
+	return NULL;
+}
+
+/***************************************************************/
+/* Run a client's command with stdout pointed at the client socket         */  
+/***************************************************************/
+int run_client_command(int fd, const char *line) {
+	int result;
+
+	pthread_mutex_lock(&SIM_LOCK);
+	fflush(stdout);
+	dup2(fd, STDOUT_FILENO);
+	result = execute_command(line);
+	printf(".\n");	/* end of reply */
+	fflush(stdout);
+	dup2(SERVER_STDOUT, STDOUT_FILENO);
+	pthread_mutex_unlock(&SIM_LOCK);
+	return result;
+}
+
+/***************************************************************/
+/* Serve line-oriented commands on a Unix domain socket                          */  
+/***************************************************************/
+int server_main(const char *path) {
+	struct sockaddr_un addr;
+	struct pollfd fds[MAX_CLIENTS + 1];
+	char inbuf[MAX_CLIENTS + 1][CMD_LINE_SIZE];
+	int inlen[MAX_CLIENTS + 1];
+	int listen_fd, nfds = 1, i, j, fd;
+	ssize_t got;
+	char *eol;
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0 || strlen(path) >= sizeof(addr.sun_path)) {
+		printf("Error: Can't create socket %s\n", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, MAX_CLIENTS) != 0) {
+		printf("Error: Can't listen on %s\n", path);
+		close(listen_fd);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);	/* a vanished client must not kill the run */
+	SERVER_MODE = 1;
+	SERVER_STDOUT = dup(STDOUT_FILENO);
+	printf("Listening on %s\n", path);
+	fflush(stdout);
+
+	fds[0].fd = listen_fd;
+	fds[0].events = POLLIN;
+	while (1) {
+		if (poll(fds, nfds, -1) < 0) {
+			continue;
+		}
+		if ((fds[0].revents & POLLIN) && nfds <= MAX_CLIENTS) {
+			fd = accept(listen_fd, NULL, NULL);
+			if (fd >= 0) {
+				fds[nfds].fd = fd;
+				fds[nfds].events = POLLIN;
+				fds[nfds].revents = 0;
+				inlen[nfds] = 0;
+				nfds++;
+			}
+		}
+		for (i = 1; i < nfds; i++) {
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+				continue;
+			}
+			got = read(fds[i].fd, inbuf[i] + inlen[i], CMD_LINE_SIZE - 1 - inlen[i]);
+			if (got > 0) {
+				inlen[i] += got;
+				inbuf[i][inlen[i]] = '\0';
+				/* run every complete line; an overlong line is cut off */
+				while ((eol = strchr(inbuf[i], '\n')) != NULL || inlen[i] == CMD_LINE_SIZE - 1) {
+					if (eol != NULL) {
+						*eol = '\0';
+					}
+					if (run_client_command(fds[i].fd, inbuf[i]) == CMD_QUIT) {
+						got = 0;
+						break;
+					}
+					j = (eol != NULL) ? eol + 1 - inbuf[i] : inlen[i];
+					memmove(inbuf[i], inbuf[i] + j, inlen[i] - j + 1);
+					inlen[i] -= j;
+				}
+			}
+			if (got <= 0) {
+				close(fds[i].fd);
+				fds[i] = fds[nfds - 1];
+				memcpy(inbuf[i], inbuf[nfds - 1], CMD_LINE_SIZE);
+				inlen[i] = inlen[nfds - 1];
+				nfds--;
+				i--;
+			}
+		}
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* main                                                                                                                                   */
+/***************************************************************/
+int main(int argc, char *argv[]) {                              
+	char *data_file = NULL;
+	char *script_file = NULL;
+	char *socket_path = NULL;
+	char *machine_path = NULL;
+	int data_shared = 0;
+	int opt;
+
+	printf("\n**************************\n");
+	printf("Welcome to MU-MIPS SIM...\n");
+	printf("**************************\n\n");
+	
+	while ((opt = getopt(argc, argv, "m:M:x:S:k:d:P")) != -1) {
+		switch (opt) {
+			case 'm':	/* private copy-on-write data file */
+			case 'M':	/* shared data file, guest stores reach the file */
+				data_file = optarg;
+				data_shared = (opt == 'M');
+				break;
+			case 'x':	/* run commands from a file first */
+				script_file = optarg;
+				break;
+			case 'S':	/* serve commands on a Unix domain socket */
+				socket_path = optarg;
+				break;
+			case 'k':	/* exception handler, loaded at EXCEPTION_VECTOR */
+				snprintf(kernel_file, sizeof(kernel_file), "%s", optarg);
+				break;
+			case 'd':	/* machine description: stage depths, latencies, forwarding */
+				machine_path = optarg;
+				break;
+			case 'P':	/* profile the simulator, breakdown at exit */
+				ENABLE_PROFILE = 1;
+				reset_profile();
+				atexit(print_profile);
+				break;
+			default:
+				exit(1);
+		}
+	}
+
+	if (optind >= argc) {
+		printf("Error: You should provide input file.\nUsage: %s [-m|-M <data file>] [-k <kernel file>] [-d <machine file>] [-P] [-x <command file>] [-S <socket>] <input program> \n\n",  argv[0]);
+		exit(1);
+	}
+
+	snprintf(prog_file, sizeof(prog_file), "%s", argv[optind]);
+	initialize();
+	if (machine_path != NULL && load_machine(machine_path) != 0) {
+		exit(1);
+	}
+	if (data_file != NULL && map_file(data_file, MEM_DATA_BEGIN, data_shared) != 0) {
+		exit(1);
+	}
+	if (socket_path != NULL) {
+		TRACE_ENABLED = 0;	/* a background run's per-stage trace would flood the server; "trace 1" still turns it on */
+	}
+	load_program();
+	load_kernel();
+	if (script_file != NULL && run_script(script_file) != 0) {
+		exit(1);
+	}
+	if (socket_path != NULL) {
+		exit(server_main(socket_path) != 0);
+	}
+	help();
+	while (1){
+		handle_command();
+	}
+	return 0;
+}
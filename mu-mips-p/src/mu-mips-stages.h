@@ -0,0 +1,647 @@
+/***************************************************************/
+/* Pipeline stages, compiled once per variant by mu-mips-pipeline.c      */
+/*                                                                                                                     */
+/* There is deliberately no include guard. Before each inclusion define  */
+/*   STAGE_FORWARDING   0/1  forwarding paths may be taken                   */
+/*   STAGE_TRACE        0/1  per-stage trace output                                */
+/*   STAGE_ACTIVITY     0/1  activity counts for the energy estimate        */
+/*   STAGE_PROFILE      0/1  host time per stage on sampled cycles           */
+/*   STAGE_MEMSYS       0/1  TLB, cache and store buffer timing is modelled */
+/* Every stage function is static and named through STAGE(), so the       */
+/* thirty-two copies sit side by side in one file and a switched off     */
+/* feature costs nothing per cycle instead of a test of its global.        */
+/***************************************************************/
+
+#define STAGE(name) STAGE_NAME(name, STAGE_FORWARDING, STAGE_TRACE, STAGE_ACTIVITY, STAGE_PROFILE, STAGE_MEMSYS)
+#define STAGE_NAME(name, f, t, a, p, m) STAGE_PASTE(name, f, t, a, p, m)
+#define STAGE_PASTE(name, f, t, a, p, m) name##_f##f##_t##t##_a##a##_p##p##_m##m
+
+#undef TRACE
+#undef TRACE_INSTRUCTION
+#if STAGE_TRACE
+#define TRACE(...) printf(__VA_ARGS__)
+#define TRACE_INSTRUCTION(ir, addr) do { \
+	char trace_buf_[INSTR_STRING_SIZE]; \
+	printf("%s\n", format_instruction(ir, addr, trace_buf_, sizeof(trace_buf_))); \
+} while (0)
+#else
+#define TRACE(...) do { } while (0)
+#define TRACE_INSTRUCTION(ir, addr) do { } while (0)
+#endif
+
+#define COUNT_ACTIVITY(event, n) do { if (STAGE_ACTIVITY) ACTIVITY[event] += (n); } while (0)
+
+#if STAGE_PROFILE
+#define PROFILE(part, ...) do { \
+	uint64_t profile_start_ = PROFILE_SAMPLE ? host_ticks() : 0; \
+	__VA_ARGS__; \
+	if (PROFILE_SAMPLE) PROFILE_TICKS[part] += host_ticks() - profile_start_; \
+} while (0)
+#else
+#define PROFILE(part, ...) do { __VA_ARGS__; } while (0)
+#endif
+
+static void STAGE(WB)(void);
+static void STAGE(MEM)(void);
+static void STAGE(EX)(void);
+static void STAGE(ID)(void);
+static void STAGE(IF)(void);
+static void STAGE(ForwardData)(void);
+static void STAGE(resolve_hazard)(int *forward, int path);
+
+/************************************************************/
+/* maintain the pipeline                                                                                           */ 
+/************************************************************/
+static void STAGE(handle_pipeline)(void)
+{
+	/*INSTRUCTION_COUNT should be incremented when instruction is done*/
+	/*Since we do not have branch/jump instructions, INSTRUCTION_COUNT should be incremented in WB stage */
+
+	CPU_Pipeline_Reg latches[4];
+	int sample = STAGE_ACTIVITY && (CYCLE_COUNT % LATCH_SAMPLE_CYCLES) == 0;
+	int frozen = STAGE_MEMSYS && MEMSYS.data_wait != 0;	//A TLB or cache miss or a store buffer wait in MEM holds every stage
+	uint64_t start = 0;
+
+	if (STAGE_PROFILE){
+		PROFILE_SAMPLE = (CYCLE_COUNT % PROFILE_SAMPLE_CYCLES) == 0;
+		if (PROFILE_SAMPLE){
+			PROFILE_CYCLES++;
+			start = host_ticks();
+		}
+	}
+
+	if (sample){
+		latches[0] = IF_ID;
+		latches[1] = ID_EX;
+		latches[2] = EX_MEM;
+		latches[3] = MEM_WB;
+	}
+	if (stall > 0 && !frozen){
+		stall = stall - 1;	//Decrement stall back to 0	
+	}
+	if (CURRENT_STATE.CP0[CP0_STATUS] & STATUS_EXL){
+		KERNEL_CYCLES++;
+	}
+	SET_CP0(CP0_COUNT, NEXT_STATE.CP0[CP0_COUNT] + 1);	//CP0 timer ticks once per cycle
+	if (NEXT_STATE.CP0[CP0_COUNT] == NEXT_STATE.CP0[CP0_COMPARE]){
+		SET_CP0(CP0_CAUSE, NEXT_STATE.CP0[CP0_CAUSE] | CAUSE_IP7);
+	}
+	TRACE("Handle Pipeline: Stall = %d\n", stall);
+	if (frozen){
+		MEMSYS.data_wait--;
+		TRACE("Waiting on memory in MEM, %u cycles left\n", MEMSYS.data_wait);
+	}
+	else{
+		PROFILE(PROF_WB, STAGE(WB)());
+		PROFILE(PROF_MEM, STAGE(MEM)());
+		PROFILE(PROF_EX, STAGE(EX)());
+		PROFILE(PROF_ID, STAGE(ID)());
+		PROFILE(PROF_IF, STAGE(IF)());
+	}
+	if (sample){
+		count_latch_toggles(latches);
+	}
+	if (STAGE_PROFILE && PROFILE_SAMPLE){
+		PROFILE_TICKS[PROF_CYCLE] += host_ticks() - start;
+	}
+}
+
+/************************************************************/
+/* writeback (WB) pipeline stage:                                                                          */ 
+/************************************************************/
+static void STAGE(WB)(void)
+{
+	/*IMPLEMENT THIS*/
+	//Fifth stage
+	
+
+	if (MEM_WB.stall == 1){
+		return;
+	}
+	
+	//Exceptions are taken here, once everything older has completed
+	if (MEM_WB.Exception != 0){
+		take_exception(MEM_WB.Exception, MEM_WB.PC - 4, MEM_WB.BadVAddr);
+		return;
+	}
+	//A breakpoint condition sees the registers every older instruction wrote
+	if (NUM_BREAKPOINTS != 0 && MEM_WB.PC != 0 && check_breakpoint(MEM_WB.PC - 4, TRUE)){
+		BREAK_FLAG = 1;
+	}
+	
+	const instr_desc_t *d = decode_instruction(MEM_WB.IR);
+	uint32_t rd = (MEM_WB.IR & 0x0000F800) >> 11;
+
+	if (MEM_WB.IR == 0 || d == NULL){
+		if (MEM_WB.PC != 0 && interrupt_pending()){
+			take_interrupt();
+		}
+		return;	//Nothing to retire
+	}
+	if (STAGE_ACTIVITY && MEM_WB.RegWrite){
+		COUNT_ACTIVITY(ACT_RF_WRITE, 1);
+	}
+
+	switch (d->op){
+		case OP_SYSCALL:
+			if (KERNEL_SIZE != 0 && !(NEXT_STATE.CP0[CP0_STATUS] & STATUS_EXL)){
+				take_exception(EXC_SYS, MEM_WB.PC - 4, 0);	//the handler returns to EPC + 4
+				return;
+			}
+			host_syscall();	//SPIM/MARS services; $v0 = 10 exits
+			break;
+
+		case OP_MTC0:
+			SET_CP0(rd, MEM_WB.B);
+			if (rd == CP0_COMPARE){
+				SET_CP0(CP0_CAUSE, NEXT_STATE.CP0[CP0_CAUSE] & ~CAUSE_IP7);	//Writing Compare acknowledges the timer
+			}
+			break;
+
+		case OP_ERET:
+			SET_CP0(CP0_STATUS, NEXT_STATE.CP0[CP0_STATUS] & ~STATUS_EXL);
+			flush_and_redirect(NEXT_STATE.CP0[CP0_EPC]);
+			break;
+
+		default:	//Everything else writes the register ID picked, if any
+			if (MEM_WB.RegWrite && MEM_WB.RegisterRD != 0){
+				SET_REG(MEM_WB.RegisterRD, (d->op == OP_LOAD) ? MEM_WB.LMD : MEM_WB.ALUOutput);
+			}
+			break;
+	}
+	INSTRUCTION_COUNT++;
+	//Interrupts come between instructions: this one has retired, the ones behind it restart after ERET
+	if (RUN_FLAG && interrupt_pending()){
+		take_interrupt();
+	}
+}
+
+/************************************************************/
+/* memory access (MEM) pipeline stage:                                                          */ 
+/************************************************************/
+static void STAGE(MEM)(void)
+{
+	/*IMPLEMENT THIS*/
+	//Fourth stage
+	//Load/Store only?
+
+	if (EX_MEM.stall == 1){
+		MEM_WB.stall = 1;	//Pass the bubble on, or WB would retire MEM_WB again
+		MEM_WB.RegWrite = 0;
+		return;
+	}
+
+	MEM_WB.stall = 0;
+	MEM_WB.RegWrite = EX_MEM.RegWrite;
+	MEM_WB.IR = EX_MEM.IR;
+	MEM_WB.PC = EX_MEM.PC;
+	MEM_WB.A = EX_MEM.A;
+	MEM_WB.B = EX_MEM.B;
+	MEM_WB.imm = EX_MEM.imm;
+	MEM_WB.ALUOutput = EX_MEM.ALUOutput;
+	MEM_WB.LMD = 0;
+    MEM_WB.RegisterRD = EX_MEM.RegisterRD;
+    MEM_WB.RegisterRT = EX_MEM.RegisterRT;
+    MEM_WB.RegisterRS = EX_MEM.RegisterRS;
+	MEM_WB.Exception = EX_MEM.Exception;
+	MEM_WB.BadVAddr = EX_MEM.BadVAddr;
+	
+	uint32_t opcode;
+	
+	opcode = (MEM_WB.IR & 0xFC000000) >> 26;	//Shift to get opcode bits 26-31
+	
+	if (opcode == 0x00 || MEM_WB.Exception != 0){
+		return;	//Don't need r type	
+	}
+	
+	else{
+		//Check the access before making it; the low opcode bits are the size (byte 00, half 01, word 11)
+		if (opcode == 0x20 || opcode == 0x21 || opcode == 0x23 || opcode == 0x28 || opcode == 0x29 || opcode == 0x2B){
+			if (MEM_WB.ALUOutput & opcode & 0x3){
+				MEM_WB.Exception = (opcode & 0x08) ? EXC_ADES : EXC_ADEL;
+			}
+			else if (!mem_mapped(MEM_WB.ALUOutput, (opcode & 0x3) + 1)){
+				MEM_WB.Exception = EXC_DBE;
+			}
+			if (MEM_WB.Exception != 0){
+				MEM_WB.BadVAddr = MEM_WB.ALUOutput;
+				return;
+			}
+			COUNT_ACTIVITY((opcode & 0x08) ? ACT_MEM_WRITE : ACT_MEM_READ, 1);
+			if (STAGE_MEMSYS){
+				PROFILE(PROF_MEMSYS, MEMSYS.data_wait = memsys_data(MEM_WB.PC - 4, MEM_WB.ALUOutput, opcode));
+			}
+		}
+		
+		switch(opcode){
+			case 0x20:	//LB
+				PROFILE(PROF_MEMORY, MEM_WB.LMD = (int8_t)mem_read_8(MEM_WB.ALUOutput));	//Sign-extend the byte into lmd
+				break;
+				
+			case 0x21:	//LH
+				PROFILE(PROF_MEMORY, MEM_WB.LMD = (int16_t)mem_read_16(MEM_WB.ALUOutput));	//Sign-extend the halfword into lmd
+				break;
+				
+			case 0x23:	//LW
+				PROFILE(PROF_MEMORY, MEM_WB.LMD = 0xFFFFFFFF & mem_read_32(MEM_WB.ALUOutput));	//Get first 32 bits from memory and place in lmd
+				TRACE("lw mem address = %X\n", MEM_WB.ALUOutput);
+        		        break;
+				
+			case 0x28:	//SB
+				PROFILE(PROF_MEMORY, mem_write_8(MEM_WB.ALUOutput, MEM_WB.B));	//Write the low byte of B, the rest of the word stays
+				break;
+				
+			case 0x29:	//SH
+				PROFILE(PROF_MEMORY, mem_write_16(MEM_WB.ALUOutput, MEM_WB.B));	//Write the low halfword of B, the rest of the word stays
+				break;
+				
+			case 0x2B:	//SW
+				PROFILE(PROF_MEMORY, mem_write_32(MEM_WB.ALUOutput, MEM_WB.B));	//Write B into ALUOutput memory
+				break;
+				
+			default:
+				break;
+		}
+
+		if (NUM_WATCHPOINTS != 0){
+			if (opcode == 0x20 || opcode == 0x21 || opcode == 0x23){
+				check_watchpoint(MEM_WB.ALUOutput, WATCH_READ, MEM_WB.LMD);
+			}else if (opcode == 0x28 || opcode == 0x29 || opcode == 0x2B){
+				check_watchpoint(MEM_WB.ALUOutput, WATCH_WRITE, MEM_WB.B);
+			}
+		}
+	}
+	
+}
+
+/************************************************************/
+/* execution (EX) pipeline stage:                                                                          */ 
+/************************************************************/
+static void STAGE(EX)(void)
+{
+	/*IMPLEMENT THIS*/
+	//Third stage
+	//Initialize EX pipeline registers
+	
+	if (ID_EX.stall == 1){
+		TRACE("Stalled in EX stage\n");
+		EX_MEM.stall = 1;
+		EX_MEM.IR = 0;
+		EX_MEM.PC = 0;
+		EX_MEM.A = 0;
+		EX_MEM.B = 0;
+		EX_MEM.imm = 0;
+		EX_MEM.ALUOutput = 0;
+		EX_MEM.RegisterRS = 0;
+		EX_MEM.RegisterRT = 0;
+		EX_MEM.RegisterRD = 0;
+		EX_MEM.RegWrite = 0;
+		EX_MEM.Exception = 0;
+	}
+	
+	if (ID_EX.stall == 0) {
+		TRACE("Running EX stage\n");
+		EX_MEM.IR = ID_EX.IR;
+		EX_MEM.PC = ID_EX.PC;
+		EX_MEM.A = ID_EX.A;
+		EX_MEM.B = ID_EX.B;
+		EX_MEM.imm = ID_EX.imm;
+		EX_MEM.ALUOutput = 0;
+		EX_MEM.RegisterRS = ID_EX.RegisterRS;
+		EX_MEM.RegisterRT = ID_EX.RegisterRT;
+		EX_MEM.RegisterRD = ID_EX.RegisterRD;
+		EX_MEM.RegWrite = ID_EX.RegWrite;
+		EX_MEM.stall = ID_EX.stall;
+		EX_MEM.Mem = ID_EX.Mem;
+		EX_MEM.Exception = ID_EX.Exception;
+		EX_MEM.BadVAddr = ID_EX.BadVAddr;
+		
+		if (EX_MEM.IR == 0 || EX_MEM.Exception != 0){
+			return;	
+		}
+		TRACE_INSTRUCTION(EX_MEM.IR, EX_MEM.PC - 4);
+		COUNT_ACTIVITY(ACT_ALU, 1);
+		
+		const instr_desc_t *d = decode_instruction(EX_MEM.IR);
+		uint32_t rd = (EX_MEM.IR & 0x0000F800) >> 11;
+		uint32_t operand = (d->opcode == 0x00) ? EX_MEM.B : EX_MEM.imm;	//R-types use rt, the rest the immediate ID extended
+		uint32_t sa = (EX_MEM.IR & 0x04) ? (EX_MEM.A & 0x1F) : ((EX_MEM.IR >> 6) & 0x1F);	//SLLV/SRLV/SRAV shift by rs
+		
+		switch (d->op){
+			case OP_ADD:	//ADD, ADDI
+				EX_MEM.ALUOutput = EX_MEM.A + operand;
+				if (~(EX_MEM.A ^ operand) & (EX_MEM.A ^ EX_MEM.ALUOutput) & 0x80000000){
+					EX_MEM.Exception = EXC_OV;	//Same-sign operands, different-sign sum
+				}
+				break;
+				
+			case OP_ADDU:	//ADDU, ADDIU
+				EX_MEM.ALUOutput = EX_MEM.A + operand;
+				break;
+				
+			case OP_SUBU:
+				EX_MEM.ALUOutput = EX_MEM.A - operand;
+				break;
+				
+			case OP_SUB:
+				EX_MEM.ALUOutput = EX_MEM.A - operand;
+				if ((EX_MEM.A ^ operand) & (EX_MEM.A ^ EX_MEM.ALUOutput) & 0x80000000){
+					EX_MEM.Exception = EXC_OV;
+				}
+				break;
+				
+			case OP_AND:	//AND, ANDI
+				EX_MEM.ALUOutput = EX_MEM.A & operand;
+				break;
+				
+			case OP_OR:	//OR, ORI
+				EX_MEM.ALUOutput = EX_MEM.A | operand;
+				break;
+				
+			case OP_XOR:	//XOR, XORI
+				EX_MEM.ALUOutput = EX_MEM.A ^ operand;
+				break;
+				
+			case OP_NOR:
+				EX_MEM.ALUOutput = ~(EX_MEM.A | operand);
+				break;
+				
+			case OP_SLT:	//SLT, SLTI
+				EX_MEM.ALUOutput = ((int32_t)EX_MEM.A < (int32_t)operand) ? 1 : 0;
+				break;
+				
+			case OP_SLTU:	//SLTU, SLTIU (the immediate is still sign-extended)
+				EX_MEM.ALUOutput = (EX_MEM.A < operand) ? 1 : 0;
+				break;
+				
+			case OP_SLL:	//SLL, SLLV
+				EX_MEM.ALUOutput = EX_MEM.B << sa;
+				break;
+				
+			case OP_SRL:	//SRL, SRLV
+				EX_MEM.ALUOutput = EX_MEM.B >> sa;
+				break;
+				
+			case OP_SRA:	//SRA, SRAV
+				EX_MEM.ALUOutput = (uint32_t)((int32_t)EX_MEM.B >> sa);
+				break;
+				
+			case OP_LUI:
+				EX_MEM.ALUOutput = EX_MEM.imm << 16;	//Shift immediate left 16 bits and place in ALUOutput
+				break;
+				
+			case OP_LOAD:
+			case OP_STORE:
+				EX_MEM.ALUOutput = EX_MEM.A + EX_MEM.imm;	//Effective address, MEM makes the access
+				break;
+				
+			case OP_MFC0:	//MFC0 reads here, MTC0 and ERET act in WB
+				EX_MEM.ALUOutput = NEXT_STATE.CP0[rd];
+				break;
+				
+			default:
+				break;
+		}
+	}
+}
+
+/************************************************************/
+/* instruction decode (ID) pipeline stage:                                                         */ 
+/************************************************************/
+static void STAGE(ID)(void)
+{	
+	if (stall != 0){	//IF_ID still holds the instruction, decode it again once the stall is over
+                ID_EX.stall = 1;
+                TRACE("Stall is needed\n");
+                return;	
+	}
+	
+	if(stall == 0){
+                TRACE("Executing ID stage\n");
+		const instr_desc_t *d = decode_instruction(IF_ID.IR);
+		uint32_t use = (IF_ID.IR == 0) ? 0 : register_use(d);	//0 for the nop (SLL $0) and for words the stages do not run
+		uint32_t rs = (IF_ID.IR & 0x03E00000) >> 21;
+		uint32_t rt = (IF_ID.IR & 0x001F0000) >> 16;
+		uint32_t rd = (IF_ID.IR & 0x0000F800) >> 11;
+		uint32_t imm = IF_ID.IR & 0x0000FFFF;
+
+		ID_EX.IR = IF_ID.IR;
+                ID_EX.PC = IF_ID.PC;
+                ID_EX.Exception = IF_ID.Exception;
+                ID_EX.BadVAddr = IF_ID.BadVAddr;
+                if (ID_EX.Exception == 0 && reserved_instruction(IF_ID.IR)){
+                        ID_EX.Exception = EXC_RI;
+                }
+
+		//RegisterRS/RT are the registers read, RegisterRD the one written, 0 when unused
+		ID_EX.RegisterRS = (use & REG_READS_RS) ? rs : 0;
+		ID_EX.RegisterRT = (use & REG_READS_RT) ? rt : 0;
+		ID_EX.RegisterRD = (use & REG_WRITES_RD) ? rd : (use & REG_WRITES_RT) ? rt : 0;
+		ID_EX.RegWrite = (use & (REG_WRITES_RD | REG_WRITES_RT)) != 0;
+		ID_EX.A = NEXT_STATE.REGS[ID_EX.RegisterRS];
+		ID_EX.B = NEXT_STATE.REGS[ID_EX.RegisterRT];
+		COUNT_ACTIVITY(ACT_RF_READ, ((use & REG_READS_RS) != 0) + ((use & REG_READS_RT) != 0));
+
+		if (d == NULL || d->opcode == 0x00){
+			ID_EX.imm = 0;
+		}
+		else if (d->format == FMT_IMMU || d->format == FMT_LUI){
+			ID_EX.imm = imm;	//Logical immediates are zero extended
+		}
+		else if ((imm >> 15) == 1){
+			ID_EX.imm = imm | 0xFFFF0000;	//Sign extend if negative
+		}
+		else{
+			ID_EX.imm = imm & 0x0000FFFF;	//Else it's positive
+		}
+	}
+
+	
+	PROFILE(PROF_FORWARD, STAGE(ForwardData)());	//Check for data hazard and see if we can forward
+	uint32_t busy = unit_busy(EX_MEM.IR);	//A multi-cycle unit holds up everything behind it
+	if ((uint32_t)stall < busy){
+		LATENCY_STALLS += busy - stall;
+		stall = busy;
+	}
+
+	if (stall != 0){
+		TRACE("Data Hazard in ID stage\n");
+		ID_EX.stall = 1;
+	}
+	else{
+		ID_EX.stall = 0;	
+	}
+	
+	if (STAGE_FORWARDING && (ForwardA == 01 || ForwardA == 10)){
+		COUNT_ACTIVITY(ACT_FORWARD, 1);
+	}
+	if (STAGE_FORWARDING && (ForwardB == 01 || ForwardB == 10)){
+		COUNT_ACTIVITY(ACT_FORWARD, 1);
+	}
+	if (STAGE_FORWARDING && ForwardA == 01){
+		ID_EX.A = EX_MEM.ALUOutput;
+		ForwardA = 0;
+	}
+	if (STAGE_FORWARDING && ForwardB == 01){
+		ID_EX.B = EX_MEM.ALUOutput;
+		ForwardB = 0;
+	}
+	if (STAGE_FORWARDING && ForwardA == 10){
+		uint32_t opcode;
+		opcode = (MEM_WB.IR & 0xFC000000) >> 26;	//What the producer was
+		if (opcode == 0x20 || opcode == 0x21 || opcode == 0x23){	//For loads
+//			if (loadStallA == 1){
+				ID_EX.A = MEM_WB.LMD;
+				loadStall = 1;
+//				loadStallA = 0;
+//			}
+//			else {
+//				loadStallA = 1;
+//				++stall;
+//			}
+		}		
+		else{
+			ID_EX.A = MEM_WB.ALUOutput;	//If not load	
+		}
+		ForwardA = 0;
+	}
+	if (STAGE_FORWARDING && ForwardB == 10){
+		uint32_t opcode;
+                opcode = (MEM_WB.IR & 0xFC000000) >> 26;	//What the producer was
+		if (opcode == 0x20 || opcode == 0x21 || opcode == 0x23){	//For loads
+//			if (loadStallB == 1){
+				ID_EX.B = MEM_WB.LMD;
+				loadStall = 1;
+//				loadStallB = 0;
+//			}
+//			else{
+//				loadStallB = 1;
+//				++stall;
+//			}
+		}
+		else{
+			ID_EX.B = MEM_WB.ALUOutput;	//If not load	
+		}
+		ForwardB = 0;
+	}
+	
+}
+
+/************************************************************/
+/* instruction fetch (IF) pipeline stage:                                                              */ 
+/************************************************************/
+static void STAGE(IF)(void)
+{	//something with memread
+	/*IMPLEMENT THIS*/
+	//First stage
+	
+	if (stall == 0 && FETCH_DELAY != 0){	//Deeper front ends take longer to refill after a redirect
+		FETCH_DELAY--;
+		REDIRECT_BUBBLES++;
+		memset(&IF_ID, 0, sizeof(IF_ID));
+		return;
+	}
+
+	int fetch_wait = 0;
+	if (STAGE_MEMSYS && stall == 0){
+		PROFILE(PROF_MEMSYS, fetch_wait = memsys_fetch_wait(CURRENT_STATE.PC));
+	}
+	if (fetch_wait){	//ITLB or I-cache refill
+		memset(&IF_ID, 0, sizeof(IF_ID));
+		return;
+	}
+
+	if (NUM_BREAKPOINTS != 0 && stall == 0 && check_breakpoint(CURRENT_STATE.PC, FALSE)){
+		BREAK_FLAG = 1;
+	}
+
+	if (stall == 0){	//Fetch instruction if there's no stall
+		IF_ID.Exception = 0;
+		if ((CURRENT_STATE.PC & 0x3) || !mem_mapped(CURRENT_STATE.PC, 4)){
+			IF_ID.IR = 0;	//Goes down the pipe as a bubble carrying the fault
+			IF_ID.Exception = (CURRENT_STATE.PC & 0x3) ? EXC_ADEL : EXC_IBE;
+			IF_ID.BadVAddr = CURRENT_STATE.PC;
+		}
+		else{
+			PROFILE(PROF_MEMORY, IF_ID.IR = mem_read_32(CURRENT_STATE.PC));	//Get current value in memory
+			COUNT_ACTIVITY(ACT_FETCH, 1);
+		}
+		IF_ID.PC = CURRENT_STATE.PC + 4;	//Increment counter
+		NEXT_STATE.PC = IF_ID.PC;	//Store incremented counter into pc's next state
+	}
+	else{
+		TRACE("Stalled in IF Stage\n");	
+	}
+}
+
+// Check for Data Hazard and forward under conditions given to us in lab assignment
+// Which paths exist and how long to stall come from the machine description
+// RegisterRD is the register a producer writes, RegisterRS/RT the ones ID_EX reads
+static void STAGE(ForwardData)(void)
+{
+	int ex_a = EX_MEM.RegWrite && (EX_MEM.RegisterRD != 0) && (EX_MEM.RegisterRD == ID_EX.RegisterRS);
+	int ex_b = EX_MEM.RegWrite && (EX_MEM.RegisterRD != 0) && (EX_MEM.RegisterRD == ID_EX.RegisterRT);
+
+	//Forward from EX stage
+	if (ex_a){
+		STAGE(resolve_hazard)(&ForwardA, FWD_EX_MEM);
+	}
+	if (ex_b){
+		STAGE(resolve_hazard)(&ForwardB, FWD_EX_MEM);
+	}
+
+	//Forward from MEM stage unless EX has a newer value
+	if ((MEM_WB.RegWrite && (MEM_WB.RegisterRD != 0)) && !ex_a && (MEM_WB.RegisterRD == ID_EX.RegisterRS)){
+		STAGE(resolve_hazard)(&ForwardA, FWD_MEM_WB);
+	}
+	if ((MEM_WB.RegWrite && (MEM_WB.RegisterRD != 0)) && !ex_b && (MEM_WB.RegisterRD == ID_EX.RegisterRT)){
+		STAGE(resolve_hazard)(&ForwardB, FWD_MEM_WB);
+	}
+
+	//MFC0 reads CP0 in EX but MTC0 writes it in WB, and nothing forwards it
+	if ((ID_EX.IR >> 26) == 0x10 && ((ID_EX.IR >> 21) & 0x1F) == 0x00 &&
+		(EX_MEM.IR >> 26) == 0x10 && ((EX_MEM.IR >> 21) & 0x1F) == 0x04){
+		if ((uint32_t)stall < MACHINE.stall_mem_wb){
+			stall = MACHINE.stall_mem_wb;	//One stage less to wait than for a GPR read in ID
+		}
+	}
+}
+
+/************************************************************/
+/* One hazard found by ForwardData: use the forwarding path if the machine */
+/* has it, otherwise stall until the producer has written back. A load    */
+/* in EX/MEM has only its address, so the consumer waits for it to reach  */
+/* MEM/WB and takes LMD from there.                                                        */
+/************************************************************/
+static void STAGE(resolve_hazard)(int *forward, int path)
+{
+	uint32_t wait, opcode = (EX_MEM.IR & 0xFC000000) >> 26;
+
+	if (STAGE_FORWARDING && (MACHINE.forward & path) && path == FWD_EX_MEM &&
+		(opcode == 0x20 || opcode == 0x21 || opcode == 0x23)){
+		wait = MACHINE.load_stall;
+	}
+	else if (STAGE_FORWARDING && (MACHINE.forward & path)){
+		*forward = (path == FWD_EX_MEM) ? 01 : 10;
+		wait = (path == FWD_EX_MEM) ? MACHINE.forward_stall_ex_mem : MACHINE.forward_stall_mem_wb;
+	}
+	else{
+		wait = (path == FWD_EX_MEM) ? MACHINE.stall_ex_mem : MACHINE.stall_mem_wb;
+	}
+	if ((uint32_t)stall < wait){
+		stall = wait;
+	}
+}
+
+#undef STAGE
+#undef STAGE_NAME
+#undef STAGE_PASTE
+#undef TRACE
+#undef TRACE_INSTRUCTION
+#undef COUNT_ACTIVITY
+#undef PROFILE
+#undef STAGE_FORWARDING
+#undef STAGE_TRACE
+#undef STAGE_ACTIVITY
+#undef STAGE_PROFILE
+#undef STAGE_MEMSYS
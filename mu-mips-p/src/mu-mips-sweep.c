@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "mu-mips.h"
+#include "libmumips.h"
+
+/***************************************************************/
+/* Design-space sweep: every combination of the values in a grid file   */
+/* is run on every workload, one forked worker per run and as many at  */
+/* once as the host has cores. Results are cached under a hash of the  */
+/* configuration, the program and the simulator build, so a re-run only */
+/* simulates new points and a rebuilt simulator starts a fresh cache.     */
+/*                                                                                                                             */
+/*   forwarding 0 1                  # the forward command                         */
+/*   stage MEM 1 2                   # any machine description line            */
+/*   latency muldiv 1 4                                                                                 */
+/*   workload ../inputs/testPipeline1.in                                                  */
+/*   cycles 1000000                  # per run, default SWEEP_CYCLES            */
+/***************************************************************/
+
+#define SWEEP_MAX_AXES 16
+#define SWEEP_MAX_VALUES 16
+#define SWEEP_MAX_WORKLOADS 64
+#define SWEEP_CYCLES 1000000
+
+typedef struct {
+	char prefix[64];	/* description line before the value, empty for forwarding */
+	char column[64];
+	int num_values;
+	char values[SWEEP_MAX_VALUES][32];
+} axis_t;
+
+typedef struct {
+	int workload;
+	int choice[SWEEP_MAX_AXES];	/* value index per axis */
+	uint64_t key;
+	int state, cached, pareto;
+	uint32_t instructions, cycles, latency_stalls, refill_bubbles;
+	int exception, running;
+	double energy;		/* pJ */
+	double time, area;
+} job_t;
+
+axis_t AXES[SWEEP_MAX_AXES];
+int NUM_AXES = 0;
+char *WORKLOADS[SWEEP_MAX_WORKLOADS];
+uint64_t WORKLOAD_HASH[SWEEP_MAX_WORKLOADS];
+uint64_t BUILD_HASH;	/* this executable, which has libmumips.a linked in */
+int NUM_WORKLOADS = 0;
+uint32_t MAX_CYCLES = SWEEP_CYCLES;
+const char *CACHE_DIR = ".mu-mips-sweep";
+job_t *JOBS = NULL;
+int NUM_JOBS = 0;
+int *TODO = NULL;	/* the jobs that missed the cache */
+
+/***************************************************************/
+/* Read the grid file                                                                                           */
+/***************************************************************/
+int read_grid(const char *path)
+{
+	char line[CMD_LINE_SIZE], scratch[CMD_LINE_SIZE];
+	char *tok[2 + SWEEP_MAX_VALUES];
+	char *hash, *save, *word;
+	machine_t m;
+	axis_t *axis;
+	FILE *fp;
+	int lineno = 0, errors = 0, n, i, first;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: Can't open grid file %s\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if ((hash = strchr(line, '#')) != NULL) {
+			*hash = '\0';
+		}
+		for (n = 0, word = strtok_r(line, " \t\r\n", &save); word != NULL && n < 2 + SWEEP_MAX_VALUES; word = strtok_r(NULL, " \t\r\n", &save)) {
+			tok[n++] = word;
+		}
+		if (n == 0) {
+			continue;
+		}
+		if (strcmp(tok[0], "workload") == 0) {
+			for (i = 1; i < n && NUM_WORKLOADS < SWEEP_MAX_WORKLOADS; i++) {
+				WORKLOADS[NUM_WORKLOADS++] = strdup(tok[i]);
+			}
+			continue;
+		}
+		if (strcmp(tok[0], "cycles") == 0 && n == 2) {
+			MAX_CYCLES = strtoul(tok[1], NULL, 0);
+			continue;
+		}
+		first = (strcmp(tok[0], "forwarding") == 0) ? 1 : 2;
+		if (n <= first || NUM_AXES == SWEEP_MAX_AXES) {
+			fprintf(stderr, "%s:%d: expected a setting and at least one value\n", path, lineno);
+			errors++;
+			continue;
+		}
+		axis = &AXES[NUM_AXES++];
+		if (first == 1) {
+			axis->prefix[0] = '\0';
+			snprintf(axis->column, sizeof(axis->column), "forwarding");
+		}else {
+			snprintf(axis->prefix, sizeof(axis->prefix), "%s %s", tok[0], tok[1]);
+			snprintf(axis->column, sizeof(axis->column), "%s.%s", tok[0], tok[1]);
+		}
+		axis->num_values = n - first;
+		for (i = 0; i < axis->num_values; i++) {
+			snprintf(axis->values[i], sizeof(axis->values[i]), "%s", tok[first + i]);
+			if (first == 2) {	/* reject bad values now, not in every worker */
+				default_machine(&m);
+				snprintf(scratch, sizeof(scratch), "%s %s", axis->prefix, axis->values[i]);
+				errors += (machine_line(&m, scratch, path, lineno) != 0);
+			}
+		}
+	}
+	fclose(fp);
+	return errors ? -1 : 0;
+}
+
+/***************************************************************/
+/* Hash of a workload file's bytes                                                                     */
+/***************************************************************/
+int hash_file(const char *path, uint64_t *hash)
+{
+	uint8_t *buf;
+	long len;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		return -1;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	rewind(fp);
+	buf = malloc(len ? len : 1);
+	if (buf == NULL || fread(buf, 1, len, fp) != (size_t)len) {
+		free(buf);
+		fclose(fp);
+		return -1;
+	}
+	*hash = page_hash(buf, len);
+	free(buf);
+	fclose(fp);
+	return 0;
+}
+
+/***************************************************************/
+/* A job's machine description; returns its forwarding setting             */
+/***************************************************************/
+int job_description(const job_t *job, char *buf, size_t size)
+{
+	size_t len = 0;
+	int forwarding = 0, i;
+
+	buf[0] = '\0';
+	for (i = 0; i < NUM_AXES; i++) {
+		if (AXES[i].prefix[0] == '\0') {
+			forwarding = atoi(AXES[i].values[job->choice[i]]) != 0;
+		}else if (len < size) {
+			len += snprintf(buf + len, size - len, "%s %s\n", AXES[i].prefix, AXES[i].values[job->choice[i]]);
+		}
+	}
+	return forwarding;
+}
+
+/***************************************************************/
+/* Cache key: the simulator's inputs for one run                                          */
+/***************************************************************/
+uint64_t job_key(const job_t *job)
+{
+	char desc[CMD_LINE_SIZE], key[2 * CMD_LINE_SIZE];
+	int forwarding = job_description(job, desc, sizeof(desc));
+	int len;
+
+	len = snprintf(key, sizeof(key), "build %016llx\n%sforwarding %d\ncycles %u\nprogram %016llx\n",
+		(unsigned long long)BUILD_HASH, desc, forwarding, MAX_CYCLES, (unsigned long long)WORKLOAD_HASH[job->workload]);
+	return page_hash((const uint8_t *)key, len);
+}
+
+/***************************************************************/
+/* Load a job's result from the cache, FALSE on a miss                         */
+/***************************************************************/
+int read_result(job_t *job)
+{
+	char path[512];
+	FILE *fp;
+	int n;
+
+	snprintf(path, sizeof(path), "%s/%016llx", CACHE_DIR, (unsigned long long)job->key);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return FALSE;
+	}
+	n = fscanf(fp, "%u %u %u %u %d %d %lf", &job->instructions, &job->cycles, &job->latency_stalls,
+		&job->refill_bubbles, &job->exception, &job->running, &job->energy);
+	fclose(fp);
+	return n == 7;
+}
+
+/***************************************************************/
+/* Worker: simulate one job and leave the result in the cache              */
+/***************************************************************/
+int run_job(int t, int fd)
+{
+	char desc[CMD_LINE_SIZE], path[512], tmp[512 + 16];
+	const job_t *job = &JOBS[TODO[t]];
+	mumips_stats_t stats;
+	mumips_t *sim;
+	FILE *fp;
+	int forwarding = job_description(job, desc, sizeof(desc));
+
+	sim = mumips_create();
+	if (sim == NULL || mumips_load_file(sim, WORKLOADS[job->workload]) != 0 || mumips_set_machine(sim, desc) != 0) {
+		return JOB_ERROR;
+	}
+	mumips_set_forwarding(sim, forwarding);
+	mumips_step(sim, MAX_CYCLES);
+	mumips_get_stats(sim, &stats);
+	mumips_destroy(sim);
+
+	/* rename so a concurrent reader never sees half a result */
+	snprintf(path, sizeof(path), "%s/%016llx", CACHE_DIR, (unsigned long long)job->key);
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		return JOB_ERROR;
+	}
+	fprintf(fp, "%u %u %u %u %d %d %.3f\n", stats.instructions, stats.cycles, stats.latency_stalls,
+		stats.refill_bubbles, stats.exception, stats.running, stats.energy);
+	fclose(fp);
+	return (rename(tmp, path) == 0) ? JOB_PASS : JOB_ERROR;
+}
+
+/***************************************************************/
+/* Parent: pick up a finished job's result from the cache                       */
+/***************************************************************/
+void job_done(int t, int state, const char *report)
+{
+	job_t *job = &JOBS[TODO[t]];
+
+	job->state = (state == JOB_PASS && read_result(job)) ? JOB_PASS : JOB_ERROR;
+}
+
+/***************************************************************/
+/* Derived metrics and the per-workload Pareto front                               */
+/*                                                                                                                             */
+/* Stages are assumed to have equal logic delay, so splitting all of them */
+/* k ways divides the clock period by k and time = cycles / min depth.     */
+/* Area counts pipeline latches plus forwarding paths in use. A point is  */
+/* on the front if no other completed run of its workload is at least    */
+/* as good in both and better in one.                                                            */
+/***************************************************************/
+void derive_metrics()
+{
+	char desc[CMD_LINE_SIZE];
+	uint32_t min_depth;
+	machine_t m;
+	job_t *a, *b;
+	int forwarding, i, j;
+
+	for (i = 0; i < NUM_JOBS; i++) {
+		a = &JOBS[i];
+		forwarding = job_description(a, desc, sizeof(desc));
+		if (parse_machine(desc) != 0) {
+			continue;
+		}
+		m = MACHINE;
+		min_depth = m.depth[0];
+		a->area = 0;
+		for (j = 0; j < NUM_STAGES; j++) {
+			min_depth = (m.depth[j] < min_depth) ? m.depth[j] : min_depth;
+			a->area += m.depth[j];
+		}
+		if (forwarding) {
+			a->area += ((m.forward & FWD_EX_MEM) != 0) + ((m.forward & FWD_MEM_WB) != 0);
+		}
+		a->time = (double)a->cycles / min_depth;
+	}
+	for (i = 0; i < NUM_JOBS; i++) {
+		a = &JOBS[i];
+		a->pareto = (a->state == JOB_PASS && !a->running && a->exception == -1);
+		for (j = 0; j < NUM_JOBS && a->pareto; j++) {
+			b = &JOBS[j];
+			if (j == i || b->workload != a->workload || b->state != JOB_PASS || b->running || b->exception != -1) {
+				continue;
+			}
+			if (b->time <= a->time && b->area <= a->area && (b->time < a->time || b->area < a->area)) {
+				a->pareto = FALSE;
+			}
+		}
+	}
+}
+
+/***************************************************************/
+/* How a run ended                                                                                            */
+/***************************************************************/
+const char *job_status(const job_t *job)
+{
+	if (job->state != JOB_PASS) {
+		return "error";
+	}
+	if (job->exception != -1) {
+		return exception_name(job->exception);
+	}
+	return job->running ? "timeout" : "exit";
+}
+
+/***************************************************************/
+/* One row per job, as CSV or a JSON array                                                  */
+/***************************************************************/
+void write_results(FILE *out, int json)
+{
+	const job_t *job;
+	double cpi;
+	int i, j;
+
+	if (json) {
+		fprintf(out, "[\n");
+	}else {
+		fprintf(out, "workload");
+		for (j = 0; j < NUM_AXES; j++) {
+			fprintf(out, ",%s", AXES[j].column);
+		}
+		fprintf(out, ",status,instructions,cycles,cpi,ipc,latency_stalls,refill_bubbles,energy_pj,epi_pj,time,area,pareto,cached\n");
+	}
+	for (i = 0; i < NUM_JOBS; i++) {
+		job = &JOBS[i];
+		cpi = job->instructions ? (double)job->cycles / job->instructions : 0.0;
+		if (json) {
+			fprintf(out, "  {\"workload\": \"%s\"", WORKLOADS[job->workload]);
+			for (j = 0; j < NUM_AXES; j++) {
+				fprintf(out, ", \"%s\": \"%s\"", AXES[j].column, AXES[j].values[job->choice[j]]);
+			}
+			fprintf(out, ", \"status\": \"%s\", \"instructions\": %u, \"cycles\": %u, \"cpi\": %.4f, \"ipc\": %.4f, "
+				"\"latency_stalls\": %u, \"refill_bubbles\": %u, \"energy_pj\": %.1f, \"epi_pj\": %.2f, \"time\": %.1f, \"area\": %.0f, "
+				"\"pareto\": %s, \"cached\": %s}%s\n",
+				job_status(job), job->instructions, job->cycles, cpi, job->cycles ? (double)job->instructions / job->cycles : 0.0,
+				job->latency_stalls, job->refill_bubbles, job->energy, job->instructions ? job->energy / job->instructions : 0.0, job->time, job->area, job->pareto ? "true" : "false",
+				job->cached ? "true" : "false", (i + 1 < NUM_JOBS) ? "," : "");
+		}else {
+			fprintf(out, "%s", WORKLOADS[job->workload]);
+			for (j = 0; j < NUM_AXES; j++) {
+				fprintf(out, ",%s", AXES[j].values[job->choice[j]]);
+			}
+			fprintf(out, ",%s,%u,%u,%.4f,%.4f,%u,%u,%.1f,%.2f,%.1f,%.0f,%d,%d\n", job_status(job), job->instructions, job->cycles,
+				cpi, job->cycles ? (double)job->instructions / job->cycles : 0.0, job->latency_stalls, job->refill_bubbles,
+				job->energy, job->instructions ? job->energy / job->instructions : 0.0, job->time, job->area, job->pareto, job->cached);
+		}
+	}
+	if (json) {
+		fprintf(out, "]\n");
+	}
+}
+
+/***************************************************************/
+/* main                                                                                                                                   */
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+	const char *out_path = NULL;
+	int workers = pool_workers();
+	int json = 0, rerun = 0, opt, i, j, k, ran = 0, failed = 0;
+	struct timespec t0, t1;
+	FILE *out = stdout;
+
+	while ((opt = getopt(argc, argv, "j:c:o:Jr")) != -1) {
+		switch (opt) {
+			case 'j': workers = atoi(optarg); break;
+			case 'c': CACHE_DIR = optarg; break;
+			case 'o': out_path = optarg; break;
+			case 'J': json = 1; break;
+			case 'r': rerun = 1; break;
+			default:
+				fprintf(stderr, "Usage: %s [-j workers] [-c cache dir] [-o output] [-J json] [-r ignore cache] <grid file> [workload...]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-j workers] [-c cache dir] [-o output] [-J json] [-r ignore cache] <grid file> [workload...]\n", argv[0]);
+		return 1;
+	}
+	if (read_grid(argv[optind]) != 0) {
+		return 1;
+	}
+	for (i = optind + 1; i < argc && NUM_WORKLOADS < SWEEP_MAX_WORKLOADS; i++) {
+		WORKLOADS[NUM_WORKLOADS++] = argv[i];
+	}
+	if (NUM_WORKLOADS == 0) {
+		fprintf(stderr, "Error: no workloads\n");
+		return 1;
+	}
+	for (i = 0; i < NUM_WORKLOADS; i++) {
+		if (hash_file(WORKLOADS[i], &WORKLOAD_HASH[i]) != 0) {
+			fprintf(stderr, "Error: Can't read workload %s\n", WORKLOADS[i]);
+			return 1;
+		}
+	}
+	if (hash_file("/proc/self/exe", &BUILD_HASH) != 0) {
+		fprintf(stderr, "Error: Can't read the simulator executable\n");
+		return 1;
+	}
+	if (mkdir(CACHE_DIR, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Error: Can't create cache directory %s\n", CACHE_DIR);
+		return 1;
+	}
+	workers = (workers < 1) ? 1 : workers;
+
+	/* every workload times every combination, the last axis varying fastest */
+	NUM_JOBS = NUM_WORKLOADS;
+	for (j = 0; j < NUM_AXES; j++) {
+		NUM_JOBS *= AXES[j].num_values;
+	}
+	JOBS = calloc(NUM_JOBS, sizeof(job_t));
+	TODO = calloc(NUM_JOBS, sizeof(int));
+	if (JOBS == NULL || TODO == NULL) {
+		return 1;
+	}
+	for (i = 0; i < NUM_JOBS; i++) {
+		k = i;
+		for (j = NUM_AXES - 1; j >= 0; j--) {
+			JOBS[i].choice[j] = k % AXES[j].num_values;
+			k /= AXES[j].num_values;
+		}
+		JOBS[i].workload = k;
+		JOBS[i].key = job_key(&JOBS[i]);
+		if (!rerun && read_result(&JOBS[i])) {
+			JOBS[i].state = JOB_PASS;
+			JOBS[i].cached = TRUE;
+		}else {
+			TODO[ran++] = i;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	run_pool(ran, workers, run_job, job_done);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	derive_metrics();
+
+	if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+		fprintf(stderr, "Error: Can't write %s\n", out_path);
+		return 1;
+	}
+	write_results(out, json);
+	if (out != stdout) {
+		fclose(out);
+	}
+	for (i = 0; i < NUM_JOBS; i++) {
+		failed += (JOBS[i].state != JOB_PASS);
+	}
+	fprintf(stderr, "%d runs: %d simulated on %d workers in %.2f s, %d cached, %d failed\n", NUM_JOBS, ran, workers,
+		(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, NUM_JOBS - ran, failed);
+	free(JOBS);
+	free(TODO);
+	return failed != 0;
+}
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mu-mips.h"
+
+uint32_t HEAP_BASE = MEM_DATA_BEGIN;
+uint32_t HEAP_BREAK = MEM_DATA_BEGIN;
+uint32_t HEAP_PEAK = MEM_DATA_BEGIN;
+uint32_t SYSCALL_COUNT = 0;
+uint32_t UNKNOWN_SYSCALL_COUNT = 0;
+uint32_t UNKNOWN_SYSCALL = 0;
+uint32_t UNKNOWN_SYSCALL_PC = 0;
+int EXIT_CODE = 0;
+
+char GUEST_OUT[GUEST_OUT_SIZE];
+uint32_t GUEST_OUT_LEN = 0;
+int GUEST_FILES[MAX_GUEST_FILES] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+
+syscall_record_t *SYSCALL_LOG = NULL;
+uint32_t SYSCALL_LOG_LEN = 0;
+uint32_t SYSCALL_LOG_MAX = 0;
+
+/***************************************************************/
+/* Queue guest stdout; written to the host when full or the run stops   */
+/***************************************************************/
+void guest_output(const char *data, uint32_t len)
+{
+	if (GUEST_OUT_LEN + len > GUEST_OUT_SIZE) {
+		flush_guest_output();
+	}
+	if (len >= GUEST_OUT_SIZE) {
+		fwrite(data, 1, len, stdout);
+		return;
+	}
+	memcpy(GUEST_OUT + GUEST_OUT_LEN, data, len);
+	GUEST_OUT_LEN += len;
+}
+
+/***************************************************************/
+/* Write out queued guest stdout                                                                          */
+/***************************************************************/
+void flush_guest_output()
+{
+	if (GUEST_OUT_LEN != 0) {
+		fwrite(GUEST_OUT, 1, GUEST_OUT_LEN, stdout);
+		GUEST_OUT_LEN = 0;
+	}
+	fflush(stdout);
+}
+
+/***************************************************************/
+/* Close guest files, forget logged results and empty the heap               */
+/***************************************************************/
+void reset_syscalls()
+{
+	int i;
+
+	flush_guest_output();
+	for (i = 0; i < MAX_GUEST_FILES; i++) {
+		if (GUEST_FILES[i] != -1) {
+			close(GUEST_FILES[i]);
+			GUEST_FILES[i] = -1;
+		}
+	}
+	clear_syscall_log();
+	HEAP_BREAK = HEAP_BASE;
+	HEAP_PEAK = HEAP_BASE;
+	SYSCALL_COUNT = 0;
+	UNKNOWN_SYSCALL_COUNT = 0;
+	EXIT_CODE = 0;
+}
+
+/***************************************************************/
+/* Start the heap after the static data: the loaded .data, which ends   */
+/* at data_end, and a host file mapped at the start of the data region  */
+/***************************************************************/
+void set_heap_base(uint32_t data_end)
+{
+	int i;
+
+	for (i = 0; i < NUM_FILE_MAPS; i++) {
+		if (FILE_MAPS[i].address == MEM_DATA_BEGIN && MEM_DATA_BEGIN + FILE_MAPS[i].size > data_end) {
+			data_end = MEM_DATA_BEGIN + FILE_MAPS[i].size;
+		}
+	}
+	HEAP_BASE = (data_end + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+	HEAP_BREAK = HEAP_BASE;
+	HEAP_PEAK = HEAP_BASE;
+}
+
+/***************************************************************/
+/* Drop every logged syscall result                                                                    */
+/***************************************************************/
+void clear_syscall_log()
+{
+	uint32_t i;
+
+	for (i = 0; i < SYSCALL_LOG_LEN; i++) {
+		free(SYSCALL_LOG[i].data);
+	}
+	SYSCALL_LOG_LEN = 0;
+}
+
+/***************************************************************/
+/* Logged result of the syscall made in a cycle, NULL if none                   */
+/***************************************************************/
+syscall_record_t *find_syscall_record(uint32_t cycle)
+{
+	uint32_t lo = 0, hi = SYSCALL_LOG_LEN, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (SYSCALL_LOG[mid].cycle < cycle) {
+			lo = mid + 1;
+		}else {
+			hi = mid;
+		}
+	}
+	return (lo < SYSCALL_LOG_LEN && SYSCALL_LOG[lo].cycle == cycle) ? &SYSCALL_LOG[lo] : NULL;
+}
+
+/***************************************************************/
+/* Remember a syscall's result while recording for reverse execution  */
+/***************************************************************/
+void log_syscall(uint32_t v0, uint32_t address, const uint8_t *data, uint32_t len)
+{
+	syscall_record_t *rec;
+
+	if (!RECORDING) {
+		return;
+	}
+	if (SYSCALL_LOG_LEN == SYSCALL_LOG_MAX) {
+		SYSCALL_LOG_MAX = SYSCALL_LOG_MAX ? SYSCALL_LOG_MAX * 2 : 64;
+		SYSCALL_LOG = realloc(SYSCALL_LOG, SYSCALL_LOG_MAX * sizeof(syscall_record_t));
+		assert(SYSCALL_LOG != NULL);
+	}
+	rec = &SYSCALL_LOG[SYSCALL_LOG_LEN++];	/* cycles only grow between resets */
+	rec->cycle = CYCLE_COUNT;
+	rec->v0 = v0;
+	rec->address = address;
+	rec->length = len;
+	rec->data = NULL;
+	if (len != 0) {
+		rec->data = malloc(len);
+		assert(rec->data != NULL);
+		memcpy(rec->data, data, len);
+	}
+}
+
+/***************************************************************/
+/* Host copy of a NUL-terminated guest string                                                 */
+/***************************************************************/
+uint32_t guest_string(uint32_t address, char *buf, uint32_t size)
+{
+	uint32_t len = mem_read_bytes(address, (uint8_t *)buf, size - 1);
+	char *end = memchr(buf, '\0', len);
+
+	len = end ? (uint32_t)(end - buf) : len;
+	buf[len] = '\0';
+	return len;
+}
+
+/***************************************************************/
+/* Print a NUL-terminated guest string without copying it                         */
+/***************************************************************/
+void print_guest_string(uint32_t address)
+{
+	uint32_t avail;
+	uint8_t *ptr = mem_host_ptr(address, &avail);
+	uint8_t *end;
+
+	if (ptr == NULL) {
+		mem_fault(address);
+		return;
+	}
+	end = memchr(ptr, '\0', avail);
+	guest_output((const char *)ptr, end ? (uint32_t)(end - ptr) : avail);
+}
+
+/***************************************************************/
+/* Read a line from the host's stdin, without the newline if strip is set */
+/***************************************************************/
+uint32_t read_host_line(char *buf, uint32_t size, int strip)
+{
+	uint32_t len;
+
+	flush_guest_output();	/* show the prompt first */
+	if (size == 0 || fgets(buf, size, stdin) == NULL) {
+		if (size != 0) {
+			buf[0] = '\0';
+		}
+		return 0;
+	}
+	len = strlen(buf);
+	if (strip && len != 0 && buf[len - 1] == '\n') {
+		buf[--len] = '\0';
+	}
+	return len;
+}
+
+/***************************************************************/
+/* open() flags from the MARS numbering                                                              */
+/***************************************************************/
+int host_open_flags(uint32_t flags)
+{
+	switch (flags) {
+		case 0: return O_RDONLY;
+		case 1: return O_WRONLY | O_CREAT | O_TRUNC;
+		case 9: return O_WRONLY | O_CREAT | O_APPEND;
+		default: return -1;
+	}
+}
+
+/***************************************************************/
+/* Host side of every syscall but exit and sbrk                                               */
+/*                                                                                                                            */
+/* Returns FALSE for an unknown syscall.                                                        */
+/***************************************************************/
+int host_syscall_effects(uint32_t v0, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+	char line[CMD_LINE_SIZE];
+	char path[256];
+	uint8_t *buf;
+	uint32_t len, result = v0;
+	int fd, flags, c;
+
+	switch (v0) {
+		case SYS_PRINT_INT:
+			len = snprintf(line, sizeof(line), "%d", (int32_t)a0);
+			guest_output(line, len);
+			log_syscall(v0, 0, NULL, 0);
+			return TRUE;
+
+		case SYS_PRINT_STRING:
+			print_guest_string(a0);
+			log_syscall(v0, 0, NULL, 0);
+			return TRUE;
+
+		case SYS_PRINT_CHAR:
+			line[0] = a0 & 0xFF;
+			guest_output(line, 1);
+			log_syscall(v0, 0, NULL, 0);
+			return TRUE;
+
+		case SYS_READ_INT:
+			read_host_line(line, sizeof(line), 1);
+			result = (uint32_t)strtol(line, NULL, 10);	/* decimal as in SPIM, so 010 is ten */
+			break;
+
+		case SYS_READ_CHAR:
+			flush_guest_output();
+			c = getchar();
+			result = (c == EOF) ? 0xFFFFFFFF : (uint32_t)c;
+			break;
+
+		case SYS_READ_STRING:	/* at most a1 - 1 characters, NUL-terminated */
+			buf = malloc(a1 ? a1 : 1);
+			assert(buf != NULL);
+			len = read_host_line((char *)buf, a1, 0);
+			len = (a1 != 0) ? mem_write_bytes(a0, buf, len + 1) : 0;
+			log_syscall(v0, a0, buf, len);
+			free(buf);
+			return TRUE;
+
+		case SYS_OPEN:
+			guest_string(a0, path, sizeof(path));
+			flags = host_open_flags(a1);
+			result = 0xFFFFFFFF;
+			for (fd = 0; fd < MAX_GUEST_FILES && GUEST_FILES[fd] != -1; fd++);
+			if (flags != -1 && fd < MAX_GUEST_FILES) {
+				GUEST_FILES[fd] = open(path, flags, 0644);
+				if (GUEST_FILES[fd] != -1) {
+					result = fd + 3;
+				}
+			}
+			break;
+
+		case SYS_READ:
+			result = 0xFFFFFFFF;
+			buf = malloc((size_t)a2 + 1);	/* room for the NUL fgets adds */
+			assert(buf != NULL);
+			len = 0;
+			if (a0 == 0) {
+				len = read_host_line((char *)buf, a2 + 1, 0);
+				result = len;
+			}else if (a0 >= 3 && a0 < MAX_GUEST_FILES + 3 && GUEST_FILES[a0 - 3] != -1) {
+				result = read(GUEST_FILES[a0 - 3], buf, a2);
+				len = ((int32_t)result > 0) ? result : 0;
+			}
+			len = mem_write_bytes(a1, buf, len);
+			SET_REG(2, result);
+			log_syscall(result, a1, buf, len);
+			free(buf);
+			return TRUE;
+
+		case SYS_WRITE:
+			result = 0xFFFFFFFF;
+			buf = mem_host_ptr(a1, &len);
+			if (buf == NULL) {
+				mem_fault(a1);
+				break;
+			}
+			len = (a2 < len) ? a2 : len;
+			if (a0 == 1) {
+				guest_output((const char *)buf, len);
+				result = len;
+			}else if (a0 == 2) {
+				flush_guest_output();
+				result = fwrite(buf, 1, len, stderr);
+			}else if (a0 >= 3 && a0 < MAX_GUEST_FILES + 3 && GUEST_FILES[a0 - 3] != -1) {
+				result = write(GUEST_FILES[a0 - 3], buf, len);
+			}
+			break;
+
+		case SYS_CLOSE:
+			if (a0 >= 3 && a0 < MAX_GUEST_FILES + 3 && GUEST_FILES[a0 - 3] != -1) {
+				close(GUEST_FILES[a0 - 3]);
+				GUEST_FILES[a0 - 3] = -1;
+			}
+			break;
+
+		default:
+			/* counted like a memory fault; stats shows the last one */
+			UNKNOWN_SYSCALL_COUNT++;
+			UNKNOWN_SYSCALL = v0;
+			UNKNOWN_SYSCALL_PC = MEM_WB.PC - 4;
+			return FALSE;
+	}
+	SET_REG(2, result);
+	log_syscall(result, 0, NULL, 0);
+	return TRUE;
+}
+
+/***************************************************************/
+/* Run the syscall in $v0, called from WB                                                       */
+/***************************************************************/
+void host_syscall()
+{
+	uint32_t v0 = NEXT_STATE.REGS[2];
+	uint32_t a0 = NEXT_STATE.REGS[4];
+	int32_t amount;
+	syscall_record_t *rec;
+
+	SYSCALL_COUNT++;
+	switch (v0) {
+		case SYS_EXIT:
+		case SYS_EXIT2:
+			EXIT_CODE = (v0 == SYS_EXIT2) ? (int32_t)a0 : 0;
+			flush_guest_output();
+			RUN_FLAG = FALSE;
+			return;
+
+		case SYS_SBRK:	/* guest state only, so never logged */
+			amount = ((int32_t)a0 + 3) & ~3;
+			if ((int64_t)HEAP_BREAK + amount < HEAP_BASE || (int64_t)HEAP_BREAK + amount > HEAP_LIMIT) {
+				SET_REG(2, 0xFFFFFFFF);
+			}else {
+				SET_REG(2, HEAP_BREAK);
+				HEAP_BREAK += amount;
+				if (HEAP_BREAK > HEAP_PEAK) {
+					HEAP_PEAK = HEAP_BREAK;
+				}
+			}
+			break;
+
+		default:
+			rec = find_syscall_record(CYCLE_COUNT);
+			if (rec != NULL) {
+				/* this cycle already ran once: same result, no second host effect */
+				SET_REG(2, rec->v0);
+				if (rec->length != 0) {
+					mem_write_bytes(rec->address, rec->data, rec->length);
+				}
+			}else if (!host_syscall_effects(v0, a0, NEXT_STATE.REGS[5], NEXT_STATE.REGS[6])) {
+				return;
+			}
+			if (v0 == SYS_PRINT_INT || v0 == SYS_PRINT_STRING || v0 == SYS_PRINT_CHAR) {
+				return;	/* nothing the instructions behind could have read early */
+			}
+			break;
+	}
+	/* anything behind the SYSCALL may have read $v0 or memory already */
+	flush_and_redirect(MEM_WB.PC);
+}
@@ -0,0 +1,666 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-mips.h"
+
+/***************************************************************/
+/* Lockstep simulation of WIDE_LANES independent programs                 */
+/*                                                                                                                             */
+/* The latches and counters are kept as one vector per field, so a      */
+/* stage runs for every lane at once and per-lane decisions become      */
+/* masks. Only fetch, register file and memory accesses go lane by       */
+/* lane. The engine covers the pipeline as the stages run it for plain   */
+/* ALU, load and store code; before a cycle that would raise an          */
+/* exception, fault, reach a syscall or CP0, or store over the word      */
+/* about to be fetched, the lane's state is written back and the caller  */
+/* finishes it on the normal pipeline, so results are the same.           */
+/***************************************************************/
+
+/***************************************************************/
+/* The vectors are 256 bits. Without AVX2 the compiler breaks their     */
+/* compares into one lane at a time and the engine is slower than the  */
+/* normal pipeline, so it is only used where the host has AVX2; the rest */
+/* of this file is compiled for it.                                                                  */
+/***************************************************************/
+int wide_supported()
+{
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	return __builtin_cpu_supports("avx2");
+#else
+	return FALSE;
+#endif
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__clang__)
+#pragma GCC target("avx2")
+#endif
+
+typedef uint32_t wide_t __attribute__((vector_size(WIDE_LANES * sizeof(uint32_t))));
+typedef int32_t wide_signed_t __attribute__((vector_size(WIDE_LANES * sizeof(int32_t))));	/* SLT, SRA */
+
+#define MASK(cond) ((wide_t)(cond))	/* all ones where cond holds */
+#define BLEND(m, a, b) (((m) & (a)) | (~(m) & (b)))
+
+/* decode_info() bits, zero for the bubble IR == 0 */
+#define INFO_WB_SHIFT 0		/* what WB does with the instruction */
+#define INFO_WB_MASK  0x3
+#define WB_NONE 0
+#define WB_RD   1	/* rd = ALUOutput */
+#define WB_RT   2	/* rt = ALUOutput */
+#define WB_LMD  3	/* rt = LMD */
+#define INFO_SPECIAL  0x8	/* reserved, SYSCALL or CP0: not run here */
+#define INFO_READS_RS 0x10	/* register_use() */
+#define INFO_READS_RT 0x20
+#define INFO_IMM_ZERO 0x40	/* zero-extended immediate */
+#define INFO_BUSY_SHIFT 8	/* unit_busy() */
+#define INFO_OP_SHIFT 16	/* OP_* */
+
+#define WIDE_CHUNK 65536	/* cycles between folding the 32-bit activity counts */
+
+typedef struct {
+	wide_t PC, IR, A, B, imm, ALUOutput, LMD;
+	wide_t RegisterRD, RegisterRS, RegisterRT, RegWrite, Mem, stall, Exception, BadVAddr;
+	wide_t info;	/* decode_info(IR), carried along with it */
+} wide_latch_t;
+
+typedef struct {
+	wide_latch_t if_id, id_ex, ex_mem, mem_wb;
+	wide_t pc, stall, count, compare, cause;
+	wide_t instructions, cycles, latency_stalls;
+	wide_t activity[NUM_ACTIVITY];
+	wide_t active;
+	uint32_t regs[MIPS_REGS + 1][WIDE_LANES];	/* the last row takes writes that do not happen */
+} wide_state_t;
+
+
+/***************************************************************/
+/* Instructions the engine leaves to the normal pipeline                          */
+/***************************************************************/
+static int special_instruction(uint32_t ir)
+{
+	const instr_desc_t *d = decode_instruction(ir);
+
+	return reserved_instruction(ir) || d->op == OP_MFC0 || d->op == OP_MTC0 || d->op == OP_ERET || d->op == OP_SYSCALL;
+}
+
+/***************************************************************/
+/* What the stages need to know about an instruction word. It only     */
+/* depends on the opcode and the funct (SPECIAL) or rt (REGIMM) field, */
+/* so INFO_TABLE holds it for every key and is refilled per wide_run()   */
+/* as unit_busy() follows MACHINE.                                                              */
+/***************************************************************/
+#define INFO_KEYS 160	/* opcode, 64 + funct, 128 + rt */
+
+static uint32_t INFO_TABLE[INFO_KEYS];
+
+static void build_info_table()
+{
+	const instr_desc_t *d;
+	uint32_t key, ir, kind, use;
+
+	for (key = 0; key < INFO_KEYS; key++) {
+		/* a word with that key, rd = 1 so it is not the nop, and every other field zero */
+		ir = (key < 64) ? key << 26 : (key < 128) ? key - 64 : (0x01 << 26) | ((key - 128) << 16);
+		ir |= 1 << 11;
+		if (special_instruction(ir)) {
+			INFO_TABLE[key] = INFO_SPECIAL;
+			continue;
+		}
+		/* the registers ID picks and WB writes */
+		d = decode_instruction(ir);
+		use = register_use(d);
+		kind = (use & REG_WRITES_RD) ? WB_RD : !(use & REG_WRITES_RT) ? WB_NONE : (d->op == OP_LOAD) ? WB_LMD : WB_RT;
+		kind |= (use & REG_READS_RS) ? INFO_READS_RS : 0;
+		kind |= (use & REG_READS_RT) ? INFO_READS_RT : 0;
+		kind |= (d->format == FMT_IMMU || d->format == FMT_LUI) ? INFO_IMM_ZERO : 0;
+		kind |= d->op << INFO_OP_SHIFT;
+		kind |= unit_busy(ir) << INFO_BUSY_SHIFT;
+		INFO_TABLE[key] = kind;
+	}
+}
+
+static inline uint32_t decode_info(uint32_t ir)
+{
+	uint32_t opcode = ir >> 26;
+
+	if (ir == 0) {
+		return 0;
+	}
+	return INFO_TABLE[(opcode == 0) ? 64 + (ir & 0x3F) : (opcode == 1) ? 128 + ((ir >> 16) & 0x1F) : opcode];
+}
+
+/***************************************************************/
+/* mem_read_32/16/8 on the lane's own memory, zero-extended                */
+/***************************************************************/
+static inline uint32_t read_word(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t lane_read(const wide_lane_t *lane, uint32_t address, uint32_t size)
+{
+	const uint8_t *p;
+	int i;
+
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if (address >= MEM_REGIONS[i].begin && address <= MEM_REGIONS[i].end - (size - 1)) {
+			p = lane->mem[i] + (address - MEM_REGIONS[i].begin);
+			return (size == 4) ? read_word(p) : (size == 2) ? (p[0] | (p[1] << 8)) : p[0];
+		}
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Can this saved state start in lockstep                                                        */
+/***************************************************************/
+int wide_eligible(const sim_context_t *ctx)
+{
+	const CPU_Pipeline_Reg *latch[4] = { &ctx->if_id, &ctx->id_ex, &ctx->ex_mem, &ctx->mem_wb };
+	int i;
+
+	if (!ctx->run_flag || ctx->fetch_delay != 0 || ctx->forward_a != 0 || ctx->forward_b != 0 ||
+		(ctx->current.CP0[CP0_STATUS] & (STATUS_IE | STATUS_EXL))) {
+		return FALSE;
+	}
+	for (i = 0; i < 4; i++) {
+		if (latch[i]->Exception != 0 || special_instruction(latch[i]->IR)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static void load_latch(wide_latch_t *w, const CPU_Pipeline_Reg *r, int l)
+{
+	w->PC[l] = r->PC;
+	w->IR[l] = r->IR;
+	w->A[l] = r->A;
+	w->B[l] = r->B;
+	w->imm[l] = r->imm;
+	w->ALUOutput[l] = r->ALUOutput;
+	w->LMD[l] = r->LMD;
+	w->RegisterRD[l] = r->RegisterRD;
+	w->RegisterRS[l] = r->RegisterRS;
+	w->RegisterRT[l] = r->RegisterRT;
+	w->RegWrite[l] = r->RegWrite;
+	w->Mem[l] = r->Mem;
+	w->stall[l] = r->stall;
+	w->Exception[l] = r->Exception;
+	w->BadVAddr[l] = r->BadVAddr;
+	w->info[l] = decode_info(r->IR);
+}
+
+static void store_latch(CPU_Pipeline_Reg *r, const wide_latch_t *w, int l)
+{
+	r->PC = w->PC[l];
+	r->IR = w->IR[l];
+	r->A = w->A[l];
+	r->B = w->B[l];
+	r->imm = w->imm[l];
+	r->ALUOutput = w->ALUOutput[l];
+	r->LMD = w->LMD[l];
+	r->RegisterRD = w->RegisterRD[l];
+	r->RegisterRS = w->RegisterRS[l];
+	r->RegisterRT = w->RegisterRT[l];
+	r->RegWrite = w->RegWrite[l];
+	r->Mem = w->Mem[l];
+	r->stall = w->stall[l];
+	r->Exception = w->Exception[l];
+	r->BadVAddr = w->BadVAddr[l];
+}
+
+/***************************************************************/
+/* Move lane l between its saved context and the vectors                      */
+/***************************************************************/
+static void import_lane(wide_state_t *s, const sim_context_t *ctx, int l)
+{
+	int r;
+
+	load_latch(&s->if_id, &ctx->if_id, l);
+	load_latch(&s->id_ex, &ctx->id_ex, l);
+	load_latch(&s->ex_mem, &ctx->ex_mem, l);
+	load_latch(&s->mem_wb, &ctx->mem_wb, l);
+	s->pc[l] = ctx->current.PC;
+	s->stall[l] = ctx->stall;
+	s->count[l] = ctx->current.CP0[CP0_COUNT];
+	s->compare[l] = ctx->current.CP0[CP0_COMPARE];
+	s->cause[l] = ctx->current.CP0[CP0_CAUSE];
+	s->instructions[l] = ctx->instruction_count;
+	s->cycles[l] = ctx->cycle_count;
+	s->latency_stalls[l] = ctx->latency_stalls;
+	for (r = 0; r < NUM_ACTIVITY; r++) {
+		s->activity[r][l] = 0;
+	}
+	for (r = 0; r < MIPS_REGS; r++) {
+		s->regs[r][l] = ctx->current.REGS[r];
+	}
+	s->active[l] = 0xFFFFFFFF;
+}
+
+static void flush_activity(wide_state_t *s, wide_lane_t *lanes, int n)
+{
+	int i, l;
+
+	for (l = 0; l < n; l++) {
+		if (s->active[l]) {
+			for (i = 0; i < NUM_ACTIVITY; i++) {
+				lanes[l].context->activity[i] += s->activity[i][l];
+			}
+		}
+	}
+	memset(s->activity, 0, sizeof(s->activity));
+}
+
+static void export_lane(wide_state_t *s, wide_lane_t *lane, int l)
+{
+	sim_context_t *ctx = lane->context;
+	int r;
+
+	store_latch(&ctx->if_id, &s->if_id, l);
+	store_latch(&ctx->id_ex, &s->id_ex, l);
+	store_latch(&ctx->ex_mem, &s->ex_mem, l);
+	store_latch(&ctx->mem_wb, &s->mem_wb, l);
+	ctx->current.PC = s->pc[l];
+	ctx->stall = s->stall[l];
+	ctx->current.CP0[CP0_COUNT] = s->count[l];
+	ctx->current.CP0[CP0_CAUSE] = s->cause[l];
+	ctx->instruction_count = s->instructions[l];
+	ctx->cycle_count = s->cycles[l];
+	ctx->latency_stalls = s->latency_stalls[l];
+	for (r = 0; r < NUM_ACTIVITY; r++) {
+		ctx->activity[r] += s->activity[r][l];
+		s->activity[r][l] = 0;
+	}
+	for (r = 0; r < MIPS_REGS; r++) {
+		ctx->current.REGS[r] = s->regs[r][l];
+	}
+	s->active[l] = 0;
+}
+
+/***************************************************************/
+/* Add the bits that changed in each lane, as count_latch_toggles()    */
+/* does for one pipeline. Vectors go by pointer to keep the ABI plain.  */
+/***************************************************************/
+static void add_toggles(wide_t *sum, const wide_t *before, const wide_t *after)
+{
+	wide_t x = *before ^ *after;
+
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0F0F0F0F;
+	*sum += (x * 0x01010101) >> 24;
+}
+
+static void latch_toggles(wide_t *sum, const wide_latch_t *a, const wide_latch_t *b)
+{
+	add_toggles(sum, &a->PC, &b->PC);
+	add_toggles(sum, &a->IR, &b->IR);
+	add_toggles(sum, &a->A, &b->A);
+	add_toggles(sum, &a->B, &b->B);
+	add_toggles(sum, &a->imm, &b->imm);
+	add_toggles(sum, &a->ALUOutput, &b->ALUOutput);
+	add_toggles(sum, &a->LMD, &b->LMD);
+}
+
+/***************************************************************/
+/* Lanes that would leave the common path this cycle go back to the   */
+/* caller now, at a cycle boundary. fetch gets the word IF will read    */
+/* and fetch_info its decode_info(). Fetches from .text and accesses to  */
+/* .text or .data are checked on vectors; anything else goes through     */
+/* mem_mapped() one lane at a time.                                                       */
+/***************************************************************/
+static void check_lanes(wide_state_t *s, wide_lane_t *lanes, int n, uint32_t *fetch, uint32_t *fetch_info,
+	uint32_t done)
+{
+	const mem_region_t *text = &MEM_REGIONS[0], *data = &MEM_REGIONS[MEM_DATA_REGION];
+	const wide_latch_t *d = &s->id_ex, *e = &s->ex_mem;
+	wide_t op = (d->info >> INFO_OP_SHIFT) & 0xFF, operand, sum, diff, overflow;
+	wide_t ls, addr, mem_op, in_text, slow;
+	uint32_t pc, word;
+	int l;
+
+	/* the overflow checks EX makes on OP_ADD and OP_SUB */
+	operand = BLEND(MASK((d->IR >> 26) == 0), d->B, d->imm);
+	sum = d->A + operand;
+	diff = d->A - operand;
+	overflow = (MASK(op == OP_ADD) & ~(d->A ^ operand) & (d->A ^ sum)) |
+		(MASK(op == OP_SUB) & (d->A ^ operand) & (d->A ^ diff));
+	overflow = MASK((overflow & 0x80000000) != 0) & MASK(d->stall == 0) & MASK(d->IR != 0);
+
+	/* MEM's alignment and mapping checks, and stores over the next fetch */
+	mem_op = e->IR >> 26;
+	ls = MASK(e->stall != 1) & (MASK(mem_op == 0x20) | MASK(mem_op == 0x21) | MASK(mem_op == 0x23) |
+		MASK(mem_op == 0x28) | MASK(mem_op == 0x29) | MASK(mem_op == 0x2B));
+	addr = e->ALUOutput;
+	in_text = MASK(s->pc - text->begin <= text->end - 3 - text->begin) & MASK((s->pc & 0x3) == 0);
+	slow = overflow | ~in_text | (ls & (MASK((addr & mem_op & 0x3) != 0) |
+		~(MASK(addr - text->begin <= text->end - 3 - text->begin) | MASK(addr - data->begin <= data->end - 3 - data->begin)) |
+		(MASK((mem_op & 0x08) != 0) & MASK(addr - s->pc + 3 <= 6))));
+
+	for (l = 0; l < n; l++) {
+		if (!s->active[l]) {
+			continue;
+		}
+		pc = s->pc[l];
+		if (slow[l]) {
+			if (overflow[l] || (pc & 0x3) || !mem_mapped(pc, 4)) {
+				goto eject;
+			}
+			if (ls[l]) {
+				if ((addr[l] & mem_op[l] & 0x3) || !mem_mapped(addr[l], (mem_op[l] & 0x3) + 1)) {
+					goto eject;
+				}
+				if ((mem_op[l] & 0x08) && addr[l] + 3 >= pc && addr[l] <= pc + 3) {
+					goto eject;	/* self-modifying store: IF would see the new word */
+				}
+			}
+			word = lane_read(&lanes[l], pc, 4);
+		}
+		else {
+			word = read_word(lanes[l].mem[0] + (pc - text->begin));
+		}
+		fetch_info[l] = decode_info(word);
+		if (fetch_info[l] & INFO_SPECIAL) {
+			goto eject;
+		}
+		fetch[l] = word;
+		continue;
+eject:
+		lanes[l].cycles = done;
+		export_lane(s, &lanes[l], l);
+	}
+}
+
+/***************************************************************/
+/* Run up to cycles cycles on every lane. A lane stops early when it    */
+/* needs the normal pipeline; lanes[l].cycles says how far it got.       */
+/***************************************************************/
+void wide_run(wide_lane_t *lanes, int n, uint32_t cycles, int forwarding, int activity,
+	void (*store)(void *owner, uint32_t address, uint32_t value, uint32_t size))
+{
+	wide_state_t state, *s = &state;
+	wide_latch_t before[4];
+	wide_t sample, wb, run, alu, bubble, keep, go, op, rs, rt, rd, ls, hazard, fa, fb, busy, fresh;
+	wide_t stall_ex_mem, stall_mem_wb, forward_stall, forward_stall_mem_wb, load_stall, bits, dest, value, a, b;
+	uint32_t fetch[WIDE_LANES], fetch_info[WIDE_LANES], c;
+	int l, any, sampled, use_forward, use_forward_mem_wb, any_busy, i;
+
+	memset(&state, 0, sizeof(state));	/* on the stack: vectors need their alignment */
+	build_info_table();
+	for (l = 0; l < n; l++) {
+		import_lane(s, lanes[l].context, l);
+		lanes[l].cycles = cycles;
+	}
+	use_forward = forwarding == 1 && (MACHINE.forward & FWD_EX_MEM);
+	use_forward_mem_wb = forwarding == 1 && (MACHINE.forward & FWD_MEM_WB);
+	stall_ex_mem = (wide_t){ 0 } + MACHINE.stall_ex_mem;
+	stall_mem_wb = (wide_t){ 0 } + MACHINE.stall_mem_wb;
+	forward_stall = (wide_t){ 0 } + MACHINE.forward_stall_ex_mem;
+	forward_stall_mem_wb = (wide_t){ 0 } + MACHINE.forward_stall_mem_wb;
+	load_stall = (wide_t){ 0 } + MACHINE.load_stall;
+	any_busy = 0;
+	for (i = 0; i < NUM_UNITS; i++) {
+		any_busy |= MACHINE.latency[i] > 1;
+	}
+
+	for (c = 0; c < cycles; c++) {
+		if (c % WIDE_CHUNK == 0 && activity) {
+			flush_activity(s, lanes, n);
+		}
+		check_lanes(s, lanes, n, fetch, fetch_info, c);
+		any = 0;
+		for (l = 0; l < n; l++) {
+			any |= s->active[l] != 0;
+		}
+		if (!any) {
+			break;
+		}
+
+		sample = MASK((s->cycles & (LATCH_SAMPLE_CYCLES - 1)) == 0) & s->active;
+		sampled = 0;
+		for (l = 0; l < n && activity; l++) {
+			sampled |= sample[l] != 0;
+		}
+		if (sampled) {
+			before[0] = s->if_id;
+			before[1] = s->id_ex;
+			before[2] = s->ex_mem;
+			before[3] = s->mem_wb;
+		}
+
+		/* start of the cycle: stall countdown and the CP0 timer */
+		s->stall += MASK(s->stall != 0);
+		s->count += 1;
+		s->cause |= MASK(s->count == s->compare) & CAUSE_IP7;
+
+		/* WB */
+		{
+			wide_latch_t *m = &s->mem_wb;
+			wide_t kind = (m->info >> INFO_WB_SHIFT) & INFO_WB_MASK;
+
+			wb = MASK(m->stall != 1) & s->active;
+			s->instructions -= wb & MASK(m->IR != 0);
+			if (activity) {
+				s->activity[ACT_RF_WRITE] -= wb & MASK(kind != WB_NONE);
+			}
+			dest = BLEND(wb & MASK(kind != WB_NONE) & MASK(m->RegisterRD != 0), m->RegisterRD,
+				(wide_t){ 0 } + MIPS_REGS);
+			value = BLEND(MASK(kind == WB_LMD), m->LMD, m->ALUOutput);
+			for (l = 0; l < n; l++) {
+				s->regs[dest[l]][l] = value[l];
+			}
+		}
+
+		/* MEM */
+		{
+			wide_latch_t *e = &s->ex_mem, *m = &s->mem_wb;
+
+			run = MASK(e->stall != 1);
+			m->stall = ~run & 1;
+			m->RegWrite = run & e->RegWrite;
+			m->IR = BLEND(run, e->IR, m->IR);
+			m->PC = BLEND(run, e->PC, m->PC);
+			m->A = BLEND(run, e->A, m->A);
+			m->B = BLEND(run, e->B, m->B);
+			m->imm = BLEND(run, e->imm, m->imm);
+			m->ALUOutput = BLEND(run, e->ALUOutput, m->ALUOutput);
+			m->LMD &= ~run;
+			m->RegisterRD = BLEND(run, e->RegisterRD, m->RegisterRD);
+			m->RegisterRT = BLEND(run, e->RegisterRT, m->RegisterRT);
+			m->RegisterRS = BLEND(run, e->RegisterRS, m->RegisterRS);
+			m->Exception = BLEND(run, e->Exception, m->Exception);
+			m->BadVAddr = BLEND(run, e->BadVAddr, m->BadVAddr);
+			m->info = BLEND(run, e->info, m->info);
+
+			op = m->IR >> 26;
+			ls = run & s->active & (MASK(op == 0x20) | MASK(op == 0x21) | MASK(op == 0x23) |
+				MASK(op == 0x28) | MASK(op == 0x29) | MASK(op == 0x2B));
+			if (activity) {
+				s->activity[ACT_MEM_READ] -= ls & MASK((op & 0x08) == 0);
+				s->activity[ACT_MEM_WRITE] -= ls & MASK((op & 0x08) != 0);
+			}
+			for (l = 0; l < n; l++) {
+				if (!ls[l]) {
+					continue;
+				}
+				switch (op[l]) {
+					case 0x20:
+						m->LMD[l] = (int8_t)lane_read(&lanes[l], m->ALUOutput[l], 1);
+						break;
+					case 0x21:
+						m->LMD[l] = (int16_t)lane_read(&lanes[l], m->ALUOutput[l], 2);
+						break;
+					case 0x23:
+						m->LMD[l] = lane_read(&lanes[l], m->ALUOutput[l], 4);
+						break;
+					default:
+						store(lanes[l].owner, m->ALUOutput[l], m->B[l], (op[l] & 0x3) + 1);
+						break;
+				}
+			}
+		}
+
+		/* EX */
+		{
+			wide_latch_t *d = &s->id_ex, *e = &s->ex_mem;
+			wide_t result, sa;
+
+			bubble = MASK(d->stall == 1);
+			run = MASK(d->stall == 0);
+			keep = ~(bubble | run);	/* a longer stall leaves EX/MEM alone, a bubble clears it */
+			e->IR = (run & d->IR) | (keep & e->IR);
+			e->PC = (run & d->PC) | (keep & e->PC);
+			e->A = (run & d->A) | (keep & e->A);
+			e->B = (run & d->B) | (keep & e->B);
+			e->imm = (run & d->imm) | (keep & e->imm);
+			e->RegisterRS = (run & d->RegisterRS) | (keep & e->RegisterRS);
+			e->RegisterRT = (run & d->RegisterRT) | (keep & e->RegisterRT);
+			e->RegisterRD = (run & d->RegisterRD) | (keep & e->RegisterRD);
+			e->RegWrite = (run & d->RegWrite) | (keep & e->RegWrite);
+			e->Exception = (run & d->Exception) | (keep & e->Exception);
+			e->info = (run & d->info) | (keep & e->info);
+			e->stall = BLEND(bubble, (wide_t){ 0 } + 1, BLEND(run, d->stall, e->stall));
+			e->Mem = BLEND(run, d->Mem, e->Mem);
+			e->BadVAddr = BLEND(run, d->BadVAddr, e->BadVAddr);
+
+			alu = run & MASK(d->IR != 0) & s->active;
+			if (activity) {
+				s->activity[ACT_ALU] -= alu;
+			}
+			op = (d->info >> INFO_OP_SHIFT) & 0xFF;
+			b = BLEND(MASK((d->IR >> 26) == 0), d->B, d->imm);
+			sa = BLEND(MASK((d->IR & 0x04) != 0), d->A & 0x1F, (d->IR >> 6) & 0x1F);
+			result = ((MASK(op == OP_ADD) | MASK(op == OP_ADDU)) & (d->A + b)) |
+				((MASK(op == OP_SUB) | MASK(op == OP_SUBU)) & (d->A - b)) |
+				(MASK(op == OP_AND) & (d->A & b)) |
+				(MASK(op == OP_OR) & (d->A | b)) |
+				(MASK(op == OP_XOR) & (d->A ^ b)) |
+				(MASK(op == OP_NOR) & ~(d->A | b)) |
+				(MASK(op == OP_SLT) & MASK((wide_signed_t)d->A < (wide_signed_t)b) & 1) |
+				(MASK(op == OP_SLTU) & MASK(d->A < b) & 1) |
+				(MASK(op == OP_SLL) & (d->B << sa)) |
+				(MASK(op == OP_SRL) & (d->B >> sa)) |
+				(MASK(op == OP_SRA) & (wide_t)((wide_signed_t)d->B >> (wide_signed_t)sa)) |
+				(MASK(op == OP_LUI) & (d->imm << 16)) |
+				((MASK(op == OP_LOAD) | MASK(op == OP_STORE)) & (d->A + d->imm));
+			e->ALUOutput = (alu & result) | (keep & e->ALUOutput);
+		}
+
+		/* ID, with ForwardData; a held lane keeps IF/ID and sends a bubble */
+		{
+			wide_latch_t *f = &s->if_id, *d = &s->id_ex, *e = &s->ex_mem, *m = &s->mem_wb;
+			wide_t kind, read_rs, read_rt, imm, ex_write, ex_load, mem_write, ma, mb, wait;
+
+			run = MASK(s->stall == 0);
+			kind = (f->info >> INFO_WB_SHIFT) & INFO_WB_MASK;
+			read_rs = MASK((f->info & INFO_READS_RS) != 0);
+			read_rt = MASK((f->info & INFO_READS_RT) != 0);
+			rs = (f->IR >> 21) & 0x1F & read_rs;
+			rt = (f->IR >> 16) & 0x1F & read_rt;
+			rd = BLEND(MASK(kind == WB_RD), (f->IR >> 11) & 0x1F, (f->IR >> 16) & 0x1F) & MASK(kind != WB_NONE);
+			imm = f->IR & 0xFFFF;
+			imm |= MASK((f->info & INFO_IMM_ZERO) == 0) & MASK((imm >> 15) == 1) & 0xFFFF0000;
+			imm &= MASK((f->IR >> 26) != 0);
+
+			d->IR = BLEND(run, f->IR, d->IR);
+			d->PC = BLEND(run, f->PC, d->PC);
+			d->Exception = BLEND(run, f->Exception, d->Exception);
+			d->BadVAddr = BLEND(run, f->BadVAddr, d->BadVAddr);
+			d->info = BLEND(run, f->info, d->info);
+			d->RegisterRS = BLEND(run, rs, d->RegisterRS);
+			d->RegisterRT = BLEND(run, rt, d->RegisterRT);
+			d->RegisterRD = BLEND(run, rd, d->RegisterRD);
+			d->RegWrite = BLEND(run, MASK(kind != WB_NONE) & 1, d->RegWrite);
+			d->imm = BLEND(run, imm, d->imm);
+			for (l = 0; l < n; l++) {
+				a[l] = s->regs[rs[l]][l];
+				b[l] = s->regs[rt[l]][l];
+			}
+			d->A = BLEND(run, a, d->A);
+			d->B = BLEND(run, b, d->B);
+			if (activity) {
+				s->activity[ACT_RF_READ] -= run & (read_rs + read_rt);
+			}
+
+			ex_write = MASK(e->RegWrite != 0) & MASK(e->RegisterRD != 0);
+			fa = run & ex_write & MASK(e->RegisterRD == d->RegisterRS);
+			fb = run & ex_write & MASK(e->RegisterRD == d->RegisterRT);
+			mem_write = MASK(m->RegWrite != 0) & MASK(m->RegisterRD != 0);
+			ma = run & ~fa & mem_write & MASK(m->RegisterRD == d->RegisterRS);
+			mb = run & ~fb & mem_write & MASK(m->RegisterRD == d->RegisterRT);
+			op = e->IR >> 26;
+			ex_load = MASK(op == 0x20) | MASK(op == 0x21) | MASK(op == 0x23);
+			hazard = fa | fb;
+			if (use_forward) {
+				wait = BLEND(ex_load, load_stall, forward_stall);
+				fa &= ~ex_load;
+				fb &= ~ex_load;
+			}
+			else {
+				wait = stall_ex_mem;
+				fa = fb = (wide_t){ 0 };
+			}
+			s->stall = BLEND(hazard & MASK(s->stall < wait), wait, s->stall);
+			hazard = ma | mb;
+			wait = use_forward_mem_wb ? forward_stall_mem_wb : stall_mem_wb;
+			s->stall = BLEND(hazard & MASK(s->stall < wait), wait, s->stall);
+			if (!use_forward_mem_wb) {
+				ma = mb = (wide_t){ 0 };
+			}
+			if (any_busy) {
+				busy = (e->info >> INFO_BUSY_SHIFT) & 0xFF;
+				fresh = run & MASK(s->stall < busy);
+				s->latency_stalls += fresh & (busy - s->stall);
+				s->stall = BLEND(fresh, busy, s->stall);
+			}
+			d->stall = MASK(s->stall != 0) & 1;
+			if (activity) {
+				s->activity[ACT_FORWARD] -= fa | ma;
+				s->activity[ACT_FORWARD] -= fb | mb;
+			}
+			d->A = BLEND(fa, e->ALUOutput, d->A);
+			d->B = BLEND(fb, e->ALUOutput, d->B);
+			op = m->IR >> 26;
+			value = BLEND(MASK(op == 0x20) | MASK(op == 0x21) | MASK(op == 0x23), m->LMD, m->ALUOutput);
+			d->A = BLEND(ma, value, d->A);
+			d->B = BLEND(mb, value, d->B);
+		}
+
+		/* IF */
+		{
+			wide_latch_t *f = &s->if_id;
+
+			go = MASK(s->stall == 0) & s->active;
+			for (l = 0; l < n; l++) {
+				if (go[l]) {
+					f->IR[l] = fetch[l];
+					f->info[l] = fetch_info[l];
+				}
+			}
+			f->Exception &= ~go;
+			f->PC = BLEND(go, s->pc + 4, f->PC);
+			s->pc = BLEND(go, s->pc + 4, s->pc);
+			if (activity) {
+				s->activity[ACT_FETCH] -= go;
+			}
+		}
+
+		if (sampled) {
+			bits = (wide_t){ 0 };
+			latch_toggles(&bits, &before[0], &s->if_id);
+			latch_toggles(&bits, &before[1], &s->id_ex);
+			latch_toggles(&bits, &before[2], &s->ex_mem);
+			latch_toggles(&bits, &before[3], &s->mem_wb);
+			s->activity[ACT_LATCH] += sample & (bits * LATCH_SAMPLE_CYCLES);
+		}
+		s->cycles += 1;
+	}
+	for (l = 0; l < n; l++) {
+		if (s->active[l]) {
+			export_lane(s, &lanes[l], l);
+		}
+	}
+}
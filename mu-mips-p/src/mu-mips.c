@@ -3,9 +3,79 @@
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "mu-mips.h"
 
+/* memory will be dynamically allocated at initialization */
+mem_region_t MEM_REGIONS[NUM_MEM_REGION] = {
+	{ MEM_TEXT_BEGIN, MEM_TEXT_END, NULL },
+	{ MEM_EXTERN_BEGIN, MEM_DATA_END, NULL },
+	{ MEM_STACK_END, MEM_STACK_BEGIN, NULL },
+	{ MEM_KDATA_BEGIN, MEM_KDATA_END, NULL },
+	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, NULL }
+};
+
+file_map_t FILE_MAPS[MAX_FILE_MAPS];
+int NUM_FILE_MAPS = 0;
+
+CPU_State CURRENT_STATE, NEXT_STATE;
+uint32_t REGS_DIRTY = 0;
+uint32_t CP0_DIRTY = 0;
+int RUN_FLAG;
+uint32_t INSTRUCTION_COUNT;
+uint32_t CYCLE_COUNT;
+uint32_t PROGRAM_SIZE;
+
+CPU_Pipeline_Reg IF_ID;
+CPU_Pipeline_Reg ID_EX;
+CPU_Pipeline_Reg EX_MEM;
+CPU_Pipeline_Reg MEM_WB;
+
+char prog_file[256];
+char kernel_file[256];
+int WATCH_PROGRAM = 0;
+struct timespec PROGRAM_MTIME;	/* of prog_file when it was last loaded */
+
+int ENABLE_FORWARDING = 0;
+int TRACE_ENABLED = 1;
+
+uint32_t KERNEL_SIZE = 0;
+uint32_t EXCEPTION_COUNT[NUM_EXC_CODES];
+uint32_t KERNEL_CYCLES = 0;
+uint32_t FLUSHED_COUNT = 0;
+int UNHANDLED_EXCEPTION = 0;
+
+uint32_t MEM_FAULT_COUNT = 0;
+uint32_t MEM_FAULT_ADDRESS = 0;
+uint32_t STACK_LOW = MEM_STACK_BEGIN + 1;
+int DIRTY_TRACKING = 0;
+uint8_t *DIRTY_MAP = NULL;
+uint32_t *DIRTY_LIST = NULL;
+uint32_t NUM_DIRTY = 0;
+uint32_t MAX_DIRTY = 0;
+
+breakpoint_t BREAKPOINTS[BREAK_TABLE_SIZE];
+int NUM_BREAKPOINTS = 0;
+watchpoint_t WATCHPOINTS[MAX_WATCHPOINTS];
+int NUM_WATCHPOINTS = 0;
+uint8_t WATCH_PAGES[1 << (32 - WATCH_PAGE_SHIFT - 3)];
+int BREAK_FLAG = 0;
+
+snapshot_t SNAPSHOTS[MAX_SNAPSHOTS];
+int NUM_SNAPSHOTS = 0;
+int RECORDING = 0;
+int REPLAYING = 0;
+uint32_t SNAPSHOT_INTERVAL = SNAPSHOT_INTERVAL_MIN;
+uint32_t SNAPSHOT_EPOCH = 0;
+uint32_t *PAGE_EPOCH = NULL;
+uint32_t *PAGE_MERGE_MARK = NULL;
+uint32_t MERGE_GENERATION = 0;
+uint64_t UNDO_BYTES = 0;
+
 int stall = 0;
 int ForwardA = 0;
 int ForwardB = 0;
@@ -13,28 +83,6 @@ int loadStallA = 0;
 int loadStallB = 0;
 int loadStall = 0;
 
-/***************************************************************/
-/* Print out a list of commands available                                                                  */
-/***************************************************************/
-void help() {        
-	printf("------------------------------------------------------------------\n\n");
-	printf("\t**********MU-MIPS Help MENU**********\n\n");
-	printf("sim\t-- simulate program to completion \n");
-	printf("run <n>\t-- simulate program for <n> instructions\n");
-	printf("rdump\t-- dump register values\n");
-	printf("reset\t-- clears all registers/memory and re-loads the program\n");
-	printf("input <reg> <val>\t-- set GPR <reg> to <val>\n");
-	printf("mdump <start> <stop>\t-- dump memory from <start> to <stop> address\n");
-	printf("high <val>\t-- set the HI register to <val>\n");
-	printf("low <val>\t-- set the LO register to <val>\n");
-	printf("print\t-- print the program loaded into memory\n");
-	printf("show\t-- print the current content of the pipeline registers\n");
-	printf("forward\t-- enable or disable forwarding\n");
-	printf("?\t-- display help menu\n");
-	printf("quit\t-- exit the simulator\n\n");
-	printf("------------------------------------------------------------------\n\n");
-}
-
 /***************************************************************/
 /* Read a 32-bit word from memory                                                                            */
 /***************************************************************/
@@ -43,6 +91,9 @@ uint32_t mem_read_32(uint32_t address)
 	int i;
 	for (i = 0; i < NUM_MEM_REGION; i++) {
 		if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
+			if (address > MEM_REGIONS[i].end - 3) {
+				break;	/* word would run past the end of the region */
+			}
 			uint32_t offset = address - MEM_REGIONS[i].begin;
 			return (MEM_REGIONS[i].mem[offset+3] << 24) |
 					(MEM_REGIONS[i].mem[offset+2] << 16) |
@@ -50,6 +101,7 @@ uint32_t mem_read_32(uint32_t address)
 					(MEM_REGIONS[i].mem[offset+0] <<  0);
 		}
 	}
+	mem_fault(address);
 	return 0;
 }
 
@@ -62,23 +114,259 @@ void mem_write_32(uint32_t address, uint32_t value)
 	uint32_t offset;
 	for (i = 0; i < NUM_MEM_REGION; i++) {
 		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
+			if (address > MEM_REGIONS[i].end - 3) {
+				break;	/* word would run past the end of the region */
+			}
+			if (RECORDING) {
+				record_page(address);
+				record_page(address + 3);
+			}
+			if (DIRTY_TRACKING) {
+				mark_dirty(address);
+				mark_dirty(address + 3);
+			}
+			if (i == MEM_STACK_REGION && address < STACK_LOW) {
+				STACK_LOW = address;
+			}
 			offset = address - MEM_REGIONS[i].begin;
 
 			MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
 			MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
 			MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
 			MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+			return;
+		}
+	}
+	mem_fault(address);
+}
+
+/***************************************************************/
+/* Read a byte or halfword from memory, zero-extended                          */
+/***************************************************************/
+static uint32_t mem_read_narrow(uint32_t address, uint32_t size)
+{
+	uint32_t avail;
+	uint8_t *ptr = mem_host_ptr(address, &avail);
+
+	if (ptr == NULL || avail < size) {
+		mem_fault(address);
+		return 0;
+	}
+	return (size == 1) ? ptr[0] : (ptr[0] | (ptr[1] << 8));
+}
+
+uint32_t mem_read_8(uint32_t address)
+{
+	return mem_read_narrow(address, 1);
+}
+
+uint32_t mem_read_16(uint32_t address)
+{
+	return mem_read_narrow(address, 2);
+}
+
+/***************************************************************/
+/* Write the low byte or halfword of value; the rest of the word keeps */
+/* what memory held                                                                                           */
+/***************************************************************/
+static void mem_write_narrow(uint32_t address, uint32_t value, uint32_t size)
+{
+	uint32_t avail;
+	uint8_t *ptr = mem_host_ptr(address, &avail);
+
+	if (ptr == NULL || avail < size) {
+		mem_fault(address);
+		return;
+	}
+	if (RECORDING) {
+		record_page(address);
+		record_page(address + size - 1);
+	}
+	if (DIRTY_TRACKING) {
+		mark_dirty(address);
+		mark_dirty(address + size - 1);
+	}
+	if (address >= MEM_STACK_END && address <= MEM_STACK_BEGIN && address < STACK_LOW) {
+		STACK_LOW = address;
+	}
+	ptr[0] = value & 0xFF;
+	if (size == 2) {
+		ptr[1] = (value >> 8) & 0xFF;
+	}
+}
+
+void mem_write_8(uint32_t address, uint32_t value)
+{
+	mem_write_narrow(address, value, 1);
+}
+
+void mem_write_16(uint32_t address, uint32_t value)
+{
+	mem_write_narrow(address, value, 2);
+}
+
+/***************************************************************/
+/* Copy bytes out of guest memory, up to the end of the region             */
+/***************************************************************/
+uint32_t mem_read_bytes(uint32_t address, uint8_t *data, uint32_t len)
+{
+	uint32_t avail;
+	uint8_t *ptr = mem_host_ptr(address, &avail);
+
+	if (ptr == NULL) {
+		mem_fault(address);
+		return 0;
+	}
+	if (len > avail) {
+		len = avail;
+	}
+	memcpy(data, ptr, len);
+	return len;
+}
+
+/***************************************************************/
+/* Copy bytes into guest memory, up to the end of the region                 */
+/***************************************************************/
+uint32_t mem_write_bytes(uint32_t address, const uint8_t *data, uint32_t len)
+{
+	uint32_t avail, page;
+	uint8_t *ptr = mem_host_ptr(address, &avail);
+
+	if (ptr == NULL) {
+		mem_fault(address);
+		return 0;
+	}
+	if (len > avail) {
+		len = avail;
+	}
+	/* undo and dirty tracking both work on 4 KB pages */
+	for (page = address >> UNDO_PAGE_SHIFT; len != 0 && page <= (address + len - 1) >> UNDO_PAGE_SHIFT; page++) {
+		if (RECORDING) {
+			record_page(page << UNDO_PAGE_SHIFT);
+		}
+		if (DIRTY_TRACKING) {
+			mark_dirty(page << UNDO_PAGE_SHIFT);
+		}
+	}
+	if (address >= MEM_STACK_END && address <= MEM_STACK_BEGIN && address < STACK_LOW) {
+		STACK_LOW = address;
+	}
+	memcpy(ptr, data, len);
+	return len;
+}
+
+/***************************************************************/
+/* Note an access outside every region (reads as 0, writes are dropped) */
+/***************************************************************/
+void mem_fault(uint32_t address)
+{
+	MEM_FAULT_COUNT++;
+	MEM_FAULT_ADDRESS = address;
+}
+
+/***************************************************************/
+/* Do the size bytes at address lie inside one region                                        */
+/***************************************************************/
+int mem_mapped(uint32_t address, uint32_t size)
+{
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if (address >= MEM_REGIONS[i].begin && address <= MEM_REGIONS[i].end - (size - 1)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/***************************************************************/
+/* Start tracking written pages so memory can be reset in O(dirty)          */
+/***************************************************************/
+int enable_dirty_tracking()
+{
+	if (DIRTY_MAP == NULL) {
+		DIRTY_MAP = calloc((size_t)1 << (32 - DIRTY_PAGE_SHIFT - 3), 1);
+		if (DIRTY_MAP == NULL) {
+			return -1;
+		}
+	}
+	DIRTY_TRACKING = 1;
+	return 0;
+}
+
+/***************************************************************/
+/* Remember the page holding address                                                                  */
+/***************************************************************/
+void mark_dirty(uint32_t address)
+{
+	uint32_t page = address >> DIRTY_PAGE_SHIFT;
+	uint32_t *grown;
+
+	if (DIRTY_MAP[page >> 3] & (1 << (page & 7))) {
+		return;
+	}
+	if (NUM_DIRTY == MAX_DIRTY) {
+		grown = realloc(DIRTY_LIST, (MAX_DIRTY ? MAX_DIRTY * 2 : 64) * sizeof(uint32_t));
+		if (grown == NULL) {
+			return;	/* page stays unmarked; reset_dirty_pages falls short */
+		}
+		DIRTY_LIST = grown;
+		MAX_DIRTY = MAX_DIRTY ? MAX_DIRTY * 2 : 64;
+	}
+	DIRTY_MAP[page >> 3] |= 1 << (page & 7);
+	DIRTY_LIST[NUM_DIRTY++] = page;
+}
+
+/***************************************************************/
+/* Zero every page written since the last call                                                     */
+/***************************************************************/
+void reset_dirty_pages()
+{
+	uint32_t i, page, avail;
+	uint8_t *ptr;
+
+	for (i = 0; i < NUM_DIRTY; i++) {
+		page = DIRTY_LIST[i];
+		ptr = mem_host_ptr(page << DIRTY_PAGE_SHIFT, &avail);
+		if (ptr != NULL) {
+			memset(ptr, 0, 1 << DIRTY_PAGE_SHIFT);
 		}
+		DIRTY_MAP[page >> 3] &= ~(1 << (page & 7));
 	}
+	NUM_DIRTY = 0;
 }
 
 /***************************************************************/
 /* Execute one cycle                                                                                                              */
 /***************************************************************/
 void cycle() {                                                
-	handle_pipeline();
-	CURRENT_STATE = NEXT_STATE;
+	PIPELINE->handle_pipeline();
+	commit_state();
 	CYCLE_COUNT++;
+	if (RECORDING && CYCLE_COUNT - SNAPSHOTS[NUM_SNAPSHOTS-1].context.cycle_count >= SNAPSHOT_INTERVAL) {
+		take_snapshot();
+	}
+}
+
+/***************************************************************/
+/* End of cycle: make what the stages wrote to NEXT_STATE current             */
+/***************************************************************/
+void commit_state() {
+	uint32_t dirty;
+	int i;
+
+	CURRENT_STATE.PC = NEXT_STATE.PC;
+	CURRENT_STATE.HI = NEXT_STATE.HI;
+	CURRENT_STATE.LO = NEXT_STATE.LO;
+	for (dirty = REGS_DIRTY; dirty != 0; dirty &= dirty - 1) {
+		i = __builtin_ctz(dirty);
+		CURRENT_STATE.REGS[i] = NEXT_STATE.REGS[i];
+	}
+	for (dirty = CP0_DIRTY; dirty != 0; dirty &= dirty - 1) {
+		i = __builtin_ctz(dirty);
+		CURRENT_STATE.CP0[i] = NEXT_STATE.CP0[i];
+	}
+	REGS_DIRTY = 0;
+	CP0_DIRTY = 0;
 }
 
 /***************************************************************/
@@ -93,13 +381,25 @@ void run(int num_cycles) {
 
 	printf("Running simulator for %d cycles...\n\n", num_cycles);
 	int i;
+	select_pipeline();
 	for (i = 0; i < num_cycles; i++) {
 		if (RUN_FLAG == FALSE) {
+			flush_guest_output();
+			if (UNHANDLED_EXCEPTION) {
+				print_unhandled_exception();
+			}
 			printf("Simulation Stopped.\n\n");
 			break;
 		}
 		cycle();
+		if (BREAK_FLAG) {
+			BREAK_FLAG = 0;
+			flush_guest_output();
+			printf("Simulation Paused.\n\n");
+			break;
+		}
 	}
+	flush_guest_output();
 }
 
 /***************************************************************/
@@ -112,10 +412,34 @@ void runAll() {
 	}
 
 	printf("Simulation Started...\n\n");
+	select_pipeline();
 	while (RUN_FLAG){
 		cycle();
+		if (BREAK_FLAG) {
+			BREAK_FLAG = 0;
+			flush_guest_output();
+			printf("Simulation Paused.\n\n");
+			return;
+		}
+	}
+	flush_guest_output();
+	if (UNHANDLED_EXCEPTION) {
+		print_unhandled_exception();
+		printf("Simulation Stopped.\n\n");
+		print_footprint();
+		return;
 	}
 	printf("Simulation Finished.\n\n");
+	print_footprint();
+}
+
+/***************************************************************/
+/* Peak stack and heap use of the run, if the program used either          */
+/***************************************************************/
+void print_footprint() {
+	if (STACK_LOW <= MEM_STACK_BEGIN || HEAP_PEAK != HEAP_BASE) {
+		printf("Peak stack %u bytes, peak heap %u bytes\n\n", MEM_STACK_BEGIN + 1 - STACK_LOW, HEAP_PEAK - HEAP_BASE);
+	}
 }
 
 /***************************************************************/ 
@@ -134,6 +458,229 @@ void mdump(uint32_t start, uint32_t stop) {
 	printf("\n");
 }
 
+/***************************************************************/
+/* Host pointer for a guest address and the bytes left in its region      */
+/***************************************************************/
+uint8_t *mem_host_ptr(uint32_t address, uint32_t *avail) {
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
+			*avail = MEM_REGIONS[i].end - address + 1;
+			return MEM_REGIONS[i].mem + (address - MEM_REGIONS[i].begin);
+		}
+	}
+	*avail = 0;
+	return NULL;
+}
+
+/***************************************************************/ 
+/* Dump memory to the terminal, one line per run of zero words              */
+/***************************************************************/
+void mdump_rle(uint32_t start, uint32_t stop) {
+	uint64_t address = start, end = (uint64_t)stop + 4;
+	uint64_t zero_start = 0;
+	uint32_t avail, value;
+	uint8_t *ptr;
+	int in_zero_run = 0;
+
+	printf("-------------------------------------------------------------\n");
+	printf("Memory content [0x%08x..0x%08x] :\n", start, stop);
+	printf("-------------------------------------------------------------\n");
+	printf("\t[Address in Hex (Dec) ]\t[Value]\n");
+	while (address < end) {
+		ptr = mem_host_ptr(address, &avail);
+		/* unmapped addresses read as zero, same as mem_read_32 */
+		if (ptr == NULL || avail < 4) {
+			value = 0;
+		}else {
+			value = ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+		}
+
+		if (value == 0) {
+			if (!in_zero_run) {
+				zero_start = address;
+				in_zero_run = 1;
+			}
+		}else {
+			if (in_zero_run) {
+				printf("\t0x%08x..0x%08x :\t0x00000000 (%u words)\n", (uint32_t)zero_start,
+					(uint32_t)address - 4, (uint32_t)((address - zero_start) / 4));
+				in_zero_run = 0;
+			}
+			printf("\t0x%08x (%u) :\t0x%08x\n", (uint32_t)address, (uint32_t)address, value);
+		}
+		address += 4;
+	}
+	if (in_zero_run) {
+		printf("\t0x%08x..0x%08x :\t0x00000000 (%u words)\n", (uint32_t)zero_start,
+			(uint32_t)address - 4, (uint32_t)((address - zero_start) / 4));
+	}
+	printf("\n");
+}
+
+/***************************************************************/ 
+/* Write raw memory bytes [start..stop+3] to a file                                         */
+/***************************************************************/
+int mdump_bin(const char *path, uint32_t start, uint32_t stop) {
+	static const uint8_t zeros[DUMP_PAGE_SIZE];
+	uint64_t address = start, end = (uint64_t)stop + 4;
+	uint32_t avail, len;
+	uint8_t *ptr;
+	FILE *fp;
+
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		printf("Error: Can't open dump file %s\n", path);
+		return -1;
+	}
+	while (address < end) {
+		ptr = mem_host_ptr(address, &avail);
+		if (ptr == NULL) {
+			/* unmapped gap: emit zeros up to the next page */
+			len = DUMP_PAGE_SIZE - (address % DUMP_PAGE_SIZE);
+			ptr = (uint8_t *)zeros;
+		}else {
+			len = avail;
+		}
+		if (len > end - address) {
+			len = end - address;
+		}
+		if (fwrite(ptr, 1, len, fp) != len) {
+			printf("Error: Can't write dump file %s\n", path);
+			fclose(fp);
+			return -1;
+		}
+		address += len;
+	}
+	fclose(fp);
+	printf("Wrote 0x%08x..0x%08x to %s\n", start, stop, path);
+	return 0;
+}
+
+/***************************************************************/ 
+/* FNV-1a hash of one dump page                                                                         */
+/***************************************************************/
+uint64_t page_hash(const uint8_t *data, uint32_t len) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint32_t i;
+	for (i = 0; i < len; i++) {
+		hash = (hash ^ data[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/***************************************************************/ 
+/* Compare memory from start against a --bin dump, page by page            */
+/***************************************************************/
+int mdiff(const char *path, uint32_t start) {
+	uint8_t saved[DUMP_PAGE_SIZE], current[DUMP_PAGE_SIZE];
+	uint64_t address = start;
+	uint32_t avail, len, i, word_saved, word_current;
+	uint32_t pages = 0, pages_differ = 0, words_differ = 0;
+	uint8_t *ptr;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		printf("Error: Can't open dump file %s\n", path);
+		return -1;
+	}
+	printf("-------------------------------------------------------------\n");
+	printf("Memory vs %s from 0x%08x :\n", path, start);
+	printf("-------------------------------------------------------------\n");
+	while ((len = fread(saved, 1, sizeof(saved), fp)) > 0 && address <= 0xFFFFFFFFULL) {
+		/* gather the same bytes of current memory, zero where unmapped */
+		for (i = 0; i < len; i += avail) {
+			ptr = mem_host_ptr(address + i, &avail);
+			if (avail > len - i) {
+				avail = len - i;
+			}
+			if (ptr == NULL) {
+				avail = (len - i < 4) ? len - i : 4;
+				memset(current + i, 0, avail);
+			}else {
+				memcpy(current + i, ptr, avail);
+			}
+		}
+		pages++;
+		if (page_hash(saved, len) != page_hash(current, len)) {
+			pages_differ++;
+			for (i = 0; i + 4 <= len; i += 4) {
+				word_saved = saved[i] | (saved[i+1] << 8) | (saved[i+2] << 16) | ((uint32_t)saved[i+3] << 24);
+				word_current = current[i] | (current[i+1] << 8) | (current[i+2] << 16) | ((uint32_t)current[i+3] << 24);
+				if (word_saved != word_current) {
+					printf("\t0x%08x :\t0x%08x -> 0x%08x\n", (uint32_t)(address + i), word_saved, word_current);
+					words_differ++;
+				}
+			}
+		}
+		address += len;
+	}
+	fclose(fp);
+	printf("%u of %u pages differ, %u words\n\n", pages_differ, pages, words_differ);
+	return pages_differ != 0;
+}
+
+/***************************************************************/
+/* Print run statistics                                                                                               */  
+/***************************************************************/
+void stats() {
+	uint32_t i, total;
+
+	printf("-------------------------------------\n");
+	printf("Statistics\n");
+	printf("-------------------------------------\n");
+	printf("# Instructions Executed\t: %u\n", INSTRUCTION_COUNT);
+	printf("# Cycles Executed\t: %u\n", CYCLE_COUNT);
+	printf("CPI\t\t\t: %.3f\n", INSTRUCTION_COUNT ? (double)CYCLE_COUNT / INSTRUCTION_COUNT : 0.0);
+	printf("PC\t\t\t: 0x%08x\n", CURRENT_STATE.PC);
+	if (machine_file[0] != '\0') {
+		printf("Machine\t\t\t: ");
+		print_machine();
+	}
+	if (LATENCY_STALLS != 0) {
+		printf("Unit latency stalls\t: %u\n", LATENCY_STALLS);
+	}
+	if (REDIRECT_BUBBLES != 0) {
+		printf("Refill bubbles\t\t: %u\n", REDIRECT_BUBBLES);
+	}
+	printf("Memory faults\t\t: %u", MEM_FAULT_COUNT);
+	if (MEM_FAULT_COUNT != 0) {
+		printf(" (last at 0x%08x)", MEM_FAULT_ADDRESS);
+	}
+	printf("\n");
+	for (i = 0, total = 0; i < NUM_EXC_CODES; i++) {
+		total += EXCEPTION_COUNT[i];
+	}
+	printf("Syscalls\t\t: %u", SYSCALL_COUNT);
+	if (!RUN_FLAG && !UNHANDLED_EXCEPTION) {
+		printf(" (exit code %d)", EXIT_CODE);
+	}
+	printf("\n");
+	if (UNKNOWN_SYSCALL_COUNT != 0) {
+		printf("Unknown syscalls\t: %u (last $v0 = %u at 0x%08x)\n", UNKNOWN_SYSCALL_COUNT, UNKNOWN_SYSCALL, UNKNOWN_SYSCALL_PC);
+	}
+	if (HEAP_PEAK != HEAP_BASE) {
+		printf("Heap\t\t\t: %u bytes (break 0x%08x, peak %u bytes)\n", HEAP_BREAK - HEAP_BASE, HEAP_BREAK, HEAP_PEAK - HEAP_BASE);
+	}
+	if (STACK_LOW <= MEM_STACK_BEGIN) {
+		printf("Stack\t\t\t: %u bytes peak (lowest 0x%08x)\n", MEM_STACK_BEGIN + 1 - STACK_LOW, STACK_LOW);
+	}
+	print_memsys();
+	print_energy();
+	printf("Exceptions\t\t: %u\n", total);
+	for (i = 0; i < NUM_EXC_CODES; i++) {
+		if (EXCEPTION_COUNT[i] != 0) {
+			printf("  %-8s\t\t: %u\n", exception_name(i), EXCEPTION_COUNT[i]);
+		}
+	}
+	if (total != 0) {
+		printf("Kernel cycles\t\t: %u (%.1f%%)\n", KERNEL_CYCLES, CYCLE_COUNT ? 100.0 * KERNEL_CYCLES / CYCLE_COUNT : 0.0);
+		printf("Flushed instructions\t: %u\n", FLUSHED_COUNT);
+	}
+	printf("-------------------------------------\n");
+}
+
 /***************************************************************/
 /* Dump current values of registers to the teminal                                              */   
 /***************************************************************/
@@ -155,102 +702,12 @@ void rdump() {
 	printf("[HI]\t: 0x%08x\n", CURRENT_STATE.HI);
 	printf("[LO]\t: 0x%08x\n", CURRENT_STATE.LO);
 	printf("-------------------------------------\n");
-}
-
-/***************************************************************/
-/* Read a command from standard input.                                                               */  
-/***************************************************************/
-void handle_command() {                         
-	char buffer[20];
-	uint32_t start, stop, cycles;
-	uint32_t register_no;
-	int register_value;
-	int hi_reg_value, lo_reg_value;
-
-	printf("MU-MIPS SIM:> ");
-
-	if (scanf("%s", buffer) == EOF){
-		exit(0);
-	}
-
-	switch(buffer[0]) {
-		case 'S':
-		case 's':
-			if (buffer[1] == 'h' || buffer[1] == 'H'){
-				show_pipeline();
-			}else {
-				runAll(); 
-			}
-			break;
-		case 'M':
-		case 'm':
-			if (scanf("%x %x", &start, &stop) != 2){
-				break;
-			}
-			mdump(start, stop);
-			break;
-		case '?':
-			help();
-			break;
-		case 'Q':
-		case 'q':
-			printf("**************************\n");
-			printf("Exiting MU-MIPS! Good Bye...\n");
-			printf("**************************\n");
-			exit(0);
-		case 'R':
-		case 'r':
-			if (buffer[1] == 'd' || buffer[1] == 'D'){
-				rdump();
-			}else if(buffer[1] == 'e' || buffer[1] == 'E'){
-				reset();
-			}
-			else {
-				if (scanf("%d", &cycles) != 1) {
-					break;
-				}
-				run(cycles);
-			}
-			break;
-		case 'I':
-		case 'i':
-			if (scanf("%u %i", &register_no, &register_value) != 2){
-				break;
-			}
-			CURRENT_STATE.REGS[register_no] = register_value;
-			NEXT_STATE.REGS[register_no] = register_value;
-			break;
-		case 'H':
-		case 'h':
-			if (scanf("%i", &hi_reg_value) != 1){
-				break;
-			}
-			CURRENT_STATE.HI = hi_reg_value; 
-			NEXT_STATE.HI = hi_reg_value; 
-			break;
-		case 'L':
-		case 'l':
-			if (scanf("%i", &lo_reg_value) != 1){
-				break;
-			}
-			CURRENT_STATE.LO = lo_reg_value;
-			NEXT_STATE.LO = lo_reg_value;
-			break;
-		case 'P':
-		case 'p':
-			print_program(); 
-			break;
-		case 'f':
-			if (scanf("%d", &ENABLE_FORWARDING) != 1) {
-				break;
-			}
-			
-			ENABLE_FORWARDING == 0 ? printf("Forwarding OFF\n") : printf("Forwarding ON\n");
-			break;
-
-		default:
-			printf("Invalid Command.\n");
-			break;
+	if (KERNEL_SIZE != 0 || CURRENT_STATE.CP0[CP0_EPC] != 0) {
+		printf("[Status]\t: 0x%08x\n", CURRENT_STATE.CP0[CP0_STATUS]);
+		printf("[Cause]\t: 0x%08x\n", CURRENT_STATE.CP0[CP0_CAUSE]);
+		printf("[EPC]\t: 0x%08x\n", CURRENT_STATE.CP0[CP0_EPC]);
+		printf("[BadVAddr]\t: 0x%08x\n", CURRENT_STATE.CP0[CP0_BADVADDR]);
+		printf("-------------------------------------\n");
 	}
 }
 
@@ -259,782 +716,1119 @@ void handle_command() {
 /***************************************************************/
 void reset() {   
 	int i;
-	/*reset registers*/
-	for (i = 0; i < MIPS_REGS; i++){
-		CURRENT_STATE.REGS[i] = 0;
-	}
-	CURRENT_STATE.HI = 0;
-	CURRENT_STATE.LO = 0;
+	int recording = RECORDING;
+
+	/* old snapshots describe the previous run */
+	set_recording(0);
+	reset_registers();
 	
+	/* fresh zero pages, then put the host files back on top */
 	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		map_region(i);
+	}
+	for (i = 0; i < NUM_FILE_MAPS; i++) {
+		apply_file_map(&FILE_MAPS[i]);
 	}
 	
 	/*load program*/
 	load_program();
+	load_kernel();
 	
 	/*reset PC*/
 	INSTRUCTION_COUNT = 0;
 	CURRENT_STATE.PC =  MEM_TEXT_BEGIN;
 	NEXT_STATE = CURRENT_STATE;
 	RUN_FLAG = TRUE;
+	set_recording(recording);
 }
 
 /***************************************************************/
-/* Allocate and set memory to zero                                                                            */
+/* Zero the run counters and all registers but $sp and $gp                    */
 /***************************************************************/
-void init_memory() {                                           
+void reset_registers() {
+	int i;
+
+	for (i = 0; i < MIPS_REGS; i++){
+		CURRENT_STATE.REGS[i] = 0;
+	}
+	CURRENT_STATE.HI = 0;
+	CURRENT_STATE.LO = 0;
+	CURRENT_STATE.REGS[29] = STACK_POINTER_INIT;
+	CURRENT_STATE.REGS[28] = GLOBAL_POINTER_INIT;
+	STACK_LOW = MEM_STACK_BEGIN + 1;
+	memset(CURRENT_STATE.CP0, 0, sizeof(CURRENT_STATE.CP0));
+	memset(EXCEPTION_COUNT, 0, sizeof(EXCEPTION_COUNT));
+	KERNEL_CYCLES = 0;
+	FLUSHED_COUNT = 0;
+	FETCH_DELAY = 0;
+	LATENCY_STALLS = 0;
+	REDIRECT_BUBBLES = 0;
+	memset(ACTIVITY, 0, sizeof(ACTIVITY));
+	UNHANDLED_EXCEPTION = 0;
+	reset_syscalls();
+	reset_memsys();
+}
+
+/***************************************************************/
+/* Reload prog_file after an edit. Only the text words that differ      */
+/* from memory are written; with keep, registers, data memory, the     */
+/* pipeline and the counters stay as they are and the run carries on   */
+/* with the new code. Otherwise the rest is reset as reset() does,      */
+/* except the text region, which is patched rather than remapped.        */
+/* On an error the old program stays loaded.                                             */
+/***************************************************************/
+int reload(int keep) {
+	asm_section_t sections[ASM_SECTIONS];
+	uint32_t *words, count, base, i, word, changed = 0;
+	int assembled = is_asm_source(prog_file), recording = RECORDING, r;
+
+	base = MEM_TEXT_BEGIN;
+	if (assembled) {
+		clear_symbols();
+		if (assemble(prog_file, sections) != 0) {
+			printf("Error: Can't assemble program file %s, keeping the old program\n", prog_file);
+			return -1;
+		}
+		base = sections[ASM_TEXT].base;
+		count = sections[ASM_TEXT].size / 4;
+		words = malloc((count ? count : 1) * sizeof(uint32_t));
+		if (words == NULL) {
+			free_sections(sections);
+			return -1;
+		}
+		for (i = 0; i < count; i++) {
+			words[i] = sections[ASM_TEXT].bytes[i*4] | (sections[ASM_TEXT].bytes[i*4 + 1] << 8) |
+				(sections[ASM_TEXT].bytes[i*4 + 2] << 16) | ((uint32_t)sections[ASM_TEXT].bytes[i*4 + 3] << 24);
+		}
+	}
+	else {
+		words = read_program(prog_file, &count);
+		if (words == NULL) {
+			printf("Error: Can't open program file %s, keeping the old program\n", prog_file);
+			return -1;
+		}
+	}
+	program_changed();	/* note the new modification time */
+
+	/* undo pages and snapshots do not cover the patch */
+	set_recording(0);
+	for (i = 0; i < count || i < PROGRAM_SIZE; i++) {
+		word = (i < count) ? words[i] : 0;
+		if (mem_read_32(base + i*4) != word) {
+			mem_write_32(base + i*4, word);
+			changed++;
+		}
+	}
+	PROGRAM_SIZE = count;
+	free(words);
+
+	if (!keep) {
+		reset_registers();
+		for (r = 0; r < NUM_MEM_REGION; r++) {
+			if (MEM_REGIONS[r].begin != MEM_TEXT_BEGIN) {
+				map_region(r);
+			}
+		}
+		for (r = 0; r < NUM_FILE_MAPS; r++) {
+			apply_file_map(&FILE_MAPS[r]);
+		}
+		if (assembled) {
+			load_sections(sections, ASM_DATA, ASM_KDATA);
+			set_heap_base(sections[ASM_DATA].base + sections[ASM_DATA].size);
+			if (sections[ASM_KTEXT].size != 0) {
+				KERNEL_SIZE = sections[ASM_KTEXT].size / 4;
+			}
+		}
+		load_kernel();
+		INSTRUCTION_COUNT = 0;
+		CURRENT_STATE.PC = MEM_TEXT_BEGIN;
+		NEXT_STATE = CURRENT_STATE;
+		RUN_FLAG = TRUE;
+	}
+	if (assembled) {
+		free_sections(sections);
+	}
+	set_recording(recording);
+	printf("Program reloaded: %u of %u words of text changed%s.\n\n", changed, PROGRAM_SIZE,
+		keep ? ", registers and data kept" : "");
+	return 0;
+}
+
+/***************************************************************/
+/* Has prog_file been written since it was last loaded                              */
+/***************************************************************/
+int program_changed() {
+	struct stat st;
+	int changed;
+
+	if (stat(prog_file, &st) != 0) {
+		return FALSE;
+	}
+	changed = st.st_mtim.tv_sec != PROGRAM_MTIME.tv_sec || st.st_mtim.tv_nsec != PROGRAM_MTIME.tv_nsec;
+	PROGRAM_MTIME = st.st_mtim;
+	return changed;
+}
+
+/***************************************************************/
+/* Allocate and set memory to zero                                                                            */
+/***************************************************************/
+void init_memory() {                                           
 	int i;
 	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		MEM_REGIONS[i].mem = malloc(region_size);
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		MEM_REGIONS[i].mem = NULL;
+		map_region(i);
+	}
+}
+
+/***************************************************************/
+/* (Re)map a region as anonymous zero pages, allocated on first touch            */
+/***************************************************************/
+void map_region(int i) {
+	uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+	void *mem;
+
+	if (MEM_REGIONS[i].mem != NULL) {
+		flags |= MAP_FIXED;	/* drops every page of the old mapping */
+	}
+	mem = mmap(MEM_REGIONS[i].mem, region_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (mem == MAP_FAILED) {
+		printf("Error: Can't allocate memory region 0x%08x..0x%08x\n", MEM_REGIONS[i].begin, MEM_REGIONS[i].end);
+		exit(-1);
+	}
+	MEM_REGIONS[i].mem = mem;
+}
+
+/***************************************************************/
+/* Back the data region at address with a host file                                                 */
+/***************************************************************/
+int map_file(const char *path, uint32_t address, int shared) {
+	file_map_t *map;
+
+	if (NUM_FILE_MAPS == MAX_FILE_MAPS) {
+		printf("Error: At most %d files can be mapped\n", MAX_FILE_MAPS);
+		return -1;
+	}
+	map = &FILE_MAPS[NUM_FILE_MAPS];
+	strncpy(map->path, path, sizeof(map->path) - 1);
+	map->path[sizeof(map->path) - 1] = '\0';
+	map->address = address;
+	map->shared = shared;
+	if (apply_file_map(map) != 0) {
+		return -1;
+	}
+	NUM_FILE_MAPS++;
+	printf("Mapped %s (%s) at 0x%08x..0x%08x\n", map->path, shared ? "shared" : "private",
+		map->address, map->address + map->size - 1);
+	return 0;
+}
+
+/***************************************************************/
+/* mmap a file over the data region; nothing is copied                                               */
+/***************************************************************/
+int apply_file_map(file_map_t *map) {
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint32_t offset;
+	struct stat st;
+	void *mem;
+	int fd;
+
+	if (map->address < MEM_EXTERN_BEGIN || map->address > MEM_DATA_END) {
+		printf("Error: 0x%08x is not in the data region\n", map->address);
+		return -1;
+	}
+	offset = map->address - MEM_EXTERN_BEGIN;
+	if (offset % page_size != 0) {
+		printf("Error: 0x%08x is not aligned to a %ld byte page\n", map->address, page_size);
+		return -1;
 	}
+
+	fd = open(map->path, map->shared ? O_RDWR : O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		printf("Error: Can't open data file %s\n", map->path);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	if (st.st_size == 0 || (uint64_t)st.st_size > (uint64_t)(MEM_DATA_END - map->address) + 1) {
+		printf("Error: %s does not fit in the data region at 0x%08x\n", map->path, map->address);
+		close(fd);
+		return -1;
+	}
+	map->size = (st.st_size + page_size - 1) / page_size * page_size;
+
+	mem = mmap(MEM_REGIONS[MEM_DATA_REGION].mem + offset, map->size, PROT_READ | PROT_WRITE,
+		(map->shared ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		printf("Error: Can't map %s\n", map->path);
+		return -1;
+	}
+	return 0;
 }
 
 /**************************************************************/
 /* load program into memory                                                                                      */
 /**************************************************************/
 void load_program() {                   
-	FILE * fp;
-	int i, word;
-	uint32_t address;
+	uint32_t *words;
+	uint32_t i, address;
+	asm_section_t sections[ASM_SECTIONS];
 
-	/* Open program file. */
-	fp = fopen(prog_file, "r");
-	if (fp == NULL) {
-		printf("Error: Can't open program file %s\n", prog_file);
-		exit(-1);
+	clear_symbols();
+	program_changed();
+	if (is_asm_source(prog_file)) {
+		if (assemble(prog_file, sections) != 0 || load_sections(sections, ASM_TEXT, ASM_KDATA) != 0) {
+			printf("Error: Can't assemble program file %s\n", prog_file);
+			exit(-1);
+		}
+		PROGRAM_SIZE = sections[ASM_TEXT].size / 4;
+		if (sections[ASM_KTEXT].size != 0) {
+			KERNEL_SIZE = sections[ASM_KTEXT].size / 4;
+		}
+		printf("Program assembled into memory.\n%d words of text, %d bytes of data, %d symbols.\n\n",
+			PROGRAM_SIZE, sections[ASM_DATA].size, NUM_SYMBOLS);
+		set_heap_base(sections[ASM_DATA].base + sections[ASM_DATA].size);
+		free_sections(sections);
+		return;
 	}
 
 	/* Read in the program. */
+	words = read_program(prog_file, &PROGRAM_SIZE);
+	if (words == NULL) {
+		printf("Error: Can't open program file %s\n", prog_file);
+		exit(-1);
+	}
 
-	i = 0;
-	while( fscanf(fp, "%x\n", &word) != EOF ) {
-		address = MEM_TEXT_BEGIN + i;
-		mem_write_32(address, word);
-		printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
-		i += 4;
+	for (i = 0; i < PROGRAM_SIZE; i++) {
+		address = MEM_TEXT_BEGIN + i*4;
+		mem_write_32(address, words[i]);
+		printf("writing 0x%08x into address 0x%08x (%d)\n", words[i], address, address);
 	}
-	PROGRAM_SIZE = i/4;
 	printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
+	free(words);
+	set_heap_base(MEM_DATA_BEGIN);
+}
+
+/**************************************************************/
+/* Load the exception handler, if one was given, at EXCEPTION_VECTOR   */
+/**************************************************************/
+void load_kernel() {
+	uint32_t *words;
+	uint32_t i;
+	asm_section_t sections[ASM_SECTIONS];
+
+	if (kernel_file[0] == '\0') {
+		return;
+	}
+	if (is_asm_source(kernel_file)) {
+		/* only the .ktext and .kdata sections of a kernel source are used */
+		if (assemble(kernel_file, sections) != 0 || sections[ASM_KTEXT].size == 0 ||
+			load_sections(sections, ASM_KTEXT, ASM_KDATA) != 0) {
+			printf("Error: Can't assemble kernel file %s (it needs a .ktext section)\n", kernel_file);
+			exit(-1);
+		}
+		KERNEL_SIZE = sections[ASM_KTEXT].size / 4;
+		printf("Kernel assembled at 0x%08x.\n%d words written into memory.\n\n", sections[ASM_KTEXT].base, KERNEL_SIZE);
+		free_sections(sections);
+		return;
+	}
+	words = read_program(kernel_file, &KERNEL_SIZE);
+	if (words == NULL) {
+		printf("Error: Can't open kernel file %s\n", kernel_file);
+		exit(-1);
+	}
+	for (i = 0; i < KERNEL_SIZE; i++) {
+		mem_write_32(EXCEPTION_VECTOR + i*4, words[i]);
+	}
+	printf("Kernel loaded at 0x%08x.\n%d words written into memory.\n\n", EXCEPTION_VECTOR, KERNEL_SIZE);
+	free(words);
+}
+
+/**************************************************************/
+/* Copy assembled sections first..last into memory                             */
+/**************************************************************/
+int load_sections(const asm_section_t sections[ASM_SECTIONS], int first, int last) {
+	int i;
+
+	for (i = first; i <= last; i++) {
+		if (sections[i].size != 0 && mem_write_bytes(sections[i].base, sections[i].bytes, sections[i].size) != sections[i].size) {
+			printf("Error: section at 0x%08x does not fit in memory\n", sections[i].base);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**************************************************************/
+/* Parse a program file of hex words into a malloc'd array               */
+/**************************************************************/
+uint32_t *read_program(const char *path, uint32_t *count) {
+	FILE * fp;
+	uint32_t *words = NULL, *grown;
+	uint32_t n = 0, max = 0;
+	unsigned int word;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return NULL;
+	}
+	while( fscanf(fp, "%x\n", &word) == 1 ) {
+		if (n == max) {
+			max = max ? max * 2 : 256;
+			grown = realloc(words, max * sizeof(uint32_t));
+			if (grown == NULL) {
+				free(words);
+				fclose(fp);
+				return NULL;
+			}
+			words = grown;
+		}
+		words[n++] = word;
+	}
 	fclose(fp);
+	if (words == NULL) {
+		words = malloc(sizeof(uint32_t));	/* empty program, still a valid array */
+	}
+	*count = n;
+	return words;
 }
 
 /************************************************************/
-/* maintain the pipeline                                                                                           */ 
+/* Is ir outside MIPS I, or a MIPS I instruction the stages do not run    */
+/* (OP_NONE in the decode table); the all-zero word is the nop                */ 
 /************************************************************/
-void handle_pipeline()
+int reserved_instruction(uint32_t ir)
 {
-	/*INSTRUCTION_COUNT should be incremented when instruction is done*/
-	/*Since we do not have branch/jump instructions, INSTRUCTION_COUNT should be incremented in WB stage */
+	const instr_desc_t *d = decode_instruction(ir);
 
-	NEXT_STATE = CURRENT_STATE;
-	if (stall > 0){
-		stall = stall - 1;	//Decrement stall back to 0	
+	return ir != 0 && (d == NULL || d->op == OP_NONE);
+}
+
+/************************************************************/
+/* Is an enabled interrupt waiting to be taken                                                       */ 
+/************************************************************/
+int interrupt_pending()
+{
+	uint32_t status = NEXT_STATE.CP0[CP0_STATUS];
+
+	if (!(status & STATUS_IE) || (status & STATUS_EXL)){
+		return 0;
 	}
-	printf("Handle Pipeline: Stall = %d\n", stall);
-	WB();
-	MEM();
-	EX();
-	ID();
-	IF();
+	return (status & NEXT_STATE.CP0[CP0_CAUSE] & CAUSE_IP7) != 0;
 }
 
 /************************************************************/
-/* writeback (WB) pipeline stage:                                                                          */ 
+/* Enter the handler for an exception raised by the instruction at epc       */ 
 /************************************************************/
-void WB()
+void take_exception(uint32_t code, uint32_t epc, uint32_t badvaddr)
 {
-	/*IMPLEMENT THIS*/
-	//Fifth stage
-	
+	char where[ADDRESS_STRING_SIZE];
 
-	if (MEM_WB.stall == 1){
+	EXCEPTION_COUNT[code]++;
+	SET_CP0(CP0_CAUSE, (NEXT_STATE.CP0[CP0_CAUSE] & ~CAUSE_EXC_MASK) | (code << CAUSE_EXC_SHIFT));
+	if (code == EXC_ADEL || code == EXC_ADES || code == EXC_IBE || code == EXC_DBE){
+		SET_CP0(CP0_BADVADDR, badvaddr);
+	}
+	if (TRACE_ENABLED){
+		printf("Exception %s at %s\n", exception_name(code), format_address(epc, where, sizeof(where)));
+	}
+
+	if (KERNEL_SIZE == 0 || (NEXT_STATE.CP0[CP0_STATUS] & STATUS_EXL)){
+		//No handler, or the handler itself faulted: stop with the state precise at epc
+		SET_CP0(CP0_EPC, epc);
+		UNHANDLED_EXCEPTION = 1;
+		RUN_FLAG = FALSE;
+		flush_and_redirect(epc);
 		return;
 	}
-	
-	uint32_t opcode = (MEM_WB.IR & 0xFC000000) >> 26;	//Shift left to get opcode bits 26-31
-	uint32_t funct = MEM_WB.IR & 0x0000003F;	//Get first 6 bits for function code
-	uint32_t rt = (MEM_WB.IR & 0x001F0000) >> 16;
-	uint32_t rd = (MEM_WB.IR & 0x0000F800) >> 11;
-	    
-	if (opcode == 0x00) {	 //R-type instruction
-		switch(funct) {
-			case 0x00:	//SLL
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x02:	//SRL
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput; 
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x03:	//SRA
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x08:	//JR
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x09:	//JALR
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x0C:	//SYSCALL
-				if (NEXT_STATE.REGS[2] == 0xa){
-					RUN_FLAG = FALSE;
-				}
-				break;
-				
-			case 0x10:	//MFHI
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;  
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x11:	//MTHI
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x12:	//MFLO
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;	
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x13:	//MTLO
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x18:	//MULT
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x19:	//MULTU
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x1A:	//DIV
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x1B:	//DIVU
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x20:	//ADD
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x21:	//ADDU
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x22:	//SUB
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x23:	//SUBU
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x24:	//AND
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x25:	//OR
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x26:	//XOR
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x27:	//NOR
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x2A:	//SLT
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			default:
-				printf("R-type instruction not handled in wb\n");
-				break;
+	SET_CP0(CP0_EPC, epc);
+	SET_CP0(CP0_STATUS, NEXT_STATE.CP0[CP0_STATUS] | STATUS_EXL);
+	flush_and_redirect(EXCEPTION_VECTOR);
+}
+
+/************************************************************/
+/* Take a pending interrupt after WB retired its instruction; EPC is the  */
+/* oldest instruction still in the pipeline, or the next fetch if none  */
+/************************************************************/
+void take_interrupt()
+{
+	uint32_t epc;
+
+	if (EX_MEM.PC != 0 && EX_MEM.stall != 1){
+		epc = EX_MEM.PC - 4;
+	}else if (ID_EX.PC != 0 && ID_EX.stall == 0){
+		epc = ID_EX.PC - 4;
+	}else if (IF_ID.PC != 0){
+		epc = IF_ID.PC - 4;
+	}else {
+		epc = CURRENT_STATE.PC;
+	}
+	take_exception(EXC_INT, epc, 0);
+}
+
+/************************************************************/
+/* Squash everything younger than WB and fetch from target this cycle   */ 
+/************************************************************/
+void flush_and_redirect(uint32_t target)
+{
+	FLUSHED_COUNT += (IF_ID.IR != 0) + (ID_EX.IR != 0) + (EX_MEM.IR != 0);
+	memset(&IF_ID, 0, sizeof(IF_ID));
+	memset(&ID_EX, 0, sizeof(ID_EX));
+	memset(&EX_MEM, 0, sizeof(EX_MEM));
+	stall = 0;
+	ForwardA = 0;
+	ForwardB = 0;
+	loadStall = 0;
+	FETCH_DELAY = MACHINE.redirect_penalty;
+	CURRENT_STATE.PC = target;	//IF runs after WB, so it fetches target in this cycle
+	NEXT_STATE.PC = target;
+}
+
+/************************************************************/
+/* Report the exception a run stopped on                                                               */ 
+/************************************************************/
+void print_unhandled_exception()
+{
+	uint32_t code = (CURRENT_STATE.CP0[CP0_CAUSE] & CAUSE_EXC_MASK) >> CAUSE_EXC_SHIFT;
+	char where[ADDRESS_STRING_SIZE];
+
+	printf("Unhandled exception: %s at %s", exception_name(code), format_address(CURRENT_STATE.CP0[CP0_EPC], where, sizeof(where)));
+	if (code == EXC_ADEL || code == EXC_ADES || code == EXC_IBE || code == EXC_DBE){
+		printf(" (address 0x%08x)", CURRENT_STATE.CP0[CP0_BADVADDR]);
+	}
+	if (code == EXC_DBE && CURRENT_STATE.CP0[CP0_BADVADDR] >= MEM_STACK_END - STACK_GUARD_SIZE &&
+		CURRENT_STATE.CP0[CP0_BADVADDR] < MEM_STACK_END){
+		printf(": stack overflow");
+	}
+	printf("\n");
+}
+
+/************************************************************/
+/* Short name of an exception code                                                                        */ 
+/************************************************************/
+const char *exception_name(uint32_t code)
+{
+	switch (code){
+		case EXC_INT: return "Int";
+		case EXC_ADEL: return "AdEL";
+		case EXC_ADES: return "AdES";
+		case EXC_IBE: return "IBE";
+		case EXC_DBE: return "DBE";
+		case EXC_SYS: return "Sys";
+		case EXC_RI: return "RI";
+		case EXC_OV: return "Ov";
+		default: return "?";
+	}
+}
+
+const char *REG_NAMES[MIPS_REGS] = {
+	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+	"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+/************************************************************/
+/* Parse a register name: $t0, $r5, r5, $5 or 5                                                   */ 
+/************************************************************/
+int parse_register(const char *name)
+{
+	char *end;
+	long reg;
+
+	if (*name == '$'){
+		name++;
+	}
+	for (reg = 0; reg < MIPS_REGS; reg++){
+		if (strcmp(name, REG_NAMES[reg]) == 0){
+			return reg;
+		}
+	}
+	if (strcmp(name, "s8") == 0){
+		return 30;
+	}
+	if (*name == 'r' || *name == 'R'){
+		name++;
+	}
+	reg = strtol(name, &end, 10);
+	if (end == name || *end != '\0' || reg < 0 || reg >= MIPS_REGS){
+		return -1;
+	}
+	return reg;
+}
+
+/************************************************************/
+/* Add a breakpoint, cond is the rest of the line: "if <reg> <op> <val>"   */ 
+/************************************************************/
+int add_breakpoint(uint32_t pc, const char *cond)
+{
+	static const char *ops[] = { "==", "!=", "<", "<=", ">", ">=" };
+	char reg[20], op[4];
+	char where[ADDRESS_STRING_SIZE];
+	breakpoint_t bp;
+	uint32_t slot;
+	int i, n = 0;
+
+	memset(&bp, 0, sizeof(bp));
+	bp.pc = pc;
+	bp.used = 1;
+	cond += strspn(cond, " \t\r\n");
+	if (*cond != '\0'){
+		/* anything after the pc must be a whole condition */
+		if (sscanf(cond, "if %19s %3s %i%n", reg, op, &bp.value, &n) != 3 || cond[n + strspn(cond + n, " \t\r\n")] != '\0'){
+			printf("Invalid breakpoint condition.\n");
+			return -1;
 		}
+		for (i = 0; i < 6 && strcmp(op, ops[i]) != 0; i++);
+		bp.reg = parse_register(reg);
+		if (bp.reg < 0 || i == 6){
+			printf("Invalid breakpoint condition.\n");
+			return -1;
+		}
+		strcpy(bp.op, op);
+		bp.has_cond = 1;
+	}
+
+	/* linear probe; an existing entry for pc is replaced */
+	slot = (pc >> 2) & (BREAK_TABLE_SIZE - 1);
+	while (BREAKPOINTS[slot].used && BREAKPOINTS[slot].pc != pc){
+		slot = (slot + 1) & (BREAK_TABLE_SIZE - 1);
 	}
-	else{
-		switch(opcode){
-			case 0x01:	//BLTZ OR BGEZ
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x02:	//J
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x03:	//JAL
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x04:	//BEQ
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x05:	//BNE
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x06:	//BLEZ
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x07:	//BGTZ
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x08:	//ADDI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x09:	//ADDIU
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x0A:	//SLTI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x0C:	//ANDI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x0D:	//ORI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x0E:	//XORI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x0F:	//LUI
-				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x20:	//LB
-				NEXT_STATE.REGS[rt] = MEM_WB.LMD;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x21:	//LH
-				NEXT_STATE.REGS[rt] = MEM_WB.LMD;
-				INSTRUCTION_COUNT++;
-				break;
-					
-			case 0x23:	//LW
-				NEXT_STATE.REGS[rt] = MEM_WB.LMD;
-				INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x28:	//SB
-//				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				//INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x29:	//SH
-//				NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-				//INSTRUCTION_COUNT++;
-				break;
-				
-			case 0x2B:	//SW
-			//	NEXT_STATE.REGS[rt] = MEM_WB.ALUOutput;
-			//	INSTRUCTION_COUNT++;
-				break;
-				
-			default:
-                printf("\ninstruction not handled in wb");
-				break;
+	if (!BREAKPOINTS[slot].used){
+		if (NUM_BREAKPOINTS == BREAK_TABLE_SIZE - 1){
+			printf("Too many breakpoints.\n");
+			return -1;
 		}
+		NUM_BREAKPOINTS++;
 	}
+	BREAKPOINTS[slot] = bp;
+	printf("Breakpoint at %s", format_address(pc, where, sizeof(where)));
+	if (bp.has_cond){
+		printf(" if $r%d %s 0x%x", bp.reg, bp.op, bp.value);
+	}
+	printf("\n");
+	return 0;
 }
 
 /************************************************************/
-/* memory access (MEM) pipeline stage:                                                          */ 
+/* Remove a breakpoint and rehash the entries that follow it              */ 
 /************************************************************/
-void MEM()
+void remove_breakpoint(uint32_t pc)
 {
-	/*IMPLEMENT THIS*/
-	//Fourth stage
-	//Load/Store only?
+	uint32_t slot = (pc >> 2) & (BREAK_TABLE_SIZE - 1);
+	uint32_t home;
+	breakpoint_t bp;
 
-	if (EX_MEM.stall == 1){
+	while (BREAKPOINTS[slot].used && BREAKPOINTS[slot].pc != pc){
+		slot = (slot + 1) & (BREAK_TABLE_SIZE - 1);
+	}
+	if (!BREAKPOINTS[slot].used){
+		printf("No breakpoint at 0x%08x\n", pc);
 		return;
 	}
+	BREAKPOINTS[slot].used = 0;
+	NUM_BREAKPOINTS--;
 
-	MEM_WB.IR = EX_MEM.IR;
-	MEM_WB.PC = EX_MEM.PC;
-	MEM_WB.A = EX_MEM.A;
-	MEM_WB.B = EX_MEM.B;
-	MEM_WB.imm = EX_MEM.imm;
-	MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-	MEM_WB.LMD = 0;
-    MEM_WB.RegisterRD = EX_MEM.RegisterRD;
-    MEM_WB.RegisterRT = EX_MEM.RegisterRT;
-    MEM_WB.RegisterRS = EX_MEM.RegisterRS;
-	
-	uint32_t opcode;
-	
-	opcode = (MEM_WB.IR & 0xFC000000) >> 26;	//Shift to get opcode bits 26-31
-	
-	if (opcode == 0x00){
-		return;	//Don't need r type	
+	/* re-insert the rest of the probe chain so lookups still find it */
+	slot = (slot + 1) & (BREAK_TABLE_SIZE - 1);
+	while (BREAKPOINTS[slot].used){
+		bp = BREAKPOINTS[slot];
+		BREAKPOINTS[slot].used = 0;
+		home = (bp.pc >> 2) & (BREAK_TABLE_SIZE - 1);
+		while (BREAKPOINTS[home].used){
+			home = (home + 1) & (BREAK_TABLE_SIZE - 1);
+		}
+		BREAKPOINTS[home] = bp;
+		slot = (slot + 1) & (BREAK_TABLE_SIZE - 1);
 	}
-	
-	else{
-		switch(opcode){
-			case 0x20:	//LB
-				MEM_WB.LMD = 0x000000FF & mem_read_32(MEM_WB.ALUOutput);	//Get first 8 bits from memory and place in lmd
-				break;
-				
-			case 0x21:	//LH
-				MEM_WB.LMD = 0x0000FFFF & mem_read_32(MEM_WB.ALUOutput);	//Get first 16 bits from memory and place in lmd
-				break;
-				
-			case 0x23:	//LW
-				++stall;	
-				MEM_WB.LMD = 0xFFFFFFFF & mem_read_32(MEM_WB.ALUOutput);	//Get first 32 bits from memory and place in lmd
-				printf("lw mem address = %X\n", MEM_WB.ALUOutput);
-        		        break;
-				
-			case 0x28:	//SB
-				mem_write_32(MEM_WB.ALUOutput, MEM_WB.B);	//Write B into ALUOutput memory
-				break;
-				
-			case 0x29:	//SH
-				mem_write_32(MEM_WB.ALUOutput, MEM_WB.B);	//Write B into ALUOutput memory
-				break;
-				
-			case 0x2B:	//SW
-				mem_write_32(EX_MEM.ALUOutput, MEM_WB.B);	//Write B into ALUOutput memory
-				break;
-				
-			default:
-				break;
+}
+
+/************************************************************/
+/* Is there a breakpoint at pc whose condition holds? IF asks about       */
+/* plain breakpoints as it fetches pc; WB asks about conditional ones  */
+/* as pc retires, once every older instruction has written its register */
+/************************************************************/
+int check_breakpoint(uint32_t pc, int retiring)
+{
+	uint32_t slot = (pc >> 2) & (BREAK_TABLE_SIZE - 1);
+	breakpoint_t *bp;
+	uint32_t reg;
+	int hit;
+	char where[ADDRESS_STRING_SIZE];
+
+	while (BREAKPOINTS[slot].used && BREAKPOINTS[slot].pc != pc){
+		slot = (slot + 1) & (BREAK_TABLE_SIZE - 1);
+	}
+	bp = &BREAKPOINTS[slot];
+	if (!bp->used || bp->has_cond != retiring){
+		return 0;
+	}
+	if (!bp->has_cond){
+		hit = 1;
+	}else {
+		reg = CURRENT_STATE.REGS[bp->reg];
+		switch (bp->op[0]){
+			case '=': hit = (reg == bp->value); break;
+			case '!': hit = (reg != bp->value); break;
+			case '<': hit = (bp->op[1] == '=') ? ((int32_t)reg <= (int32_t)bp->value) : ((int32_t)reg < (int32_t)bp->value); break;
+			case '>': hit = (bp->op[1] == '=') ? ((int32_t)reg >= (int32_t)bp->value) : ((int32_t)reg > (int32_t)bp->value); break;
+			default: hit = 0; break;
 		}
 	}
-	
+	if (hit && !REPLAYING){
+		printf("Breakpoint hit at %s (cycle %u)\n", format_address(pc, where, sizeof(where)), CYCLE_COUNT);
+	}
+	return hit;
 }
 
 /************************************************************/
-/* execution (EX) pipeline stage:                                                                          */ 
+/* Add a watchpoint on the word at address                                                           */ 
 /************************************************************/
-void EX()
+int add_watchpoint(uint32_t address, int mode)
 {
-	/*IMPLEMENT THIS*/
-	//Third stage
-	//Initialize EX pipeline registers
-	
-	if (ID_EX.stall == 1){
-		printf("Stalled in EX stage\n");
-		EX_MEM.stall = 1;
-		EX_MEM.IR = 0;
-		EX_MEM.PC = 0;
-		EX_MEM.A = 0;
-		EX_MEM.B = 0;
-		EX_MEM.imm = 0;
-		EX_MEM.ALUOutput = 0;
-		EX_MEM.RegisterRS = 0;
-		EX_MEM.RegisterRT = 0;
-		EX_MEM.RegisterRD = 0;
-		EX_MEM.RegWrite = 0;
+	address &= ~3;
+	if (NUM_WATCHPOINTS == MAX_WATCHPOINTS){
+		printf("Too many watchpoints.\n");
+		return -1;
 	}
-	
-	if (ID_EX.stall == 0) {
-		printf("Running EX stage\n");
-		EX_MEM.IR = ID_EX.IR;
-		EX_MEM.PC = ID_EX.PC;
-		EX_MEM.A = ID_EX.A;
-		EX_MEM.B = ID_EX.B;
-		EX_MEM.imm = ID_EX.imm;
-		EX_MEM.ALUOutput = 0;
-		EX_MEM.RegisterRS = ID_EX.RegisterRS;
-		EX_MEM.RegisterRT = ID_EX.RegisterRT;
-		EX_MEM.RegisterRD = ID_EX.RegisterRD;
-		EX_MEM.RegWrite = ID_EX.RegWrite;
-		EX_MEM.stall = ID_EX.stall;
-		EX_MEM.Mem = ID_EX.Mem;
-		
-		if (EX_MEM.IR == 0){
-			return;	
+	WATCHPOINTS[NUM_WATCHPOINTS].address = address;
+	WATCHPOINTS[NUM_WATCHPOINTS].mode = mode;
+	NUM_WATCHPOINTS++;
+	WATCH_PAGES[address >> (WATCH_PAGE_SHIFT + 3)] |= 1 << ((address >> WATCH_PAGE_SHIFT) & 7);
+	printf("Watchpoint at 0x%08x (%s%s)\n", address, (mode & WATCH_READ) ? "r" : "", (mode & WATCH_WRITE) ? "w" : "");
+	return 0;
+}
+
+/************************************************************/
+/* Remove a watchpoint and rebuild the armed page bits                                  */ 
+/************************************************************/
+void remove_watchpoint(uint32_t address)
+{
+	int i, j;
+	uint32_t addr;
+
+	address &= ~3;
+	for (i = 0, j = 0; i < NUM_WATCHPOINTS; i++){
+		if (WATCHPOINTS[i].address != address){
+			WATCHPOINTS[j++] = WATCHPOINTS[i];
 		}
-		
-		uint32_t opcode, funct; //sa;
-		opcode = (EX_MEM.IR & 0xFC000000) >> 26;	//Shift left to get opcode bits 26-31
-		funct = EX_MEM.IR & 0x0000003F;	//Get first 6 bits for function code
-		//sa = (EX_MEM.IR & 0x000007C0) >> 6;	//Get shift amount
-		
-		if (opcode == 0x00){	//R-type instruction
-			switch(funct){
-				case 0x20:	//ADD
-					EX_MEM.ALUOutput = EX_MEM.A + EX_MEM.B;	//ADD rd(ALUOutput), rs(A), rt(B)
-					print_instruction(CURRENT_STATE.PC-8);
-					break;
-					
-				case 0x24:	//AND
-					EX_MEM.ALUOutput = EX_MEM.A & EX_MEM.B;	//AND rd(ALUOutput), rs(A), rt(B)
-					print_instruction(CURRENT_STATE.PC-8);
-					break;
-					
-				case 0x25:	//OR
-					EX_MEM.ALUOutput = EX_MEM.A | EX_MEM.B;	//OR rd(ALUOutput), rs(A), rt(B)
-					break;
-					
-				case 0x26:	//XOR	
-					EX_MEM.ALUOutput = EX_MEM.A ^ EX_MEM.B;	//XOR rd(ALUOutput), rs(A), rt(B)
-					print_instruction(CURRENT_STATE.PC-8);
-					break;
-					
-				case 0x0C:	//SYSCALL
-				//	if(CURRENT_STATE.REGS[2] == 0xa){
-                   		//		RUN_FLAG = FALSE;
-                    		//	}
-                    		//	print_instruction(CURRENT_STATE.PC-8);
-					break; 
+		addr = WATCHPOINTS[i].address;
+		WATCH_PAGES[addr >> (WATCH_PAGE_SHIFT + 3)] &= ~(1 << ((addr >> WATCH_PAGE_SHIFT) & 7));
+	}
+	if (j == NUM_WATCHPOINTS){
+		printf("No watchpoint at 0x%08x\n", address);
+	}
+	NUM_WATCHPOINTS = j;
+	for (i = 0; i < NUM_WATCHPOINTS; i++){
+		addr = WATCHPOINTS[i].address;
+		WATCH_PAGES[addr >> (WATCH_PAGE_SHIFT + 3)] |= 1 << ((addr >> WATCH_PAGE_SHIFT) & 7);
+	}
+}
+
+/************************************************************/
+/* Called from MEM for every access while watchpoints exist                          */ 
+/************************************************************/
+void check_watchpoint(uint32_t address, int mode, uint32_t value)
+{
+	int i;
+
+	if (!(WATCH_PAGES[address >> (WATCH_PAGE_SHIFT + 3)] & (1 << ((address >> WATCH_PAGE_SHIFT) & 7)))){
+		return;
+	}
+	for (i = 0; i < NUM_WATCHPOINTS; i++){
+		if (WATCHPOINTS[i].address == (address & ~3) && (WATCHPOINTS[i].mode & mode)){
+			if (!REPLAYING){
+				printf("Watchpoint 0x%08x: %s 0x%08x (cycle %u)\n", address,
+					mode == WATCH_READ ? "read" : "write", value, CYCLE_COUNT);
 			}
+			BREAK_FLAG = 1;
+			return;
 		}
-		else {	//I/J type
-			switch(opcode){
-				case 0x09:	//ADDIU
-					EX_MEM.ALUOutput = EX_MEM.A + EX_MEM.imm;	//ADDIU rt(aluoutput), rs(A), immediate
-					print_instruction(CURRENT_STATE.PC-8);
-					break;
-					
-				case 0x0E:	//XORI
-					EX_MEM.ALUOutput = EX_MEM.A ^ EX_MEM.imm;	//XORI rt(aluotput), rs(A), immediate
-					print_instruction(CURRENT_STATE.PC-8);
-					break;
-					
-				case 0x0F:	//LUI
-					EX_MEM.ALUOutput = EX_MEM.imm << 16;	//Shift immediate left 16 bits and place in ALUOutput
-					print_instruction(CURRENT_STATE.PC-8);
-					break;
-					
-				case 0x23:	//LW
-					EX_MEM.ALUOutput = ID_EX.A + ID_EX.imm;	//aluoutput = a + immediate
-					EX_MEM.A = ID_EX.A;	//Update Memory locations with current values
-					EX_MEM.B = ID_EX.B;
-					EX_MEM.imm = ID_EX.imm;
-                			print_instruction(CURRENT_STATE.PC-8);
-					break;
-					
-				case 0x2B:	//SW
-					EX_MEM.ALUOutput = ID_EX.A + ((ID_EX.imm & 0x8000)>0?(ID_EX.imm | 0xFFFF0000) : (ID_EX.imm & 0x0000FFFF));	//aluoutput = a + immediate
-					EX_MEM.A = ID_EX.A;	//Update Memory locations with current values
-					EX_MEM.B = ID_EX.B;
-					EX_MEM.imm = ID_EX.imm;
-                			print_instruction(CURRENT_STATE.PC-8);
-					break;
-			}
+	}
+}
+
+/************************************************************/
+/* Copy the simulator state that a cycle can change                                          */ 
+/************************************************************/
+void save_context(sim_context_t *ctx)
+{
+	ctx->current = CURRENT_STATE;
+	ctx->if_id = IF_ID;
+	ctx->id_ex = ID_EX;
+	ctx->ex_mem = EX_MEM;
+	ctx->mem_wb = MEM_WB;
+	ctx->stall = stall;
+	ctx->forward_a = ForwardA;
+	ctx->forward_b = ForwardB;
+	ctx->load_stall_a = loadStallA;
+	ctx->load_stall_b = loadStallB;
+	ctx->load_stall = loadStall;
+	ctx->run_flag = RUN_FLAG;
+	ctx->instruction_count = INSTRUCTION_COUNT;
+	ctx->cycle_count = CYCLE_COUNT;
+	ctx->mem_fault_count = MEM_FAULT_COUNT;
+	ctx->mem_fault_address = MEM_FAULT_ADDRESS;
+	memcpy(ctx->exception_count, EXCEPTION_COUNT, sizeof(EXCEPTION_COUNT));
+	ctx->kernel_cycles = KERNEL_CYCLES;
+	ctx->flushed_count = FLUSHED_COUNT;
+	ctx->unhandled_exception = UNHANDLED_EXCEPTION;
+	ctx->heap_base = HEAP_BASE;
+	ctx->heap_break = HEAP_BREAK;
+	ctx->heap_peak = HEAP_PEAK;
+	ctx->stack_low = STACK_LOW;
+	ctx->syscall_count = SYSCALL_COUNT;
+	ctx->unknown_syscall_count = UNKNOWN_SYSCALL_COUNT;
+	ctx->unknown_syscall = UNKNOWN_SYSCALL;
+	ctx->unknown_syscall_pc = UNKNOWN_SYSCALL_PC;
+	ctx->exit_code = EXIT_CODE;
+	ctx->fetch_delay = FETCH_DELAY;
+	ctx->latency_stalls = LATENCY_STALLS;
+	ctx->redirect_bubbles = REDIRECT_BUBBLES;
+	memcpy(ctx->activity, ACTIVITY, sizeof(ACTIVITY));
+	ctx->memsys = MEMSYS;
+}
+
+/************************************************************/
+/* Put back state copied by save_context                                                               */ 
+/************************************************************/
+void restore_context(const sim_context_t *ctx)
+{
+	CURRENT_STATE = ctx->current;
+	NEXT_STATE = ctx->current;
+	REGS_DIRTY = 0;
+	CP0_DIRTY = 0;
+	IF_ID = ctx->if_id;
+	ID_EX = ctx->id_ex;
+	EX_MEM = ctx->ex_mem;
+	MEM_WB = ctx->mem_wb;
+	stall = ctx->stall;
+	ForwardA = ctx->forward_a;
+	ForwardB = ctx->forward_b;
+	loadStallA = ctx->load_stall_a;
+	loadStallB = ctx->load_stall_b;
+	loadStall = ctx->load_stall;
+	RUN_FLAG = ctx->run_flag;
+	INSTRUCTION_COUNT = ctx->instruction_count;
+	CYCLE_COUNT = ctx->cycle_count;
+	MEM_FAULT_COUNT = ctx->mem_fault_count;
+	MEM_FAULT_ADDRESS = ctx->mem_fault_address;
+	memcpy(EXCEPTION_COUNT, ctx->exception_count, sizeof(EXCEPTION_COUNT));
+	KERNEL_CYCLES = ctx->kernel_cycles;
+	FLUSHED_COUNT = ctx->flushed_count;
+	UNHANDLED_EXCEPTION = ctx->unhandled_exception;
+	HEAP_BASE = ctx->heap_base;
+	HEAP_BREAK = ctx->heap_break;
+	HEAP_PEAK = ctx->heap_peak;
+	STACK_LOW = ctx->stack_low;
+	SYSCALL_COUNT = ctx->syscall_count;
+	UNKNOWN_SYSCALL_COUNT = ctx->unknown_syscall_count;
+	UNKNOWN_SYSCALL = ctx->unknown_syscall;
+	UNKNOWN_SYSCALL_PC = ctx->unknown_syscall_pc;
+	EXIT_CODE = ctx->exit_code;
+	FETCH_DELAY = ctx->fetch_delay;
+	LATENCY_STALLS = ctx->latency_stalls;
+	REDIRECT_BUBBLES = ctx->redirect_bubbles;
+	memcpy(ACTIVITY, ctx->activity, sizeof(ACTIVITY));
+	MEMSYS = ctx->memsys;
+}
+
+/************************************************************/
+/* Start recording at the current cycle, or drop every snapshot               */ 
+/************************************************************/
+void set_recording(int on)
+{
+	while (NUM_SNAPSHOTS > 0){
+		free_snapshot(&SNAPSHOTS[--NUM_SNAPSHOTS]);
+	}
+	RECORDING = 0;
+	SNAPSHOT_INTERVAL = SNAPSHOT_INTERVAL_MIN;
+	if (!on){
+		free(PAGE_EPOCH);
+		PAGE_EPOCH = NULL;
+		free(PAGE_MERGE_MARK);
+		PAGE_MERGE_MARK = NULL;
+		return;
+	}
+	if (PAGE_EPOCH == NULL){
+		PAGE_EPOCH = calloc((size_t)1 << (32 - UNDO_PAGE_SHIFT), sizeof(uint32_t));
+		PAGE_MERGE_MARK = calloc((size_t)1 << (32 - UNDO_PAGE_SHIFT), sizeof(uint32_t));
+		MERGE_GENERATION = 0;
+		if (PAGE_EPOCH == NULL || PAGE_MERGE_MARK == NULL){
+			printf("Error: Can't allocate page table for recording\n");
+			free(PAGE_EPOCH);
+			PAGE_EPOCH = NULL;
+			free(PAGE_MERGE_MARK);
+			PAGE_MERGE_MARK = NULL;
+			return;
 		}
 	}
+	RECORDING = 1;
+	take_snapshot();
 }
 
 /************************************************************/
-/* instruction decode (ID) pipeline stage:                                                         */ 
+/* Start a new interval at the current cycle                                                        */ 
 /************************************************************/
-void ID()
-{	
-	if (stall != 0){
-		IF_ID.IR = ID_EX.IR;
-                ID_EX.stall = stall;
-                printf("Stall is needed\n");
-                return;	
+void take_snapshot()
+{
+	snapshot_t *snap;
+
+	if (NUM_SNAPSHOTS == MAX_SNAPSHOTS){
+		thin_snapshots();
 	}
-	
-	if(stall == 0){
-                printf("Executing ID stage\n");
-		ID_EX.IR = IF_ID.IR;
-                ID_EX.PC = IF_ID.PC;
-                ID_EX.A = 0;
-                ID_EX.B = 0;
-                ID_EX.imm = 0;
-                ID_EX.RegWrite = 0;
-                ID_EX.RegisterRD = 0;
-                ID_EX.RegisterRS = 0;
-                ID_EX.RegisterRT = 0;
-
-                uint32_t opcode, funct, rs, rt, rd, imm;// sa;
-
-		opcode = (IF_ID.IR & 0xFC000000) >> 26;
-                funct = IF_ID.IR & 0x0000003F;
-                rs = (IF_ID.IR & 0x03E00000) >> 21;
-                rt = (IF_ID.IR & 0x001F0000) >> 16;
-                rd = (IF_ID.IR & 0x0000F800) >> 11;
-                //sa = (IF_ID.IR & 0x000007C0) >> 6;
-                imm = IF_ID.IR & 0x0000FFFF;
-	
-		if(opcode == 0){
-			ID_EX.RegisterRT = rt;
-			ID_EX.RegisterRS = rs;
-			ID_EX.RegisterRD = rd;
-			ID_EX.RegWrite = 1;
-                        switch(funct){
-                                case 0x20:      //ADD
-                                        ID_EX.A = NEXT_STATE.REGS[rs];
-                                        ID_EX.B = NEXT_STATE.REGS[rt];
-                                        break;
-
-                                case 0x24:      //AND
-                                        ID_EX.A = NEXT_STATE.REGS[rs];
-                                        ID_EX.B = NEXT_STATE.REGS[rt];
-                                        break;
-
-                                case 0x25:      //OR
-                                        ID_EX.A = NEXT_STATE.REGS[rs];
-                                        ID_EX.B = NEXT_STATE.REGS[rt];
-                                        break;
-
-                                case 0x26:      //XOR   
-                                        ID_EX.A = NEXT_STATE.REGS[rs];
-                                        ID_EX.B = NEXT_STATE.REGS[rt];
-                                        break;
-
-                                case 0x0C:      //SYSCALL
-                                        break;
-
-                                default:
-                                        printf("Instruction not handled in ID stage\n");
-                        }
-                }
-		
-		else {  //I or J type
-                        ID_EX.A = NEXT_STATE.REGS[rs];
-                        ID_EX.B = NEXT_STATE.REGS[rt];
-                        ID_EX.RegisterRS = rs;
-                        ID_EX.RegisterRT = rt;
-			ID_EX.RegisterRD = rd;
-
-			if ((imm >> 15) == 1){
-				ID_EX.imm = imm | 0xFFFF0000;	//Sign extend if negative
+	/* keep undo memory bounded by forgetting the oldest intervals */
+	while (UNDO_BYTES > SNAPSHOT_MEM_LIMIT && NUM_SNAPSHOTS > 1){
+		free_snapshot(&SNAPSHOTS[0]);
+		memmove(&SNAPSHOTS[0], &SNAPSHOTS[1], (NUM_SNAPSHOTS - 1) * sizeof(snapshot_t));
+		NUM_SNAPSHOTS--;
+	}
+	snap = &SNAPSHOTS[NUM_SNAPSHOTS++];
+	memset(snap, 0, sizeof(*snap));
+	save_context(&snap->context);
+	snap->epoch = ++SNAPSHOT_EPOCH;
+}
+
+/************************************************************/
+/* Release the undo pages of a snapshot                                                               */ 
+/************************************************************/
+void free_snapshot(snapshot_t *snap)
+{
+	UNDO_BYTES -= (uint64_t)snap->num_undo * sizeof(undo_page_t);
+	free(snap->undo);
+	snap->undo = NULL;
+	snap->num_undo = snap->max_undo = 0;
+	free(snap->touched);
+	snap->touched = NULL;
+	snap->num_touched = snap->max_touched = 0;
+}
+
+/************************************************************/
+/* Append a page to the pages an interval first touched                           */ 
+/************************************************************/
+void add_touched_page(snapshot_t *snap, uint32_t vpn)
+{
+	if (snap->num_touched == snap->max_touched){
+		snap->max_touched = snap->max_touched ? snap->max_touched * 2 : 16;
+		snap->touched = realloc(snap->touched, snap->max_touched * sizeof(uint32_t));
+		assert(snap->touched != NULL);
+	}
+	snap->touched[snap->num_touched++] = vpn;
+}
+
+/************************************************************/
+/* Merge neighbouring intervals pairwise and double the interval           */ 
+/************************************************************/
+void thin_snapshots()
+{
+	snapshot_t *older, *newer;
+	uint32_t i;
+	int k, n = 0;
+
+	for (k = 0; k < NUM_SNAPSHOTS; k += 2){
+		older = &SNAPSHOTS[k];
+		if (k + 1 < NUM_SNAPSHOTS){
+			newer = &SNAPSHOTS[k + 1];
+			/* stamp the older interval's pages with a fresh generation so */
+			/* each page of the newer one is looked up in constant time      */
+			if (++MERGE_GENERATION == 0){
+				memset(PAGE_MERGE_MARK, 0, ((size_t)1 << (32 - UNDO_PAGE_SHIFT)) * sizeof(uint32_t));
+				MERGE_GENERATION = 1;
+			}
+			for (i = 0; i < older->num_undo; i++){
+				PAGE_MERGE_MARK[older->undo[i].address >> UNDO_PAGE_SHIFT] = MERGE_GENERATION;
+			}
+			/* a page first saved by the newer interval is still needed; one */
+			/* the older interval already saved holds the older contents      */
+			for (i = 0; i < newer->num_undo; i++){
+				if (PAGE_MERGE_MARK[newer->undo[i].address >> UNDO_PAGE_SHIFT] != MERGE_GENERATION){
+					if (older->num_undo == older->max_undo){
+						older->max_undo = older->max_undo ? older->max_undo * 2 : 16;
+						older->undo = realloc(older->undo, older->max_undo * sizeof(undo_page_t));
+						assert(older->undo != NULL);
+					}
+					older->undo[older->num_undo++] = newer->undo[i];
+					UNDO_BYTES += sizeof(undo_page_t);
+				}
 			}
-			else{
-				ID_EX.imm = imm & 0x0000FFFF;	//Else it's positive
+			/* a page is first touched once, so the two lists never overlap */
+			for (i = 0; i < newer->num_touched; i++){
+				add_touched_page(older, newer->touched[i]);
 			}
+			free_snapshot(newer);
+		}
+		SNAPSHOTS[n++] = *older;
+	}
+	NUM_SNAPSHOTS = n;
+	SNAPSHOT_INTERVAL *= 2;
+}
 
-                        switch (opcode){
-                                case 0x23:      //LW
-                                        ID_EX.RegWrite = 1;
-                                        break;
-                                case 0x2B:      //SW
-                                        ID_EX.RegWrite = 0;
-                                        break;
-                                default:
-                                        ID_EX.RegWrite = 1;
-                        }
+/************************************************************/
+/* Save a page before its first write in the current interval                    */ 
+/************************************************************/
+void record_page(uint32_t address)
+{
+	snapshot_t *snap = &SNAPSHOTS[NUM_SNAPSHOTS - 1];
+	uint32_t page = address >> UNDO_PAGE_SHIFT;
+	uint32_t avail;
+	uint8_t *ptr;
 
-                }
+	if (PAGE_EPOCH[page] >= snap->epoch){
+		return;
+	}
+	PAGE_EPOCH[page] = snap->epoch;
+	ptr = mem_host_ptr(page << UNDO_PAGE_SHIFT, &avail);
+	if (ptr == NULL){
+		return;
+	}
+	if (snap->num_undo == snap->max_undo){
+		snap->max_undo = snap->max_undo ? snap->max_undo * 2 : 16;
+		snap->undo = realloc(snap->undo, snap->max_undo * sizeof(undo_page_t));
+		assert(snap->undo != NULL);
 	}
+	snap->undo[snap->num_undo].address = page << UNDO_PAGE_SHIFT;
+	memcpy(snap->undo[snap->num_undo].data, ptr, UNDO_PAGE_SIZE);
+	snap->num_undo++;
+	UNDO_BYTES += sizeof(undo_page_t);
+}
 
-	
-	ForwardData();	//Check for data hazard and see if we can forward
+/************************************************************/
+/* Note a page the TLB walk marked touched, so a rollback clears it again */ 
+/************************************************************/
+void record_touched_page(uint32_t vpn)
+{
+	add_touched_page(&SNAPSHOTS[NUM_SNAPSHOTS - 1], vpn);
+}
 
-	if (stall != 0){
-		printf("Data Hazard in ID stage\n");
-		ID_EX.stall = 1;
-	}
-	else{
-		ID_EX.stall = 0;	
+/************************************************************/
+/* Roll memory and state back to the start of snapshot k                              */ 
+/************************************************************/
+int restore_snapshot(int k)
+{
+	snapshot_t *snap;
+	uint32_t avail, i;
+	uint8_t *ptr;
+
+	if (k < 0 || k >= NUM_SNAPSHOTS){
+		return -1;
 	}
-	
-	if (ForwardA == 01){
-		ID_EX.A = EX_MEM.ALUOutput;
-		ForwardA = 0;
-	}
-	if (ForwardB == 01){
-		ID_EX.B = EX_MEM.ALUOutput;
-		ForwardB = 0;
-	}
-	if (ForwardA == 10){
-		uint32_t opcode;
-		opcode = (IF_ID.IR & 0xFC000000) >> 26;
-		if (opcode == 0x20 || opcode == 0x21 || opcode == 0x23){	//For loads
-//			if (loadStallA == 1){
-				ID_EX.A = MEM_WB.LMD;
-				loadStall = 1;
-//				loadStallA = 0;
-//			}
-//			else {
-//				loadStallA = 1;
-//				++stall;
-//			}
-		}		
-		else{
-			ID_EX.A = MEM_WB.ALUOutput;	//If not load	
+	/* undo the newest interval first so the oldest copy of a page wins */
+	while (NUM_SNAPSHOTS > k){
+		snap = &SNAPSHOTS[NUM_SNAPSHOTS - 1];
+		for (i = 0; i < snap->num_undo; i++){
+			ptr = mem_host_ptr(snap->undo[i].address, &avail);
+			memcpy(ptr, snap->undo[i].data, UNDO_PAGE_SIZE);
 		}
-		ForwardA = 0;
-	}
-	if (ForwardB == 10){
-		uint32_t opcode;
-                opcode = (IF_ID.IR & 0xFC000000) >> 26;
-		if (opcode == 0x20 || opcode == 0x21 || opcode == 0x23){	//For loads
-//			if (loadStallB == 1){
-				ID_EX.B = MEM_WB.LMD;
-				loadStall = 1;
-//				loadStallB = 0;
-//			}
-//			else{
-//				loadStallB = 1;
-//				++stall;
-//			}
+		for (i = 0; i < snap->num_touched; i++){
+			MEMSYS.touched[snap->touched[i] >> 3] &= ~(1 << (snap->touched[i] & 7));
 		}
-		else{
-			ID_EX.B = MEM_WB.ALUOutput;	//If not load	
+		free_snapshot(snap);
+		NUM_SNAPSHOTS--;
+	}
+	/* snapshot k starts over with no pages saved */
+	snap = &SNAPSHOTS[NUM_SNAPSHOTS++];
+	restore_context(&snap->context);
+	snap->epoch = ++SNAPSHOT_EPOCH;
+	return 0;
+}
+
+/************************************************************/
+/* Re-simulate silently up to a cycle, noting the last stop point            */ 
+/************************************************************/
+void replay_to(uint32_t cycle_count, uint32_t *last_hit)
+{
+	int trace = TRACE_ENABLED;
+
+	TRACE_ENABLED = 0;
+	REPLAYING = 1;
+	select_pipeline();
+	while (CYCLE_COUNT < cycle_count && RUN_FLAG){
+		cycle();
+		if (BREAK_FLAG){
+			BREAK_FLAG = 0;
+			if (last_hit != NULL){
+				*last_hit = CYCLE_COUNT;
+			}
 		}
-		ForwardB = 0;
 	}
-	
+	REPLAYING = 0;
+	TRACE_ENABLED = trace;
+	select_pipeline();
 }
 
 /************************************************************/
-/* instruction fetch (IF) pipeline stage:                                                              */ 
+/* Go back n cycles: nearest earlier snapshot, then replay forward          */ 
 /************************************************************/
-void IF()
-{	//something with memread
-	/*IMPLEMENT THIS*/
-	//First stage
-	
-	if (stall == 0){	//Fetch instruction if there's no stall
-		IF_ID.IR = mem_read_32(CURRENT_STATE.PC);	//Get current value in memory
-		IF_ID.PC = CURRENT_STATE.PC + 4;	//Increment counter
-		NEXT_STATE.PC = IF_ID.PC;	//Store incremented counter into pc's next state
+void reverse_step(uint32_t n)
+{
+	uint32_t target;
+	int k;
+
+	if (!RECORDING){
+		printf("Recording is off, use \"record 1\" first.\n");
+		return;
 	}
-	else{
-		printf("Stalled in IF Stage\n");	
+	target = (n > CYCLE_COUNT) ? 0 : CYCLE_COUNT - n;
+	if (target < SNAPSHOTS[0].context.cycle_count){
+		printf("Cycle %u is older than the oldest snapshot.\n", target);
+		target = SNAPSHOTS[0].context.cycle_count;
 	}
+	for (k = NUM_SNAPSHOTS - 1; k > 0 && SNAPSHOTS[k].context.cycle_count > target; k--);
+	restore_snapshot(k);
+	replay_to(target, NULL);
+	printf("Stepped back to cycle %u (PC 0x%08x)\n\n", CYCLE_COUNT, CURRENT_STATE.PC);
 }
 
-// Check for Data Hazard and forward under conditions given to us in lab assignment
-void ForwardData()
+/************************************************************/
+/* Go back to the most recent earlier breakpoint/watchpoint stop             */ 
+/************************************************************/
+void reverse_continue()
 {
-	//Forward from EX stage for A
-	if ((EX_MEM.RegWrite && (EX_MEM.RegisterRD != 0)) && (EX_MEM.RegisterRD == ID_EX.RegisterRS)){
-		if (ENABLE_FORWARDING == 1){
-			ForwardA = 01;	
+	uint32_t now = CYCLE_COUNT, hit;
+	uint32_t orig = CYCLE_COUNT;
+	uint32_t start;
+	int k;
+
+	if (!RECORDING){
+		printf("Recording is off, use \"record 1\" first.\n");
+		return;
+	}
+	if (now == 0){
+		return;
+	}
+	/* search the intervals newest first; replaying one recreates the later ones */
+	for (k = NUM_SNAPSHOTS - 1; k >= 0; k--){
+		start = SNAPSHOTS[k].context.cycle_count;
+		if (start >= now){
+			continue;
 		}
-		else{
-			stall = 2;	
+		hit = 0;
+		restore_snapshot(k);
+		replay_to(now - 1, &hit);
+		if (hit != 0 && hit > start){
+			restore_snapshot(k);
+			replay_to(hit, NULL);
+			printf("Stopped at cycle %u (PC 0x%08x)\n\n", CYCLE_COUNT, CURRENT_STATE.PC);
+			return;
 		}
+		now = start + 1;
 	}
-	
-	if ((EX_MEM.RegWrite && (EX_MEM.RegisterRD != 0)) && (EX_MEM.RegisterRD == ID_EX.RegisterRT)){
-		if (ENABLE_FORWARDING == 1){
-			ForwardB = 01;	
-		}
-		else{
-			stall = 2;	
-		}	
-	}
-
-	if ((EX_MEM.RegWrite && (EX_MEM.RegisterRT != 0)) && (EX_MEM.RegisterRT == ID_EX.RegisterRS)){
-                if (ENABLE_FORWARDING == 1){
-                        ForwardA = 01;
-                }
-                else{
-                        stall = 2;
-                }
-        }
-
-	if ((EX_MEM.RegWrite && (EX_MEM.RegisterRT != 0)) && (EX_MEM.RegisterRT == ID_EX.RegisterRT)){
-                if (ENABLE_FORWARDING == 1){
-                        ForwardB = 01;
-                }
-                else{
-                        stall = 2;
-                }
-        }
-	
-	if ((MEM_WB.RegWrite && (MEM_WB.RegisterRD != 0)) && !(EX_MEM.RegWrite && (EX_MEM.RegisterRD != 0) &&
-(EX_MEM.RegisterRD = ID_EX.RegisterRS)) && (MEM_WB.RegisterRD == ID_EX.RegisterRS)){
-                if (ENABLE_FORWARDING == 1){
-                        ForwardA = 10;
-                }
-                else{
-                        stall = 1;
-                }
-        }
-
-        if ((MEM_WB.RegWrite && (MEM_WB.RegisterRD != 0)) && (!((EX_MEM.RegWrite && (EX_MEM.RegisterRD != 0)) &&
-(EX_MEM.RegisterRD = ID_EX.RegisterRT))) && (MEM_WB.RegisterRD == ID_EX.RegisterRT)){
-                if (ENABLE_FORWARDING == 1){
-                        ForwardB = 10;
-                }
-                else{
-                        stall = 1;
-                }
-        }
-
-        if ((MEM_WB.RegWrite && (MEM_WB.RegisterRT != 0)) && (!((EX_MEM.RegWrite && (EX_MEM.RegisterRT != 0)) &&
-(EX_MEM.RegisterRT = ID_EX.RegisterRS))) &&  (MEM_WB.RegisterRT == ID_EX.RegisterRS)){
-                if (ENABLE_FORWARDING == 1){
-                        ForwardA = 10;
-                }
-                else{
-                        stall = 1;
-                }
-        }
-
-        if ((MEM_WB.RegWrite && (MEM_WB.RegisterRT != 0)) && (!((EX_MEM.RegWrite && (EX_MEM.RegisterRT != 0)) &&
-(EX_MEM.RegisterRT = ID_EX.RegisterRT))) && (MEM_WB.RegisterRT ==ID_EX.RegisterRT)){
-                if (ENABLE_FORWARDING == 1){
-                        ForwardB = 10;
-                }
-                else{
-                        stall = 1;
-                }
-        }
+	/* nothing found: come back to where we started */
+	replay_to(orig, NULL);
+	printf("No earlier stop point, back at cycle %u.\n\n", CYCLE_COUNT);
 }
 
-
 /************************************************************/
 /* Initialize Memory                                                                                                    */ 
 /************************************************************/
 void initialize() { 
 	init_memory();
+	init_decoder();
+	default_machine(&MACHINE);
 	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
+	CURRENT_STATE.REGS[29] = STACK_POINTER_INIT;
+	CURRENT_STATE.REGS[28] = GLOBAL_POINTER_INIT;
 	NEXT_STATE = CURRENT_STATE;
 	RUN_FLAG = TRUE;
 	stall = 0;
@@ -1046,10 +1840,15 @@ void initialize() {
 void print_program(){
 	/*IMPLEMENT THIS*/
 	int i;
-	uint32_t addr;
+	uint32_t addr, offset;
+	const symbol_t *sym;
 	
 	for(i=0; i<PROGRAM_SIZE; i++){
 		addr = MEM_TEXT_BEGIN + (i*4);
+		sym = symbol_at(addr, &offset);
+		if (sym != NULL && offset == 0){
+			printf("%s:\n", sym->name);
+		}
 		printf("[0x%x]\t", addr);
 		print_instruction(addr);
 	}
@@ -1059,174 +1858,9 @@ void print_program(){
 /* Print the instruction at given memory address (in MIPS assembly format)    */
 /************************************************************/
 void print_instruction(uint32_t addr){
-	uint32_t instruction, opcode, function, rs, rt, rd, sa, immediate, target;
-	
-	instruction = mem_read_32(addr);
-	
-	opcode = (instruction & 0xFC000000) >> 26;
-	function = instruction & 0x0000003F;
-	rs = (instruction & 0x03E00000) >> 21;
-	rt = (instruction & 0x001F0000) >> 16;
-	rd = (instruction & 0x0000F800) >> 11;
-	sa = (instruction & 0x000007C0) >> 6;
-	immediate = instruction & 0x0000FFFF;
-	target = instruction & 0x03FFFFFF;
-	
-	if(opcode == 0x00){
-		/*R format instructions here*/
-		
-		switch(function){
-			case 0x00:
-				printf("SLL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x02:
-				printf("SRL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x03:
-				printf("SRA $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x08:
-				printf("JR $r%u\n", rs);
-				break;
-			case 0x09:
-				if(rd == 31){
-					printf("JALR $r%u\n", rs);
-				}
-				else{
-					printf("JALR $r%u, $r%u\n", rd, rs);
-				}
-				break;
-			case 0x0C:
-				printf("SYSCALL\n");
-				break;
-			case 0x10:
-				printf("MFHI $r%u\n", rd);
-				break;
-			case 0x11:
-				printf("MTHI $r%u\n", rs);
-				break;
-			case 0x12:
-				printf("MFLO $r%u\n", rd);
-				break;
-			case 0x13:
-				printf("MTLO $r%u\n", rs);
-				break;
-			case 0x18:
-				printf("MULT $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x19:
-				printf("MULTU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1A:
-				printf("DIV $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1B:
-				printf("DIVU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x20:
-				printf("ADD $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x21:
-				printf("ADDU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x22:
-				printf("SUB $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x23:
-				printf("SUBU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x24:
-				printf("AND $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x25:
-				printf("OR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x26:
-				printf("XOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x27:
-				printf("NOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x2A:
-				printf("SLT $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			default:
-				printf("Instruction is not implemented!\n");
-				break;
-		}
-	}
-	else{
-		switch(opcode){
-			case 0x01:
-				if(rt == 0){
-					printf("BLTZ $r%u, 0x%x\n", rs, immediate<<2);
-				}
-				else if(rt == 1){
-					printf("BGEZ $r%u, 0x%x\n", rs, immediate<<2);
-				}
-				break;
-			case 0x02:
-				printf("J 0x%x\n", (addr & 0xF0000000) | (target<<2));
-				break;
-			case 0x03:
-				printf("JAL 0x%x\n", (addr & 0xF0000000) | (target<<2));
-				break;
-			case 0x04:
-				printf("BEQ $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x05:
-				printf("BNE $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x06:
-				printf("BLEZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x07:
-				printf("BGTZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x08:
-				printf("ADDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x09:
-				printf("ADDIU $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0A:
-				printf("SLTI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0C:
-				printf("ANDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0D:
-				printf("ORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0E:
-				printf("XORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0F:
-				printf("LUI $r%u, 0x%x\n", rt, immediate);
-				break;
-			case 0x20:
-				printf("LB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x21:
-				printf("LH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x23:
-				printf("LW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x28:
-				printf("SB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x29:
-				printf("SH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x2B:
-				printf("SW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			default:
-				printf("Instruction is not implemented!\n");
-				break;
-		}
-	}
+	char buf[INSTR_STRING_SIZE];
+
+	printf("%s\n", format_instruction(mem_read_32(addr), addr, buf, sizeof(buf)));
 }
 
 /************************************************************/
@@ -1234,46 +1868,42 @@ void print_instruction(uint32_t addr){
 /************************************************************/
 void show_pipeline(){
 	/*IMPLEMENT THIS*/
-	printf("\nCurrent PC: %X", CURRENT_STATE.PC);
-	printf("\nIF/ID.IR:  %X  instruction:   ", IF_ID.IR);
-	print_instruction(CURRENT_STATE.PC);
-	printf("\nIF/ID.PC: %X\n\n", IF_ID.PC );
-	
-	printf("\nID/EX.IR: %X    instruction:   ", ID_EX.IR);
-	print_instruction(CURRENT_STATE.PC);
-	printf("\nID/EX.IR:  %X", ID_EX.IR);
-	printf("\nID/EX.A:  %X",ID_EX.A);
-	printf("\nID/EX.B:  %X\n\n",ID_EX.B);
-	
-	printf("\nEX/MEM.IR:  %X", EX_MEM.IR);
+	char where[ADDRESS_STRING_SIZE];
+
+	printf("\nCurrent PC: %s\n", format_address(CURRENT_STATE.PC, where, sizeof(where)));
+
+	show_latch("IF/ID", &IF_ID);
+	printf("\n");
+
+	show_latch("ID/EX", &ID_EX);
+	printf("\nID/EX.A:  %X", ID_EX.A);
+	printf("\nID/EX.B:  %X", ID_EX.B);
+	printf("\nID/EX.imm:  %X\n", ID_EX.imm);
+
+	show_latch("EX/MEM", &EX_MEM);
 	printf("\nEX/MEM.A:  %X", EX_MEM.A);
-	printf("\nEX/MEM.B:  %X",EX_MEM.B);
-	printf("\nEX/MEM.ALUOutput:  %X\n\n",EX_MEM.ALUOutput);
-	
-	printf("\nMEM/WB.IR:  %X",MEM_WB.IR);
-	printf("\nMEM/WB.ALUOutput:  %X",MEM_WB.ALUOutput);
-	printf("\nMEM/WB.LMD:  %X\n\n",MEM_WB.LMD );
+	printf("\nEX/MEM.B:  %X", EX_MEM.B);
+	printf("\nEX/MEM.ALUOutput:  %X\n", EX_MEM.ALUOutput);
+
+	show_latch("MEM/WB", &MEM_WB);
+	printf("\nMEM/WB.ALUOutput:  %X", MEM_WB.ALUOutput);
+	printf("\nMEM/WB.LMD:  %X\n\n", MEM_WB.LMD);
 }
 
-/***************************************************************/
-/* main                                                                                                                                   */
-/***************************************************************/
-int main(int argc, char *argv[]) {                              
-	printf("\n**************************\n");
-	printf("Welcome to MU-MIPS SIM...\n");
-	printf("**************************\n\n");
-	
-	if (argc < 2) {
-		printf("Error: You should provide input file.\nUsage: %s <input program> \n\n",  argv[0]);
-		exit(1);
-	}
+/************************************************************/
+/* Print the instruction a pipeline register holds, at its own address     */
+/************************************************************/
+void show_latch(const char *name, const CPU_Pipeline_Reg *latch){
+	char buf[INSTR_STRING_SIZE], where[ADDRESS_STRING_SIZE];
 
-	strcpy(prog_file, argv[1]);
-	initialize();
-	load_program();
-	help();
-	while (1){
-		handle_command();
+	if (latch->PC == 0){
+		printf("\n%s.IR:  %X    (bubble)", name, latch->IR);
+		return;
+	}
+	/* latches carry the address of the next instruction */
+	printf("\n%s.PC:  %s", name, format_address(latch->PC - 4, where, sizeof(where)));
+	printf("\n%s.IR:  %X    instruction:   %s", name, latch->IR, format_instruction(latch->IR, latch->PC - 4, buf, sizeof(buf)));
+	if (latch->Exception != 0){
+		printf("    [%s]", exception_name(latch->Exception));
 	}
-	return 0;
 }
@@ -1,4 +1,9 @@
+#ifndef MU_MIPS_H
+#define MU_MIPS_H
+
 #include <stdint.h>
+#include <pthread.h>
+#include <time.h>
 
 #define FALSE 0
 #define TRUE  1
@@ -8,9 +13,10 @@
 /******************************************************************************/
 #define MEM_TEXT_BEGIN  0x00400000
 #define MEM_TEXT_END      0x0FFFFFFF
-/*Memory address 0x10000000 to 0x1000FFFF access by $gp*/
-#define MEM_DATA_BEGIN  0x10010000
-#define MEM_DATA_END   0x7FFFFFFF
+/*Memory address 0x10000000 to 0x1000FFFF access by $gp (.extern), part of the data region*/
+#define MEM_EXTERN_BEGIN 0x10000000
+#define MEM_DATA_BEGIN  0x10010000	/* start of .data */
+#define MEM_DATA_END   0x7F7FEFFF
 
 #define MEM_KTEXT_BEGIN 0x80000000
 #define MEM_KTEXT_END  0x8FFFFFFF
@@ -18,24 +24,53 @@
 #define MEM_KDATA_BEGIN 0x90000000
 #define MEM_KDATA_END  0xFFFEFFFF
 
-/*stack and data segments occupy the same memory space. Stack grows backward (from higher address to lower address) */
-#define MEM_STACK_BEGIN 0x7FFFFFFF
-#define MEM_STACK_END  0x10010000
+/*stack grows backward (from higher address to lower address), from MEM_STACK_BEGIN down to MEM_STACK_END */
+#define MEM_STACK_BEGIN 0x7FFFFFFFU
+#define MEM_STACK_END  0x7F800000	/* 8 MB */
+#define STACK_GUARD_SIZE 0x1000	/* unmapped page below the stack, so overflow traps */
+
+#define STACK_POINTER_INIT 0x7FFFFFFC	/* $sp at reset: the top word of the stack */
+#define GLOBAL_POINTER_INIT 0x10008000	/* $gp at reset: middle of the .extern area */
 
 typedef struct {
 	uint32_t begin, end;
 	uint8_t *mem;
 } mem_region_t;
 
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
-	{ MEM_TEXT_BEGIN, MEM_TEXT_END, NULL },
-	{ MEM_DATA_BEGIN, MEM_DATA_END, NULL },
-	{ MEM_KDATA_BEGIN, MEM_KDATA_END, NULL },
-	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, NULL }
-};
+#define NUM_MEM_REGION 5
+
+/* memory will be dynamically allocated at initialization; pages are only */
+/* backed by the host once touched */
+extern mem_region_t MEM_REGIONS[NUM_MEM_REGION];
+
+#define MEM_DATA_REGION 1	/* index of the data region in MEM_REGIONS */
+#define MEM_STACK_REGION 2	/* index of the stack region */
+#define DUMP_PAGE_SIZE 4096	/* unit mdiff hashes and compares */
+
+/* host files mapped over part of the data region */
+typedef struct {
+	char path[256];
+	uint32_t address;	/* guest address of the first byte */
+	uint32_t size;		/* mapped length, rounded up to a host page */
+	int shared;		/* MAP_SHARED instead of MAP_PRIVATE */
+} file_map_t;
+
+#define MAX_FILE_MAPS 8
+extern file_map_t FILE_MAPS[MAX_FILE_MAPS];
+extern int NUM_FILE_MAPS;
+
+/* accesses outside every region, or running past a region's end */
+extern uint32_t MEM_FAULT_COUNT;
+extern uint32_t MEM_FAULT_ADDRESS;
+extern uint32_t STACK_LOW;	/* lowest stack address written since reset */
+
+/* pages written since the last reset_dirty_pages(), for O(dirty) resets */
+#define DIRTY_PAGE_SHIFT 12
+extern int DIRTY_TRACKING;
+extern uint8_t *DIRTY_MAP;	/* one bit per guest page */
+extern uint32_t *DIRTY_LIST;
+extern uint32_t NUM_DIRTY, MAX_DIRTY;
 
-#define NUM_MEM_REGION 4
 #define MIPS_REGS 32
 
 typedef struct CPU_State_Struct {
@@ -43,9 +78,11 @@ typedef struct CPU_State_Struct {
   uint32_t PC;		                   /* program counter */
   uint32_t REGS[MIPS_REGS]; /* register file. */
   uint32_t HI, LO;                          /* special regs for mult/div. */
+  uint32_t CP0[MIPS_REGS];	/* coprocessor 0: Status, Cause, EPC, timer */
 } CPU_State;
 
 typedef struct CPU_Pipeline_Reg_Struct{
+	/* hot: the stages touch these every cycle */
 	uint32_t PC;
 	uint32_t IR;
 	uint32_t A;
@@ -53,63 +90,725 @@ typedef struct CPU_Pipeline_Reg_Struct{
 	uint32_t imm;
 	uint32_t ALUOutput;
 	uint32_t LMD;
-	uint32_t RegisterRD;
-	uint32_t RegisterRS;
-	uint32_t RegisterRT;
-	uint32_t RegWrite;
-	uint32_t Mem;
-	int stall;
-	
+	uint8_t RegisterRD;	/* register numbers and flags each fit a byte */
+	uint8_t RegisterRS;
+	uint8_t RegisterRT;
+	uint8_t RegWrite;
+	uint8_t Mem;
+	uint8_t stall;
+	uint8_t Exception;	/* EXC_* raised by this instruction, 0 if none (EXC_INT is never latched) */
+	/* cold: only written on a fault */
+	uint32_t BadVAddr;	/* faulting address for address and bus errors */
 } CPU_Pipeline_Reg;
 
+/***************************************************************/
+/* Coprocessor 0 and exceptions                                                                            */
+/*                                                                                                                             */
+/* Exceptions are tagged in the pipeline register of the faulting              */
+/* instruction and taken when it reaches WB, so every older instruction  */
+/* has completed and nothing younger has touched registers or memory.     */
+/***************************************************************/
+#define CP0_BADVADDR 8
+#define CP0_COUNT    9
+#define CP0_COMPARE  11
+#define CP0_STATUS   12
+#define CP0_CAUSE    13
+#define CP0_EPC      14
+
+#define STATUS_IE  0x00000001	/* interrupts enabled */
+#define STATUS_EXL 0x00000002	/* in the handler: interrupts off, SYSCALL goes to the host */
+#define STATUS_IM7 0x00008000	/* timer interrupt unmasked */
+#define CAUSE_IP7  0x00008000	/* timer interrupt pending, cleared by writing Compare */
+#define CAUSE_EXC_SHIFT 2
+#define CAUSE_EXC_MASK  0x0000007C
+
+#define EXC_INT  0	/* interrupt */
+#define EXC_ADEL 4	/* unaligned load or fetch */
+#define EXC_ADES 5	/* unaligned store */
+#define EXC_IBE  6	/* fetch from unmapped memory */
+#define EXC_DBE  7	/* load or store to unmapped memory */
+#define EXC_SYS  8	/* SYSCALL outside the handler */
+#define EXC_RI   10	/* reserved instruction */
+#define EXC_OV   12	/* ADD, ADDI or SUB overflow */
+#define NUM_EXC_CODES 32
+
+#define EXCEPTION_VECTOR 0x80000180	/* the kernel image is loaded here */
+
+extern char kernel_file[256];
+extern uint32_t KERNEL_SIZE;	/* words at EXCEPTION_VECTOR; without a handler exceptions stop the run */
+extern uint32_t EXCEPTION_COUNT[NUM_EXC_CODES];
+extern uint32_t KERNEL_CYCLES;	/* cycles spent with Status.EXL set */
+extern uint32_t FLUSHED_COUNT;	/* instructions squashed by exceptions, ERET and syscalls */
+extern int UNHANDLED_EXCEPTION;
+
+/***************************************************************/
+/* Host syscalls, SPIM/MARS numbering (mu-mips-syscall.c)                     */
+/***************************************************************/
+#define SYS_PRINT_INT    1
+#define SYS_PRINT_STRING 4
+#define SYS_READ_INT     5
+#define SYS_READ_STRING  8
+#define SYS_SBRK         9
+#define SYS_EXIT         10
+#define SYS_PRINT_CHAR   11
+#define SYS_READ_CHAR    12
+#define SYS_OPEN         13
+#define SYS_READ         14
+#define SYS_WRITE        15
+#define SYS_CLOSE        16
+#define SYS_EXIT2        17
+
+#define HEAP_ALIGN 8	/* the first sbrk block starts this aligned after the static data */
+#define HEAP_LIMIT 0x70000000	/* sbrk fails past this */
+
+#define GUEST_OUT_SIZE 8192	/* guest stdout is batched, flushed when full or the run stops */
+#define MAX_GUEST_FILES 16	/* guest fds 3.. map to these host fds */
+
+/* host effects of a syscall, so re-running a cycle after reverse-step */
+/* replays the result instead of printing, reading or writing again      */
+typedef struct {
+	uint32_t cycle;
+	uint32_t v0;		/* $v0 after the call */
+	uint32_t address;	/* guest bytes the call filled in */
+	uint32_t length;
+	uint8_t *data;
+} syscall_record_t;
+
+extern uint32_t HEAP_BASE;	/* break at reset, just past the loaded .data */
+extern uint32_t HEAP_BREAK;
+extern uint32_t HEAP_PEAK;	/* highest break since reset */
+extern uint32_t SYSCALL_COUNT;
+extern uint32_t UNKNOWN_SYSCALL_COUNT;	/* $v0 values the simulator does not emulate */
+extern uint32_t UNKNOWN_SYSCALL, UNKNOWN_SYSCALL_PC;	/* the last one */
+extern int EXIT_CODE;
+extern char GUEST_OUT[GUEST_OUT_SIZE];
+extern uint32_t GUEST_OUT_LEN;
+extern int GUEST_FILES[MAX_GUEST_FILES];
+extern syscall_record_t *SYSCALL_LOG;
+extern uint32_t SYSCALL_LOG_LEN, SYSCALL_LOG_MAX;
+
+/***************************************************************/
+/* Assembler and symbol table (mu-mips-asm.c)                                            */
+/***************************************************************/
+#define ASM_TEXT  0
+#define ASM_DATA  1
+#define ASM_KTEXT 2	/* starts at EXCEPTION_VECTOR unless given an address */
+#define ASM_KDATA 3
+#define ASM_SECTIONS 4
+
+typedef struct {
+	uint32_t base;		/* guest address of the first byte */
+	uint32_t size;		/* bytes assembled */
+	uint8_t *bytes;		/* in guest byte order, NULL if empty */
+} asm_section_t;
+
+#define SYMBOL_NAME_SIZE 64
+#define ADDRESS_STRING_SIZE (SYMBOL_NAME_SIZE + 32)	/* format_address() output */
+typedef struct {
+	char name[SYMBOL_NAME_SIZE];
+	uint32_t address;
+} symbol_t;
+
+extern const char *REG_NAMES[MIPS_REGS];
+extern symbol_t *SYMBOLS;	/* labels of the loaded program and kernel, by address */
+extern uint32_t NUM_SYMBOLS;
+
+/***************************************************************/
+/* Instruction table and decoder (mu-mips-decode.c)                                    */
+/***************************************************************/
+/* operand layouts, shared by the assembler and disassembler */
+#define FMT_R3      0	/* rd, rs, rt */
+#define FMT_SHIFT   1	/* rd, rt, sa */
+#define FMT_SHIFTV  2	/* rd, rt, rs */
+#define FMT_JR      3	/* rs */
+#define FMT_JALR    4	/* [rd,] rs */
+#define FMT_MULDIV  5	/* rs, rt */
+#define FMT_MFHL    6	/* rd */
+#define FMT_MTHL    7	/* rs */
+#define FMT_NONE    8	/* no operands */
+#define FMT_IMM     9	/* rt, rs, signed imm */
+#define FMT_IMMU    10	/* rt, rs, unsigned imm */
+#define FMT_LUI     11	/* rt, imm */
+#define FMT_MEM     12	/* rt, offset(rs) or rt, address */
+#define FMT_BRANCH2 13	/* rs, rt, label */
+#define FMT_BRANCH1 14	/* rs, label */
+#define FMT_JUMP    15	/* label */
+#define FMT_COP0    16	/* rt, rd */
+
+/* what the stages do with an instruction */
+#define OP_NONE    0	/* not executed by the pipeline */
+#define OP_ADD     1	/* add, addi: trap on overflow */
+#define OP_ADDU    2	/* addu, addiu */
+#define OP_SUB     3
+#define OP_AND     4	/* and, andi */
+#define OP_OR      5	/* or, ori */
+#define OP_XOR     6	/* xor, xori */
+#define OP_LUI     7
+#define OP_LOAD    8	/* address in EX, access in MEM */
+#define OP_STORE   9
+#define OP_MFC0    10	/* reads CP0 in EX */
+#define OP_MTC0    11	/* writes CP0 in WB */
+#define OP_ERET    12
+#define OP_SYSCALL 13
+#define OP_SUBU    14
+#define OP_NOR     15
+#define OP_SLT     16	/* slt, slti */
+#define OP_SLTU    17	/* sltu, sltiu: unsigned compare, sign-extended immediate */
+#define OP_SLL     18	/* sll, sllv: funct bit 2 picks rs over sa as the amount */
+#define OP_SRL     19	/* srl, srlv */
+#define OP_SRA     20	/* sra, srav */
+
+/* register_use() flags */
+#define REG_READS_RS  0x1
+#define REG_READS_RT  0x2
+#define REG_WRITES_RD 0x4
+#define REG_WRITES_RT 0x8
+
+typedef struct {
+	const char *name;	/* mnemonic as written in assembly */
+	int format;
+	uint32_t opcode;	/* bits 31..26 */
+	uint32_t code;		/* funct of SPECIAL, rt of REGIMM, rs of COP0, low bits of FMT_NONE */
+	int op;			/* OP_* */
+} instr_desc_t;
+
+#define INSTR_STRING_SIZE (ADDRESS_STRING_SIZE + 32)	/* format_instruction() output */
+extern const instr_desc_t INSTRUCTIONS[];	/* NULL name ends the table */
+
+/***************************************************************/
+/* Machine description (mu-mips-machine.c)                                                    */
+/*                                                                                                                             */
+/* The datapath is always IF ID EX MEM WB; a description sets how many  */
+/* cycles each stage takes, how long each unit stays busy, which            */
+/* forwarding paths exist and what each counted activity costs in energy.  */
+/* Stall distances are derived from it, and the default reproduces the    */
+/* classic pipeline cycle for cycle.                                                                   */
+/***************************************************************/
+#define STAGE_IF  0
+#define STAGE_ID  1
+#define STAGE_EX  2
+#define STAGE_MEM 3
+#define STAGE_WB  4
+#define NUM_STAGES 5
+
+#define UNIT_ALU    0
+#define UNIT_MULDIV 1
+#define UNIT_LOAD   2
+#define UNIT_STORE  3
+#define NUM_UNITS   4
+
+#define TLB_I 0	/* instruction TLB, looked up by IF */
+#define TLB_D 1	/* data TLB, looked up by MEM */
+#define NUM_TLBS 2
+#define MAX_TLB_ENTRIES 256
+#define TLB_REFILL_HARDWARE 0	/* a walker reads the PTE */
+#define TLB_REFILL_SOFTWARE 1	/* a trap to a refill handler does */
+
+#define CACHE_I 0	/* instruction cache, read by IF */
+#define CACHE_D 1	/* data cache, read and written by MEM */
+#define NUM_CACHES 2
+#define MAX_CACHE_LINES 1024
+#define MAX_CACHE_LINE 256	/* bytes */
+
+#define PREFETCH_NONE      0
+#define PREFETCH_NEXT_LINE 1	/* the lines after a miss or a first use of a prefetched line */
+#define PREFETCH_STRIDE    2	/* per-PC stride table, data cache only */
+#define PREFETCH_STREAM    3	/* FIFO stream buffer refilled from misses */
+#define NUM_PREFETCHERS    4
+#define MAX_PREFETCH_DEGREE 8
+#define STRIDE_TABLE_SIZE 64
+
+#define MAX_STORE_BUFFER 32
+#define MAX_COMBINE_BYTES 32	/* a combining entry covers one aligned block */
+
+#define FWD_EX_MEM 0x1	/* EX/MEM.ALUOutput, mux input 01 */
+#define FWD_MEM_WB 0x2	/* MEM/WB.ALUOutput or LMD, mux input 10 */
+
+/* activity counted for the energy model, one cost per event */
+#define ACT_FETCH     0	/* instruction word read in IF */
+#define ACT_RF_READ   1	/* register file read port in ID */
+#define ACT_ALU       2	/* operation in EX */
+#define ACT_MEM_READ  3
+#define ACT_MEM_WRITE 4
+#define ACT_RF_WRITE  5	/* register file write in WB */
+#define ACT_FORWARD   6	/* forwarding mux picks a latch over the register file */
+#define ACT_LATCH     7	/* pipeline latch bit that changed this cycle */
+#define NUM_ACTIVITY  8
+#define LATCH_SAMPLE_CYCLES 8	/* latch toggles are counted on one cycle in 8 and scaled; every cycle costs ~40% of sim speed */
+
+#define MAX_STAGE_DEPTH  16
+#define MAX_UNIT_LATENCY 64
+
+typedef struct {
+	char name[64];
+	uint32_t depth[NUM_STAGES];	/* pipelined sub-stages, 1 = one cycle */
+	uint32_t latency[NUM_UNITS];	/* cycles a unit is busy, 1 = fully pipelined */
+	int forward;			/* FWD_* paths in the datapath */
+	double energy[NUM_ACTIVITY];	/* pJ per ACT_* event */
+	uint32_t tlb_entries[NUM_TLBS];	/* 0 = no TLB on that path */
+	uint32_t tlb_ways[NUM_TLBS];	/* 0 = fully associative */
+	uint32_t tlb_miss;		/* cycles to refill an entry from the page table */
+	int tlb_refill;			/* TLB_REFILL_* */
+	uint32_t store_buffer;		/* entries, 0 = stores complete in MEM */
+	uint32_t store_drain;		/* cycles to write one entry to memory */
+	uint32_t store_combine;		/* block bytes stores merge within, 0 = none */
+	uint32_t cache_size[NUM_CACHES];	/* bytes, 0 = no cache on that path */
+	uint32_t cache_ways[NUM_CACHES];	/* 0 = fully associative */
+	uint32_t cache_line;		/* bytes per line, both caches */
+	uint32_t cache_miss;		/* cycles to fill a line from memory */
+	int prefetch[NUM_CACHES];	/* PREFETCH_* */
+	uint32_t prefetch_degree;	/* lines a trigger asks for */
+	uint32_t prefetch_distance;	/* lines between the trigger and the first of them */
+	/* derived by apply_machine() */
+	uint32_t stall_ex_mem, stall_mem_wb;	/* until a producer in that latch writes back */
+	uint32_t forward_stall_ex_mem, forward_stall_mem_wb;	/* until it reaches the forwarding point */
+	uint32_t load_stall;		/* load-use */
+	uint32_t redirect_penalty;	/* extra refill bubbles after a flush */
+	uint32_t tlb_trap;		/* a software refill also pays to enter and leave the handler */
+	uint32_t cache_lines[NUM_CACHES];
+	uint32_t line_shift;
+	int memsys;			/* some mu-mips-memsys.c model is on, picks the pipeline variant */
+} machine_t;
+
+extern machine_t MACHINE;
+extern char machine_file[256];	/* empty for the built-in default */
+extern const char *STAGE_NAMES[NUM_STAGES];
+extern const char *UNIT_NAMES[NUM_UNITS];
+extern const char *TLB_NAMES[NUM_TLBS];
+extern const char *CACHE_NAMES[NUM_CACHES];
+extern const char *PREFETCH_NAMES[NUM_PREFETCHERS];
+extern uint32_t FETCH_DELAY;	/* bubbles IF still owes after a redirect */
+extern uint32_t LATENCY_STALLS;	/* stall cycles charged for busy units */
+extern uint32_t REDIRECT_BUBBLES;
+extern const char *ACTIVITY_NAMES[NUM_ACTIVITY];
+extern uint64_t ACTIVITY[NUM_ACTIVITY];
+
+/***************************************************************/
+/* Memory system timing (mu-mips-memsys.c)                                                   */
+/*                                                                                                                             */
+/* Off unless the machine description turns a model on. Guest memory     */
+/* stays flat and every access still goes straight to MEM_REGIONS; the   */
+/* models only decide what an access costs. A wait in MEM is blocking:   */
+/* every stage holds until it is over, so back-to-back misses are paid  */
+/* one after the other. A wait in IF only inserts fetch bubbles.             */
+/*                                                                                                                             */
+/* The TLBs cache translations of 4 KB pages. The mapping is the          */
+/* identity, so a miss only looks the page up in a host-side bitmap of  */
+/* the pages touched so far; the first touch sets its bit and counts a  */
+/* page fault. Guest memory is never written.                                        */
+/*                                                                                                                             */
+/* The store buffer lets a store leave MEM at once and drain to memory   */
+/* in the background, one entry per store_drain cycles. A store to a     */
+/* block with an entry still waiting merges into it, a load whose bytes  */
+/* are all buffered is forwarded, one that only partly overlaps waits    */
+/* for the entry to drain, and a store into a full buffer waits for the  */
+/* oldest entry.                                                                                               */
+/*                                                                                                                             */
+/* The caches keep tags only, with LRU replacement. Loads, fetches and   */
+/* stores that do not go to the store buffer allocate on a miss and      */
+/* wait cache_miss cycles. A prefetcher fills lines ahead of use, each   */
+/* ready cache_miss cycles after it was asked for; a demand access that  */
+/* finds one still in flight waits the rest and counts as late.            */
+/***************************************************************/
+#define PAGE_SHIFT 12
+#define PAGE_BITMAP_SIZE (1 << (32 - PAGE_SHIFT - 3))	/* bytes, one bit per page */
+
+typedef struct {
+	uint32_t vpn[MAX_TLB_ENTRIES];
+	uint32_t used[MAX_TLB_ENTRIES];	/* access stamp for LRU, 0 = empty */
+	uint32_t last;			/* entry that hit last, checked first */
+	uint32_t accesses, misses;
+} tlb_t;
+
+typedef struct {
+	uint32_t block;			/* address of the first byte covered */
+	uint32_t mask;			/* bytes written, bit i = block + i */
+	uint32_t done;			/* cycle the entry is in memory */
+} store_entry_t;
+
+typedef struct {
+	uint32_t tag[MAX_CACHE_LINES];	/* line address, address >> line_shift */
+	uint32_t used[MAX_CACHE_LINES];	/* access stamp for LRU, 0 = empty */
+	uint32_t ready[MAX_CACHE_LINES];	/* cycle a prefetched line arrives */
+	uint8_t prefetched[MAX_CACHE_LINES];	/* prefetched and not used yet */
+	uint32_t last;
+	uint32_t stream[MAX_PREFETCH_DEGREE];	/* stream buffer lines, oldest at stream_head */
+	uint32_t stream_ready[MAX_PREFETCH_DEGREE];
+	uint32_t stream_head, stream_count;
+	uint32_t accesses, misses;
+	uint32_t issued, useful, late;	/* prefetches */
+} cache_t;
+
+typedef struct {
+	uint32_t pc;			/* load or store that trained the entry */
+	uint32_t last;			/* its previous address */
+	uint32_t stride;
+	uint32_t confidence;		/* times in a row the stride repeated */
+} stride_entry_t;
+
+typedef struct {
+	tlb_t tlb[NUM_TLBS];
+	cache_t cache[NUM_CACHES];
+	stride_entry_t strides[STRIDE_TABLE_SIZE];
+	stride_entry_t global_stride;	/* trained by every data access */
+	uint32_t stamp;			/* advances on every TLB and cache access */
+	uint32_t fetch_wait;		/* IF bubbles left on an ITLB or I-cache miss */
+	uint32_t data_wait;		/* cycles the whole pipeline still holds for MEM */
+	uint8_t *touched;		/* PAGE_BITMAP_SIZE bytes, allocated on the first walk */
+	uint32_t page_faults;		/* pages touched for the first time */
+	uint32_t walk_cycles;		/* stall and bubble cycles spent on refills */
+	store_entry_t stores[MAX_STORE_BUFFER];	/* FIFO ring */
+	uint32_t store_head, store_count;
+	uint32_t buffered, combined, forwarded;
+	uint32_t full_stalls, overlap_stalls;	/* cycles */
+} memsys_t;
+
+extern memsys_t MEMSYS;
+
 /***************************************************************/
 /* CPU State info.                                                                                                               */
 /***************************************************************/
 
-CPU_State CURRENT_STATE, NEXT_STATE;
-int RUN_FLAG;	/* run flag*/
-uint32_t INSTRUCTION_COUNT;
-uint32_t CYCLE_COUNT;
-uint32_t PROGRAM_SIZE; /*in words*/
+extern CPU_State CURRENT_STATE, NEXT_STATE;
+
+/* NEXT_STATE equals CURRENT_STATE between cycles. Stages write registers */
+/* and CP0 through SET_REG/SET_CP0 so commit_state() copies only those. */
+extern uint32_t REGS_DIRTY, CP0_DIRTY;
+#define SET_REG(r, v) do { NEXT_STATE.REGS[r] = (v); REGS_DIRTY |= 1u << (r); } while (0)
+#define SET_CP0(r, v) do { NEXT_STATE.CP0[r] = (v); CP0_DIRTY |= 1u << (r); } while (0)
+extern int RUN_FLAG;	/* run flag*/
+extern uint32_t INSTRUCTION_COUNT;
+extern uint32_t CYCLE_COUNT;
+extern uint32_t PROGRAM_SIZE; /*in words*/
 
 
 /***************************************************************/
 /* Pipeline Registers.                                                                                                        */
 /***************************************************************/
-CPU_Pipeline_Reg IF_ID;
-CPU_Pipeline_Reg ID_EX;
-CPU_Pipeline_Reg EX_MEM;
-CPU_Pipeline_Reg MEM_WB;
+extern CPU_Pipeline_Reg IF_ID;
+extern CPU_Pipeline_Reg ID_EX;
+extern CPU_Pipeline_Reg EX_MEM;
+extern CPU_Pipeline_Reg MEM_WB;
+
+extern char prog_file[256];
+extern int WATCH_PROGRAM;	/* reload prog_file before sim/run once it changes */
+extern struct timespec PROGRAM_MTIME;
 
-char prog_file[32];
+/* hazard detection state shared by ID and ForwardData */
+extern int stall;
+extern int ForwardA, ForwardB;
+extern int loadStallA, loadStallB, loadStall;
 
 /***************************************************************/
 /* Forwarding variable                                                                                                       */
 /***************************************************************/
-int ENABLE_FORWARDING = 0;
+extern int ENABLE_FORWARDING;
+
+/***************************************************************/
+/* Command interface: REPL, script files and socket server (mu-mips-shell.c) */
+/***************************************************************/
+#define CMD_LINE_SIZE 512
+#define CMD_OK   0
+#define CMD_QUIT 1
+
+#define MAX_CLIENTS 16
+#define BACKGROUND_BATCH 1024	/* cycles simulated per hold of SIM_LOCK */
+extern int SERVER_MODE;	/* run/sim/continue go to the worker thread */
+extern int SERVER_STDOUT;	/* the server's own stdout while a client's command runs */
+extern pthread_mutex_t SIM_LOCK;
+extern pthread_t SIM_WORKER;
+extern volatile int SIM_BUSY;
+extern volatile int STOP_REQUESTED;
+extern uint32_t BACKGROUND_CYCLES;
+extern int BACKGROUND_FOREVER;	/* run to completion, ignoring BACKGROUND_CYCLES */
+
+/***************************************************************/
+/* Forked worker pool for mu-mips-check and mu-mips-sweep (mu-mips-pool.c) */
+/***************************************************************/
+#define JOB_PENDING 0	/* not run yet */
+#define JOB_PASS    1	/* the worker finished and its result stands */
+#define JOB_FAIL    2	/* the worker finished but its result is wrong */
+#define JOB_ERROR   3	/* the worker could not run, crashed or never started */
+#define POOL_REPORT_SIZE 2048	/* below the pipe buffer, so a worker never blocks */
+
+/***************************************************************/
+/* Per-stage trace output                                                                                     */
+/***************************************************************/
+extern int TRACE_ENABLED;
+#define TRACE(...) do { if (TRACE_ENABLED) printf(__VA_ARGS__); } while (0)
+#define TRACE_INSTRUCTION(ir, addr) do { \
+	char trace_buf_[INSTR_STRING_SIZE]; \
+	if (TRACE_ENABLED) printf("%s\n", format_instruction(ir, addr, trace_buf_, sizeof(trace_buf_))); \
+} while (0)
+
+/***************************************************************/
+/* Specialized pipelines (mu-mips-pipeline.c)                                                      */
+/***************************************************************/
+typedef struct {
+	const char *name;
+	void (*handle_pipeline)(void);	/* one cycle of all five stages */
+} pipeline_variant_t;
+
+extern const pipeline_variant_t *PIPELINE;	/* picked by select_pipeline() at run start */
+extern int ENABLE_ACTIVITY;	/* count activity for the energy estimate */
+
+/***************************************************************/
+/* Host profile of the simulator itself (profile command, -P)                   */
+/***************************************************************/
+#define PROF_WB      0
+#define PROF_MEM     1
+#define PROF_EX      2
+#define PROF_ID      3
+#define PROF_IF      4
+#define PROF_FORWARD 5	/* inside ID */
+#define PROF_MEMORY  6	/* mem_read_32/mem_write_32, inside IF and MEM */
+#define PROF_MEMSYS  7	/* TLB, cache and store buffer model, inside IF and MEM */
+#define PROF_CYCLE   8	/* the whole of handle_pipeline */
+#define NUM_PROF     9
+#define PROFILE_SAMPLE_CYCLES 17	/* stages are timed on one cycle in 17, prime so it drifts across LATCH_SAMPLE_CYCLES */
+
+extern int ENABLE_PROFILE;
+extern int PROFILE_SAMPLE;	/* this cycle is timed */
+extern uint64_t PROFILE_TICKS[NUM_PROF];
+extern uint64_t PROFILE_CYCLES;	/* timed cycles */
+
+/* cheapest clock the host has: the TSC on x86, calibrated against CLOCK_MONOTONIC by print_profile */
+static inline uint64_t host_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/***************************************************************/
+/* Breakpoints and watchpoints                                                                                */
+/***************************************************************/
+typedef struct {
+	uint32_t pc;
+	int used;
+	int has_cond;	/* only stop if REGS[reg] <op> value when pc reaches WB */
+	int reg;
+	char op[3];
+	uint32_t value;
+} breakpoint_t;
+
+#define BREAK_TABLE_SIZE 64	/* open-addressed PC hash set, power of two */
+extern breakpoint_t BREAKPOINTS[BREAK_TABLE_SIZE];
+extern int NUM_BREAKPOINTS;
+
+#define WATCH_READ  1
+#define WATCH_WRITE 2
+typedef struct {
+	uint32_t address;	/* word aligned */
+	int mode;
+} watchpoint_t;
+
+#define MAX_WATCHPOINTS 16
+#define WATCH_PAGE_SHIFT 12
+extern watchpoint_t WATCHPOINTS[MAX_WATCHPOINTS];
+extern int NUM_WATCHPOINTS;
+extern uint8_t WATCH_PAGES[1 << (32 - WATCH_PAGE_SHIFT - 3)];	/* one armed bit per 4 KB page */
+
+extern int BREAK_FLAG;	/* set by IF/MEM/WB, the run loop stops after the cycle */
+
+/***************************************************************/
+/* Reverse execution: periodic snapshots plus per-interval undo pages         */
+/***************************************************************/
+typedef struct {
+	CPU_State current;	/* NEXT_STATE is the same between cycles */
+	CPU_Pipeline_Reg if_id, id_ex, ex_mem, mem_wb;
+	int stall, forward_a, forward_b, load_stall_a, load_stall_b, load_stall;
+	int run_flag;
+	uint32_t instruction_count, cycle_count;
+	uint32_t mem_fault_count, mem_fault_address;
+	uint32_t exception_count[NUM_EXC_CODES];
+	uint32_t kernel_cycles, flushed_count;
+	int unhandled_exception;
+	uint32_t heap_base, heap_break, heap_peak, stack_low, syscall_count;
+	uint32_t unknown_syscall_count, unknown_syscall, unknown_syscall_pc;
+	int exit_code;
+	uint32_t fetch_delay, latency_stalls, redirect_bubbles;
+	uint64_t activity[NUM_ACTIVITY];
+	memsys_t memsys;
+} sim_context_t;
+
+/***************************************************************/
+/* Lockstep batch simulation (mu-mips-wide.c)                                              */
+/***************************************************************/
+#define WIDE_LANES 8	/* one 256-bit vector of 32-bit fields */
+
+typedef struct {
+	sim_context_t *context;	/* read at the start, written back when the lane stops */
+	uint8_t *mem[NUM_MEM_REGION];	/* the lane's guest memory, read directly */
+	void *owner;		/* handed to the store callback */
+	uint32_t cycles;	/* out: cycles run in lockstep */
+} wide_lane_t;
+
+#define UNDO_PAGE_SHIFT 12
+#define UNDO_PAGE_SIZE (1 << UNDO_PAGE_SHIFT)
+typedef struct {
+	uint32_t address;
+	uint8_t data[UNDO_PAGE_SIZE];
+} undo_page_t;
+
+typedef struct {
+	sim_context_t context;	/* state at the start of the interval */
+	uint32_t epoch;		/* pages stamped >= epoch are already in undo */
+	undo_page_t *undo;	/* pages first written in the interval, old contents */
+	uint32_t num_undo, max_undo;
+	uint32_t *touched;	/* pages the TLB walk first touched in the interval */
+	uint32_t num_touched, max_touched;
+} snapshot_t;
+
+#define MAX_SNAPSHOTS 64
+#define SNAPSHOT_MEM_LIMIT (256u << 20)	/* undo bytes before old snapshots are dropped */
+#define SNAPSHOT_INTERVAL_MIN 256
+extern snapshot_t SNAPSHOTS[MAX_SNAPSHOTS];
+extern int NUM_SNAPSHOTS;
+extern int RECORDING;
+extern int REPLAYING;	/* re-simulating to a target cycle, no user output */
+extern uint32_t SNAPSHOT_INTERVAL;	/* cycles, doubles each time the table is thinned */
+extern uint32_t SNAPSHOT_EPOCH;
+extern uint32_t *PAGE_EPOCH;	/* per guest page: epoch it was last saved in */
+extern uint32_t *PAGE_MERGE_MARK;	/* per guest page: merge it is in the older interval's undo for */
+extern uint32_t MERGE_GENERATION;
+extern uint64_t UNDO_BYTES;
+
 /***************************************************************/
 /* Function Declerations.                                                                                                */
 /***************************************************************/
 void help();
 uint32_t mem_read_32(uint32_t address);
 void mem_write_32(uint32_t address, uint32_t value);
+uint32_t mem_read_8(uint32_t address);
+uint32_t mem_read_16(uint32_t address);
+void mem_write_8(uint32_t address, uint32_t value);
+void mem_write_16(uint32_t address, uint32_t value);
+uint32_t mem_read_bytes(uint32_t address, uint8_t *data, uint32_t len);
+uint32_t mem_write_bytes(uint32_t address, const uint8_t *data, uint32_t len);
+void mem_fault(uint32_t address);
+int mem_mapped(uint32_t address, uint32_t size);
+int enable_dirty_tracking();
+void mark_dirty(uint32_t address);
+void reset_dirty_pages();
 void cycle();
 void run(int num_cycles);
 void runAll();
 void mdump(uint32_t start, uint32_t stop) ;
+void mdump_rle(uint32_t start, uint32_t stop);
+int mdump_bin(const char *path, uint32_t start, uint32_t stop);
+int mdiff(const char *path, uint32_t start);
+uint8_t *mem_host_ptr(uint32_t address, uint32_t *avail);
+uint64_t page_hash(const uint8_t *data, uint32_t len);
 void rdump();
 void handle_command();
+int execute_command(const char *line);
+void stats();
+void print_footprint();
+void quit_simulator();
+int run_script(const char *path);
+void start_background_run(uint32_t cycles, int forever);
+void *background_run_main(void *);
+int run_client_command(int fd, const char *line);
+void reload_if_changed();
+int server_main(const char *path);
+int pool_workers();
+void run_pool(int count, int workers, int (*work)(int job, int fd), void (*done)(int job, int state, const char *report));
 void reset();
+void reset_registers();
+int reload(int keep);
+int program_changed();
 void init_memory();
+void map_region(int i);
+int map_file(const char *path, uint32_t address, int shared);
+int apply_file_map(file_map_t *map);
 void load_program();
-void handle_pipeline(); /*IMPLEMENT THIS*/
-void WB();/*IMPLEMENT THIS*/
-void MEM();/*IMPLEMENT THIS*/
-void EX();/*IMPLEMENT THIS*/
-void ID();/*IMPLEMENT THIS*/
-void IF();/*IMPLEMENT THIS*/
-void ForwardData();
+void load_kernel();
+uint32_t *read_program(const char *path, uint32_t *count);
+int load_sections(const asm_section_t sections[ASM_SECTIONS], int first, int last);
+int is_asm_source(const char *path);
+int assemble(const char *path, asm_section_t sections[ASM_SECTIONS]);
+void free_sections(asm_section_t sections[ASM_SECTIONS]);
+void clear_symbols();
+void add_symbol(const char *name, uint32_t address);
+void sort_symbols();
+const symbol_t *symbol_at(uint32_t address, uint32_t *offset);
+int lookup_symbol(const char *name, uint32_t *address);
+int parse_address(const char *s, uint32_t *address);
+char *format_address(uint32_t address, char *buf, size_t size);
+void init_decoder();
+const instr_desc_t *decode_instruction(uint32_t ir);
+int register_use(const instr_desc_t *d);
+char *format_instruction(uint32_t ir, uint32_t addr, char *buf, size_t size);
+char *format_target(uint32_t address, char *buf, size_t size);
+void default_machine(machine_t *m);
+void apply_machine(machine_t *m);
+int machine_line(machine_t *m, char *line, const char *origin, int lineno);
+int check_machine(const machine_t *m, const char *origin);
+int load_machine(const char *path);
+int parse_machine(const char *text);
+void print_machine();
+int instruction_unit(uint32_t ir);
+uint32_t unit_busy(uint32_t ir);
+int writes_register(uint32_t ir);
+void count_latch_toggles(const CPU_Pipeline_Reg before[4]);
+double activity_energy();
+void print_energy();
+void select_pipeline();
+void reset_profile();
+void print_profile();
+void reset_memsys();
+int memsys_fetch_wait(uint32_t pc);
+uint32_t memsys_data(uint32_t pc, uint32_t address, uint32_t opcode);
+void print_memsys();
+int wide_supported();
+int wide_eligible(const sim_context_t *ctx);
+void wide_run(wide_lane_t *lanes, int n, uint32_t cycles, int forwarding, int activity,
+	void (*store)(void *owner, uint32_t address, uint32_t value, uint32_t size));
+void commit_state();
+int reserved_instruction(uint32_t ir);
+int interrupt_pending();
+void take_exception(uint32_t code, uint32_t epc, uint32_t badvaddr);
+void take_interrupt();
+void flush_and_redirect(uint32_t target);
+const char *exception_name(uint32_t code);
+void print_unhandled_exception();
+void host_syscall();
+void guest_output(const char *data, uint32_t len);
+void flush_guest_output();
+void reset_syscalls();
+void set_heap_base(uint32_t data_end);
+void clear_syscall_log();
+syscall_record_t *find_syscall_record(uint32_t cycle);
+void log_syscall(uint32_t v0, uint32_t address, const uint8_t *data, uint32_t len);
+int add_breakpoint(uint32_t pc, const char *cond);
+void remove_breakpoint(uint32_t pc);
+int check_breakpoint(uint32_t pc, int retiring);
+int parse_register(const char *name);
+int add_watchpoint(uint32_t address, int mode);
+void remove_watchpoint(uint32_t address);
+void check_watchpoint(uint32_t address, int mode, uint32_t value);
+void save_context(sim_context_t *ctx);
+void restore_context(const sim_context_t *ctx);
+void set_recording(int on);
+void take_snapshot();
+void free_snapshot(snapshot_t *snap);
+void add_touched_page(snapshot_t *snap, uint32_t vpn);
+void thin_snapshots();
+void record_page(uint32_t address);
+void record_touched_page(uint32_t vpn);
+int restore_snapshot(int k);
+void replay_to(uint32_t cycle, uint32_t *last_hit);
+void reverse_step(uint32_t n);
+void reverse_continue();
 void show_pipeline();/*IMPLEMENT THIS*/
+void show_latch(const char *name, const CPU_Pipeline_Reg *latch);
 void initialize();
 void print_program(); /*IMPLEMENT THIS*/
 void print_instruction(uint32_t);
+
+#endif
@@ -0,0 +1,36 @@
+# Pseudo-instructions and the operations they expand to: li (addiu, ori
+# or lui + ori), la, move (addu), not (nor) and neg (sub), then the
+# shifts and the set-on-less-than family
+	.data
+val:	.word 0x12345678
+out:	.word 0, 0, 0, 0, 0, 0, 0
+
+	.text
+main:
+	li	$t0, -5
+	li	$t1, 0xBEEF
+	li	$t2, 0x12345678
+	la	$t3, val
+	lw	$t4, 0($t3)
+	move	$s0, $t4
+	not	$s1, $t1
+	neg	$s2, $t0
+	sll	$s3, $t1, 4
+	sra	$s4, $t0, 1
+	srl	$s5, $t0, 28
+	slt	$s6, $t0, $s2
+	sltu	$s7, $t0, $s2
+	subu	$t5, $t2, $t4
+	sltiu	$t6, $t5, 1
+	andi	$t7, $t2, 0xFF
+	sllv	$t9, $t6, $s2
+	la	$t8, out
+	sw	$s1, 0($t8)
+	sw	$s2, 4($t8)
+	sw	$s3, 8($t8)
+	sw	$s4, 12($t8)
+	sw	$t6, 16($t8)
+	sw	$t7, 20($t8)
+	sw	$t9, 24($t8)
+	li	$v0, 10
+	syscall
@@ -0,0 +1,24 @@
+# Sum and mix the words of arr, using labels, .data and the
+# lui-based addressing the assembler emits for "lw rt, label"
+	.data
+arr:	.word 3, 5, 7, 11
+result:	.word 0, 0, 0
+
+	.text
+main:
+	lw	$t0, arr
+	lw	$t1, arr+4
+	lw	$t2, arr+8
+	lw	$t3, arr+12
+	add	$t4, $t0, $t1
+	add	$t4, $t4, $t2
+	add	$t4, $t4, $t3
+	sw	$t4, result
+	xor	$t5, $t0, $t3
+	sw	$t5, result+4
+	sub	$t6, $t3, $t0
+	and	$t7, $t6, $t1
+	or	$t7, $t7, $t2
+	sw	$t7, result+8
+	addiu	$v0, $zero, 10
+	syscall